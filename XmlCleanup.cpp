@@ -1,15 +1,46 @@
+#include "XmlCanonicalReader.h"
+#include "XmlFormatter.h"
+#include "XmlHash.h"
 #include "XmlIndenter.h"
+#include "XmlLineIndex.h"
+#include "XmlMappedFile.h"
+#include "XmlOutputCache.h"
+#include "XmlPerfCounters.h"
+#include "XmlPipeline.h"
+#include "XmlScanStress.h"
+#include "XmlSlowCapture.h"
+#include "XmlStructureIndex.h"
+#include "XmlRecordSplitter.h"
+#include "XmlStructureStats.h"
+#include "XmlTarRewriter.h"
+#include "XmlTrace.h"
+#include "XmlValidator.h"
 
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
-// Find all XML and XSD files in a directory and its subdirectories.
-std::vector<std::filesystem::path> findXmlAndXsdFiles(const std::filesystem::path& directoryPath)
+// Bytes of file contents the batch pipeline may hold in memory at once.
+#define XML_PIPELINE_MAX_BYTES_IN_FLIGHT (256ULL * 1024 * 1024)
+
+// Size of the --fuzz inputs (and four times that): smaller ones are timed while the caches warm up, which reads as super-linear growth.
+#define XML_FUZZ_INPUT_SIZE (1024 * 1024)
+
+// Find all XML and XSD files in a directory and its subdirectories. The excluded directory (such as an output directory inside the tree) is not entered.
+std::vector<std::filesystem::path> findXmlAndXsdFiles(const std::filesystem::path& directoryPath, const std::filesystem::path& excludedPath = std::filesystem::path())
 {
+	std::string directoryString = (XmlTrace::isEnabled() ? directoryPath.string() : std::string());
+	XmlTraceScope trace("discovery", &directoryString);
 	std::vector<std::filesystem::path> xmlFiles;
 
 	try
@@ -21,10 +52,16 @@ std::vector<std::filesystem::path> findXmlAndXsdFiles(const std::filesystem::pat
 			return xmlFiles;
 		}
 
-		// Recursively iterate through the directory and subdirectories.
-		for (const std::filesystem::recursive_directory_iterator::value_type& entry : std::filesystem::recursive_directory_iterator(directoryPath))
+		// Recursively iterate through the directory and subdirectories. Paths are compared canonical, so that "out" and "./out/" are the same directory.
+		std::filesystem::path excludedDirectory = (excludedPath.empty() ? std::filesystem::path() : std::filesystem::weakly_canonical(excludedPath));
+		for (std::filesystem::recursive_directory_iterator it(directoryPath), end; it != end; ++it)
 		{
-			if (entry.is_regular_file())
+			const std::filesystem::directory_entry& entry = *it;
+			if (!excludedDirectory.empty() && entry.is_directory() && std::filesystem::weakly_canonical(entry.path()) == excludedDirectory)
+			{
+				it.disable_recursion_pending();
+			}
+			else if (entry.is_regular_file())
 			{
 				// Check if the file has .xml or .xsd extension.
 				std::string extension = entry.path().extension().string();
@@ -43,6 +80,42 @@ std::vector<std::filesystem::path> findXmlAndXsdFiles(const std::filesystem::pat
 	return xmlFiles;
 }
 
+// Keep the files of one shard out of count, for splitting a tree cleanup between independent processes sharing a checkout.
+// Every process computes the same assignment without coordination, from the path of each file relative to the root only (rendezvous hashing: the file goes to the shard
+// with the highest hash of its path seeded by the shard number). Sizes are not used: shards format files in place, so they change while other shards select theirs.
+std::vector<std::filesystem::path> selectShard(const std::vector<std::filesystem::path>& files, const std::filesystem::path& rootPath, size_t shard, size_t count)
+{
+	std::vector<bool> selected(files.size(), false);
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		// Ties go to the lowest shard.
+		std::string relativePath = files[i].lexically_relative(rootPath).generic_string();
+		size_t target = 0;
+		uint64_t bestScore = 0;
+		for (size_t candidate = 0; candidate < count; ++candidate)
+		{
+			uint64_t score = QuickXml::XmlHasher::hash(relativePath.data(), relativePath.length(), candidate + 1);
+			if (candidate == 0 || score > bestScore)
+			{
+				target = candidate;
+				bestScore = score;
+			}
+		}
+		selected[i] = (target == shard);
+	}
+
+	// The traversal order is kept inside the shard.
+	std::vector<std::filesystem::path> res;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		if (selected[i])
+		{
+			res.push_back(files[i]);
+		}
+	}
+	return res;
+}
+
 void printUsage()
 {
 	std::cout << "XmlCleanup - A tool for indenting XML files\n";
@@ -55,7 +128,45 @@ void printUsage()
 	std::cout << "  -f, --full-format    Full formatting (adds linebreaks)\n";
 	std::cout << "  -a, --auto-close     Auto-close empty elements (default)\n";
 	std::cout << "  -n, --no-auto-close  Don't auto-close empty elements\n";
+	std::cout << "  -o DIR, --output-dir DIR  Write the outputs of a directory input to a mirror of its tree under DIR instead of the files, unchanged files are copied by the kernel\n";
+	std::cout << "  -j N, --jobs N       Process directories with a read/format/write pipeline using N formatter threads (0: one per core)\n";
+	std::cout << "  --shard I/N          Only process the I-th (1-based) of N shards of a directory, for splitting the work between independent processes\n";
+	std::cout << "  --stdout             Format all following inputs (files or directories) to stdout in input order, also with -j\n";
+	std::cout << "  --cache DIR          Reuse formatted outputs stored in the DIR content-addressed cache\n";
+	std::cout << "  --cache-size MB      Size bound of the cache, least recently used entries are evicted (default 512)\n";
+	std::cout << "  --validate           Check well-formedness while formatting, invalid files are reported and not written\n";
+	std::cout << "  --range B:E          Reindent only bytes [B, E) (widened to whole lines) and output the replacement text of that range\n";
+	std::cout << "  --lines A:B          Reindent only lines A to B (1-based, inclusive) and output the replacement text of those lines\n";
+	std::cout << "  --variant SPEC FILE  Also write the input-file formatted with the comma-separated options of SPEC (t, sN, i, f, a, n, or m to minify) to FILE, can be repeated\n";
+	std::cout << "                       The normal output and all variants are produced from a single parse of the input\n";
+	std::cout << "  --verify             Check that formatting only changed insignificant whitespace, files failing the check are not written\n";
+	std::cout << "  --compare            Compare input-file and output-file ignoring formatting, and report their first semantic difference\n";
+	std::cout << "  --fingerprint        Print a hash of the significant content of input files, insensitive to formatting, instead of formatting\n";
+	std::cout << "  --tar                The input-file is a tar archive: its XML and XSD members are formatted in a single streaming pass into output-file\n";
+	std::cout << "                       (default: replace the archive), other members are copied untouched\n";
+	std::cout << "  --split SPEC         Split the input-file into files of records instead of formatting, the records being the outermost elements matching SPEC:\n";
+	std::cout << "                       a name (record), a path of names (records/record) or an absolute path (/export/records/record); files go next to\n";
+	std::cout << "                       the input-file (or to the -o directory) as input-NNNNNN.xml, written by -j threads\n";
+	std::cout << "  --split-records N    Maximum records per file of --split (default 1), records under other ancestors start a new file\n";
+	std::cout << "  --split-format       Format the files written by --split\n";
+	std::cout << "  --stats-structure    Print statistics of the structure of input files instead of formatting: name frequencies, depths, largest nodes, ...\n";
+	std::cout << "  --path POS           Print the element path at POS (line:column or byte offset) instead of formatting, can be repeated\n";
+	std::cout << "  --index              Build the structural index of the input-file next to it (input-file.xcidx), or refresh it if stale, instead of formatting;\n";
+	std::cout << "                       --path, --range and --lines use a valid index to start near the queried positions\n";
+	std::cout << "  --stress MB          Time adversarial inputs of MB megabytes at 1x and 4x size and report super-linear ones (no input-file)\n";
+	std::cout << "  --fuzz N             Check N random inputs made of markup fragments for super-linear time (no input-file)\n";
+	std::cout << "  --seed S             Seed of --fuzz, to replay a reported failure\n";
+	std::cout << "  --trace FILE         Record the phases of every thread (discovery, read, format, write, ...) and write them as Chrome trace-event JSON to FILE at exit\n";
+	std::cout << "  --multi-document     The input-file is a concatenation of documents, each starting with its XML declaration: they are formatted independently,\n";
+	std::cout << "                       in parallel with -j, and output in order\n";
+	std::cout << "  --bench-threads N    Benchmark the pipeline on the input-file directory at 1, 2, 4, ... N formatter threads (0: one per core) and report throughput,\n";
+	std::cout << "                       parallel efficiency and where the time goes, outputs are not written\n";
+	std::cout << "  --slow-threshold NS  Capture the files formatted slower than NS nanoseconds per byte (and slower than 1 ms), with a report of their timing and options\n";
+	std::cout << "  --capture-dir DIR    Directory of the captured files (default slow-inputs)\n";
+	std::cout << "  --capture-bytes N    Only copy the first N bytes of captured files (default: whole files)\n";
+	std::cout << "  --counters           Count cycles, instructions, branch misses and LLC misses of the formatting phases of every file and report them on stderr at exit (Linux)\n";
 	std::cout << "\n";
+	std::cout << "If input-file is a directory, all XML and XSD files in it and its subfolders will be indented.\n";
 	std::cout << "If no arguments are given, all XML and XSD files in the current folder and subfolders will be indented\n";
 	std::cout << "using tabs for indentation and indent-only mode.\n";
 	std::cout << "\n";
@@ -64,11 +175,11 @@ void printUsage()
 
 std::string readFile(const std::string& filename)
 {
+	XmlTraceScope trace("read", &filename);
 	std::ifstream file(filename, std::ios::binary);
 	if (!file.is_open())
 	{
-		std::cerr << "Error: Cannot open input file: " << filename << std::endl;
-		exit(1);
+		throw std::runtime_error("Cannot open input file: " + filename);
 	}
 
 	std::stringstream buffer;
@@ -78,6 +189,7 @@ std::string readFile(const std::string& filename)
 
 void writeFile(const std::string& filename, const std::string& content)
 {
+	XmlTraceScope trace("write", &filename);
 	std::ofstream file(filename, std::ios::binary);
 	if (!file.is_open())
 	{
@@ -88,145 +200,1386 @@ void writeFile(const std::string& filename, const std::string& content)
 	file << content;
 }
 
-// Process a single XML file with the given formatting settings.
-bool processXmlFile(const std::filesystem::path& inputPath, const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements)
+// Format an XML document. When a cache is given, identical content formatted with identical settings is never formatted twice.
+// When a validator is given, the document is checked in the same pass. Only well-formed documents are cached then.
+std::string formatXmlContent(const std::string& xmlContent, const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements, XmlOutputCache* cache, QuickXml::XmlValidator* validator)
 {
-	try
+	std::string formattedXml;
+	std::string optionsKey;
+	if (validator != NULL)
 	{
-		// Read input file.
-		std::string xmlContent = readFile(inputPath.string());
+		validator->reset();
+	}
+
+	if (cache != NULL)
+	{
+		optionsKey = XmlOutputCache::makeOptionsKey(indentStr, eolStr, indentOnly, autoCloseEmptyElements, validator != NULL);
+		switch (cache->lookup(xmlContent, optionsKey, formattedXml))
+		{
+			case XmlCacheResult::Clean:
+				return xmlContent;
 
-		// Create XML indenter.
-		XmlIndenter indenter(xmlContent, indentStr, eolStr, indentOnly, autoCloseEmptyElements);
+			case XmlCacheResult::Formatted:
+				return formattedXml;
 
-		// Indent XML.
-		std::string formattedXml = indenter.indentXML();
+			case XmlCacheResult::Miss:
+			default:
+				break;
+		}
+	}
 
-		// Write back to the same file.
-		writeFile(inputPath.string(), formattedXml);
-		std::cout << "Formatted: " << inputPath.string() << std::endl;
+	// Create XML indenter.
+	XmlIndenter indenter(xmlContent, indentStr, eolStr, indentOnly, autoCloseEmptyElements);
 
-		return true;
+	// Indent XML.
+	indenter.setValidator(validator);
+	formattedXml = indenter.indentXML();
+
+	if (cache != NULL && (validator == NULL || validator->isValid()))
+	{
+		cache->store(xmlContent, optionsKey, formattedXml);
 	}
-	catch (const std::exception& e)
+
+	return formattedXml;
+}
+
+// Start the per file reports of a formatting: drops the phases recorded before it (reading, or writing the previous file). Returns the start time.
+uint64_t beginFileReports()
+{
+	if (!XmlSlowCapture::isEnabled())
 	{
-		std::cerr << "Error processing " << inputPath.string() << ": " << e.what() << std::endl;
-		return false;
+		return 0;
 	}
+
+	XmlTrace::takePhaseTimes();
+	return XmlTrace::now();
 }
 
-int main(int argc, char* argv[])
+// End the per file reports of the formatting of xmlContent started at reportBegin: keeps its hardware counters, and captures it when it was slow.
+void endFileReports(const std::string& path, const std::string& xmlContent, uint64_t reportBegin)
 {
-	// Default settings.
-	std::string indentStr = "\t";
-	std::string eolStr = "\n";
-	bool indentOnly = true;
-	bool autoCloseEmptyElements = true;
-	std::string inputFile;
-	std::string outputFile;
+	if (XmlPerfCounters::isEnabled())
+	{
+		XmlPerfCounters::endFile(path);
+	}
 
-	// Check if no arguments were provided.
-	if (argc == 1)
+	if (XmlSlowCapture::isEnabled())
 	{
-		std::cout << "No arguments provided. Processing all XML and XSD files in current directory and subdirectories...\n";
+		uint64_t elapsed = XmlTrace::now() - reportBegin;
+		XmlSlowCapture::check(path, xmlContent, elapsed, XmlTrace::takePhaseTimes());
+	}
+}
+
+// Format the validation errors of a document, one "path:line:column: message" line per error.
+std::string formatValidationErrors(const std::string& path, const QuickXml::XmlValidator& validator)
+{
+	std::ostringstream res;
+	for (const QuickXml::XmlValidationError& error : validator.getErrors())
+	{
+		res << path << ":" << error.position.toString() << ": " << error.message << " (offset " << error.offset << ")\n";
+	}
+	return res.str();
+}
+
+// Describe the first semantic difference between two documents, with its position in both. Returns an empty string when they are equivalent.
+std::string describeDifference(const std::string& leftPath, const std::string& left, const std::string& rightPath, const std::string& right)
+{
+	QuickXml::XmlCanonicalDifference difference = QuickXml::XmlCanonicalReader::compare(left.data(), left.length(), right.data(), right.length());
+	if (difference.equivalent)
+	{
+		return std::string();
+	}
+
+	// Only built when a difference is found.
+	QuickXml::XmlLineIndex leftLines(left.data(), left.length());
+	QuickXml::XmlLineIndex rightLines(right.data(), right.length());
+	std::ostringstream res;
+	res << leftPath << ":" << leftLines.positionOf(difference.leftOffset).toString() << " (offset " << difference.leftOffset << ") / ";
+	res << rightPath << ":" << rightLines.positionOf(difference.rightOffset).toString() << " (offset " << difference.rightOffset << "): " << difference.description;
+	return res.str();
+}
+
+// Parse a "first<separator>second" pair of numbers.
+bool parseNumberPair(const std::string& str, char separator, size_t& first, size_t& second)
+{
+	size_t pos = str.find(separator);
+	if (pos == std::string::npos || pos == 0 || pos + 1 >= str.length() || str.find_first_not_of("0123456789", pos + 1) != std::string::npos || str.find_first_not_of("0123456789") != pos)
+	{
+		return false;
+	}
 
-		// Find all XML and XSD files in current directory and subdirectories.
-		std::vector<std::filesystem::path> xmlFiles = findXmlAndXsdFiles(".");
+	first = std::stoull(str.substr(0, pos));
+	second = std::stoull(str.substr(pos + 1));
+	return true;
+}
 
-		if (xmlFiles.empty())
+// Parse a --variant specification: comma-separated options among t (tabs), sN (N spaces), i (indent only), f (full format), a (auto-close), n (no auto-close) and m (minify), applied over the given settings.
+bool parseVariant(const std::string& spec, std::string indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements, QuickXml::XmlFormatterVariant& variant)
+{
+	variant.linearize = false;
+	std::istringstream options(spec);
+	std::string option;
+	while (std::getline(options, option, ','))
+	{
+		if (option == "t")
 		{
-			std::cout << "No XML or XSD files found.\n";
-			return 0;
+			indentStr = "\t";
+		}
+		else if (option.length() > 1 && option[0] == 's' && option.find_first_not_of("0123456789", 1) == std::string::npos)
+		{
+			indentStr = std::string(std::stoul(option.substr(1)), ' ');
+		}
+		else if (option == "i")
+		{
+			indentOnly = true;
+		}
+		else if (option == "f")
+		{
+			indentOnly = false;
+		}
+		else if (option == "a")
+		{
+			autoCloseEmptyElements = true;
+		}
+		else if (option == "n")
+		{
+			autoCloseEmptyElements = false;
+		}
+		else if (option == "m")
+		{
+			variant.linearize = true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	variant.params = XmlIndenter::makeFormatterParams(indentStr, eolStr, indentOnly, autoCloseEmptyElements);
+	return true;
+}
+
+// Load the structural index of an input file, or build and save it when asked and it is missing or stale. Returns false when there is no valid index file.
+bool openStructureIndex(const std::string& inputFile, const char* data, size_t length, bool build, QuickXml::XmlStructureIndex& index)
+{
+	std::filesystem::path indexPath = QuickXml::XmlStructureIndex::sidecarPath(inputFile);
+	QuickXml::XmlIndexSource source = QuickXml::XmlStructureIndex::describe(inputFile, data, length);
+	if (index.load(indexPath, source))
+	{
+		if (build)
+		{
+			std::cerr << "Index: " << indexPath.string() << " is up to date" << std::endl;
 		}
+		return true;
+	}
+	if (!build)
+	{
+		return false;
+	}
 
-		std::cout << "Found " << xmlFiles.size() << " XML/XSD files to process.\n";
+	index.build(data, length, source);
+	if (!index.save(indexPath))
+	{
+		std::cerr << "Error: Cannot write index file: " << indexPath.string() << std::endl;
+		return false;
+	}
+	std::cerr << "Index: " << indexPath.string() << " (" << index.getCheckpointCount() << " checkpoints, " << index.getElementCount() << " elements)" << std::endl;
+	return true;
+}
 
-		// Process each file with default settings.
-		int successCount = 0;
-		for (const std::filesystem::path& file : xmlFiles)
+// Print the element path of every queried position (line:column, or byte offset) as "line:column path".
+// With an index, only the content from the nearest checkpoint before each position is scanned.
+int printPaths(const char* data, size_t length, const std::vector<std::string>& positions, const QuickXml::XmlStructureIndex* index)
+{
+	if (index != NULL)
+	{
+		int res = 0;
+		for (const std::string& str : positions)
 		{
-			if (processXmlFile(file, indentStr, eolStr, indentOnly, autoCloseEmptyElements))
+			QuickXml::XmlLinePosition position;
+			size_t offset = 0;
+			try
+			{
+				if (QuickXml::XmlLinePosition::parse(str, position))
+				{
+					offset = index->offsetOf(data, length, position);
+				}
+				else if (!str.empty() && str.find_first_not_of("0123456789") == std::string::npos)
+				{
+					offset = std::min<size_t>(std::stoull(str), length);
+					position = index->positionOf(data, length, offset);
+				}
+				else
+				{
+					std::cerr << "Error: Invalid position " << str << ", expected line:column or a byte offset\n";
+					res = 1;
+					continue;
+				}
+			}
+			catch (const std::out_of_range& e)
 			{
-				successCount++;
+				std::cerr << "Error: " << e.what() << std::endl;
+				res = 1;
+				continue;
 			}
+			std::cout << position.toString() << " " << index->path(data, length, offset) << "\n";
 		}
+		return res;
+	}
 
-		std::cout << "Successfully processed " << successCount << " out of " << xmlFiles.size() << " files.\n";
+	QuickXml::XmlLineIndex lines(data, length);
+	QuickXml::XmlFormatter formatter(data, length);
+	int res = 0;
+	for (const std::string& str : positions)
+	{
+		QuickXml::XmlLinePosition position;
+		if (!QuickXml::XmlLinePosition::parse(str, position))
+		{
+			if (str.empty() || str.find_first_not_of("0123456789") != std::string::npos)
+			{
+				std::cerr << "Error: Invalid position " << str << ", expected line:column or a byte offset\n";
+				res = 1;
+				continue;
+			}
+			position = lines.positionOf(std::stoull(str));
+		}
 
-		return 0;
+		try
+		{
+			std::stringstream* path = formatter.currentPath(lines, position);
+			std::cout << position.toString() << " " << path->str() << "\n";
+		}
+		catch (const std::out_of_range& e)
+		{
+			std::cerr << "Error: " << e.what() << std::endl;
+			res = 1;
+		}
 	}
+	return res;
+}
 
-	// Parse command-line arguments.
-	std::vector<std::string> args(argv + 1, argv + argc);
+// Print a stress result line, returns false for a failure.
+bool printStressResult(const XmlScanStressResult& result)
+{
+	bool passed = (!result.superLinear && !result.outOfBounds);
+	std::cout << (passed ? "OK    " : "FAIL  ") << std::left << std::setw(34) << result.name << std::right << std::fixed << std::setprecision(2);
+	std::cout << std::setw(10) << (result.smallSeconds * 1000) << " ms (" << result.smallSize << " bytes)" << std::setw(10) << (result.largeSeconds * 1000) << " ms (" << result.largeSize << " bytes)";
+	std::cout << (result.superLinear ? "  super-linear" : "") << (result.outOfBounds ? "  out of bounds" : "") << "\n";
+	return passed;
+}
 
-	for (size_t i = 0; i < args.size(); ++i)
+// Run the adversarial benchmark (stressMB not zero) and the fuzzer (fuzzIterations not zero). Returns 1 when any scan is super-linear.
+int runStress(size_t stressMB, size_t fuzzIterations, uint64_t seed)
+{
+	bool passed = true;
+	if (stressMB > 0)
 	{
-		if (args[i] == "-h" || args[i] == "--help")
+		for (const XmlScanStressResult& result : XmlScanStress::benchmark(stressMB * 1024 * 1024))
 		{
-			printUsage();
-			return 0;
+			passed = printStressResult(result) && passed;
 		}
-		else if (args[i] == "-t" || args[i] == "--tabs")
+	}
+
+	if (fuzzIterations > 0)
+	{
+		std::cout << "Fuzzing " << fuzzIterations << " inputs from seed " << seed << "\n";
+		std::vector<XmlScanStressResult> failures = XmlScanStress::fuzz(fuzzIterations, XML_FUZZ_INPUT_SIZE, seed);
+		for (const XmlScanStressResult& result : failures)
 		{
-			indentStr = "\t";
+			printStressResult(result);
 		}
-		else if (args[i] == "-s" || args[i] == "--spaces")
+		std::cout << failures.size() << " failing inputs\n";
+		passed = passed && failures.empty();
+	}
+	return (passed ? 0 : 1);
+}
+
+// Process a single XML file with the given formatting settings. The output goes to outputPath, which is the input file for in place formatting.
+bool processXmlFile(const std::filesystem::path& inputPath, const std::filesystem::path& outputPath, const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements, XmlOutputCache* cache, bool validate, bool verify)
+{
+	try
+	{
+		// Read input file.
+		std::string xmlContent = readFile(inputPath.string());
+
+		// Indent XML.
+		uint64_t reportBegin = beginFileReports();
+		QuickXml::XmlValidator validator;
+		std::string formattedXml = formatXmlContent(xmlContent, indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache, validate ? &validator : NULL);
+		endFileReports(inputPath.string(), xmlContent, reportBegin);
+
+		// Invalid files are left untouched.
+		if (!validator.isValid())
 		{
-			if (i + 1 < args.size() && args[i + 1][0] != '-')
-			{
-				int spaces = std::stoi(args[i + 1]);
-				indentStr = std::string(spaces, ' ');
-				i++;
-			}
-			else
+			std::cerr << "Invalid: " << inputPath.string() << "\n" << formatValidationErrors(inputPath.string(), validator);
+			return false;
+		}
+
+		// The formatted document must have the same significant content.
+		std::string difference = (verify ? describeDifference(inputPath.string(), xmlContent, "formatted", formattedXml) : std::string());
+		if (!difference.empty())
+		{
+			std::cerr << "Verification failed: " << difference << std::endl;
+			return false;
+		}
+
+		// Already clean files are not rewritten, their modification time is preserved. In a mirror, they are copied by the kernel.
+		if (formattedXml == xmlContent)
+		{
+			if (outputPath != inputPath)
 			{
-				indentStr = "  "; // Default to 2 spaces.
+				XmlPipeline::copyWholeFile(inputPath, outputPath);
 			}
+			std::cout << "Unchanged: " << inputPath.string() << std::endl;
+			return true;
 		}
-		else if (args[i] == "-i" || args[i] == "--indent-only")
+
+		// Write to the output file.
+		writeFile(outputPath.string(), formattedXml);
+		std::cout << "Formatted: " << inputPath.string() << std::endl;
+
+		return true;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Error processing " << inputPath.string() << ": " << e.what() << std::endl;
+		return false;
+	}
+}
+
+// XmlCleanupProcessor: The formatting stage of the batch pipeline.
+class XmlCleanupProcessor : public XmlJobProcessor
+{
+private:
+	std::string indentStr;
+	std::string eolStr;
+	bool indentOnly;
+	bool autoCloseEmptyElements;
+	XmlOutputCache* cache;
+	bool validate;
+	bool verify;
+
+public:
+	// Constructor.
+	XmlCleanupProcessor(const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements, XmlOutputCache* cache, bool validate, bool verify) : indentStr(indentStr), eolStr(eolStr), indentOnly(indentOnly), autoCloseEmptyElements(autoCloseEmptyElements), cache(cache), validate(validate), verify(verify)
+	{
+	}
+
+	// Format a file read by the pipeline.
+	void process(XmlPipelineJob& job) override
+	{
+		uint64_t reportBegin = beginFileReports();
+		QuickXml::XmlValidator validator;
+		job.output = formatXmlContent(job.input, this->indentStr, this->eolStr, this->indentOnly, this->autoCloseEmptyElements, this->cache, this->validate ? &validator : NULL);
+		endFileReports(job.path.string(), job.input, reportBegin);
+		if (!validator.isValid())
 		{
-			indentOnly = true;
+			// Invalid files are left untouched.
+			job.output.clear();
+			job.failed = true;
+			job.message = "not well-formed\n" + formatValidationErrors(job.path.string(), validator);
+			job.message.pop_back();
+			return;
 		}
-		else if (args[i] == "-f" || args[i] == "--full-format")
+
+		std::string difference = (this->verify ? describeDifference(job.path.string(), job.input, "formatted", job.output) : std::string());
+		if (!difference.empty())
 		{
-			indentOnly = false;
+			job.output.clear();
+			job.failed = true;
+			job.message = "verification failed: " + difference;
+			return;
 		}
-		else if (args[i] == "-a" || args[i] == "--auto-close")
+
+		job.writeOutput = (job.output != job.input);
+		if (job.writeOutput)
 		{
-			autoCloseEmptyElements = true;
+			job.message = "Formatted: " + job.path.string();
 		}
-		else if (args[i] == "-n" || args[i] == "--no-auto-close")
+		else
 		{
-			autoCloseEmptyElements = false;
+			// Already clean files are not rewritten. Release the copy early, it counts in the bytes in flight.
+			job.output.clear();
+			job.message = "Unchanged: " + job.path.string();
 		}
-		else if (inputFile.empty() && args[i][0] != '-')
+	}
+};
+
+// XmlBenchmarkProcessor: The formatting stage of the thread-scaling benchmark. Files are formatted as by XmlCleanupProcessor, nothing is written.
+class XmlBenchmarkProcessor : public XmlCleanupProcessor
+{
+public:
+	using XmlCleanupProcessor::XmlCleanupProcessor;
+
+	// Format a file read by the pipeline, and drop the output.
+	void process(XmlPipelineJob& job) override
+	{
+		XmlCleanupProcessor::process(job);
+		job.writeOutput = false;
+		job.output.clear();
+	}
+};
+
+// XmlFingerprintProcessor: The pipeline stage computing fingerprints. Nothing is written.
+class XmlFingerprintProcessor : public XmlJobProcessor
+{
+public:
+	// Fingerprint a file read by the pipeline.
+	void process(XmlPipelineJob& job) override
+	{
+		job.message = QuickXml::XmlHasher::toHex(QuickXml::XmlCanonicalReader::fingerprint(job.input.data(), job.input.length())) + "  " + job.path.string();
+		job.writeOutput = false;
+		job.input.clear();
+	}
+};
+
+// Print the fingerprint of a file, or of all XML and XSD files of a directory (only the ones of the given shard when shardCount is not zero), as "fingerprint  path" lines.
+int printFingerprints(const std::filesystem::path& inputPath, size_t jobs, size_t shard, size_t shardCount)
+{
+	std::vector<std::filesystem::path> xmlFiles;
+	if (std::filesystem::is_directory(inputPath))
+	{
+		xmlFiles = findXmlAndXsdFiles(inputPath);
+		if (shardCount > 0)
 		{
-			inputFile = args[i];
+			xmlFiles = selectShard(xmlFiles, inputPath, shard, shardCount);
 		}
-		else if (!inputFile.empty() && outputFile.empty() && args[i][0] != '-')
+	}
+	else
+	{
+		xmlFiles.push_back(inputPath);
+	}
+
+	if (jobs > 0)
+	{
+		XmlFingerprintProcessor processor;
+		XmlPipeline pipeline(processor, jobs, XML_PIPELINE_MAX_BYTES_IN_FLIGHT);
+		return (pipeline.run(xmlFiles) == xmlFiles.size() ? 0 : 1);
+	}
+
+	for (const std::filesystem::path& file : xmlFiles)
+	{
+		std::string xmlContent = readFile(file.string());
+		std::cout << QuickXml::XmlHasher::toHex(QuickXml::XmlCanonicalReader::fingerprint(xmlContent.data(), xmlContent.length())) << "  " << file.string() << "\n";
+	}
+	return 0;
+}
+
+// Print the structure statistics of a file, or of all XML and XSD files of a directory (only the ones of the given shard when shardCount is not zero).
+// With jobs, files are taken by that many threads, each collecting its own statistics, merged at the end.
+int printStructureStats(const std::filesystem::path& inputPath, size_t jobs, size_t shard, size_t shardCount)
+{
+	std::vector<std::filesystem::path> xmlFiles;
+	if (std::filesystem::is_directory(inputPath))
+	{
+		xmlFiles = findXmlAndXsdFiles(inputPath);
+		if (shardCount > 0)
 		{
-			outputFile = args[i];
+			xmlFiles = selectShard(xmlFiles, inputPath, shard, shardCount);
 		}
 	}
-
-	// Check if input file is provided (we only get here if arguments were passed).
-	if (inputFile.empty())
+	else
 	{
-		std::cerr << "Error: No valid input file specified\n";
-		printUsage();
-		return 1;
+		xmlFiles.push_back(inputPath);
 	}
 
-	try
+	size_t threadCount = std::min(std::max<size_t>(jobs, 1), std::max<size_t>(xmlFiles.size(), 1));
+	std::vector<QuickXml::XmlStructureStats> threadStats(threadCount);
+	std::atomic<size_t> nextFile(0);
+	std::atomic<bool> failed(false);
+	auto worker = [&](QuickXml::XmlStructureStats& stats)
 	{
-		// Read input file.
-		std::string xmlContent = readFile(inputFile);
+		size_t i;
+		while ((i = nextFile.fetch_add(1, std::memory_order_relaxed)) < xmlFiles.size())
+		{
+			std::string path = xmlFiles[i].string();
+			QuickXml::XmlMappedFile file;
+			if (!file.open(xmlFiles[i]))
+			{
+				std::cerr << "Error: Cannot open input file: " + path + "\n";
+				failed.store(true, std::memory_order_relaxed);
+				continue;
+			}
+			stats.add(file.getData(), file.getLength(), path);
+		}
+	};
 
-		// Create XML indenter.
-		XmlIndenter indenter(xmlContent, indentStr, eolStr, indentOnly, autoCloseEmptyElements);
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < threadCount; ++i)
+	{
+		threads.emplace_back(worker, std::ref(threadStats[i]));
+	}
+	worker(threadStats[0]);
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
 
-		// Indent XML.
-		std::string formattedXml = indenter.indentXML();
+	for (size_t i = 1; i < threadCount; ++i)
+	{
+		threadStats[0].merge(threadStats[i]);
+	}
+	threadStats[0].report(std::cout);
+	return (failed.load() ? 1 : 0);
+}
+
+// Format the XML and XSD members of a tar archive into another archive, in a single streaming pass. Without an output file, the archive is replaced once complete.
+int rewriteTarArchive(const std::string& inputFile, const std::string& outputFile, const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements, XmlOutputCache* cache, bool validate, bool verify)
+{
+	std::ifstream in(inputFile, std::ios::binary);
+	if (!in.is_open())
+	{
+		std::cerr << "Error: Cannot open input file: " << inputFile << std::endl;
+		return 1;
+	}
+
+	std::string outputPath = (outputFile.empty() ? inputFile + ".tmp" : outputFile);
+	std::ofstream out(outputPath, std::ios::binary | std::ios::trunc);
+	if (!out.is_open())
+	{
+		std::cerr << "Error: Cannot open output file: " << outputPath << std::endl;
+		return 1;
+	}
+
+	// Status lines go to stderr, the archive may be written to stdout.
+	XmlCleanupProcessor processor(indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache, validate, verify);
+	XmlTarRewriter rewriter(processor, XML_PIPELINE_MAX_BYTES_IN_FLIGHT);
+	try
+	{
+		rewriter.run(in, out);
+		out.close();
+		if (!out.good())
+		{
+			throw std::runtime_error("Cannot write output file: " + outputPath);
+		}
+		if (outputFile.empty())
+		{
+			in.close();
+			std::filesystem::rename(outputPath, inputFile);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Error: " << e.what() << std::endl;
+		if (outputFile.empty())
+		{
+			out.close();
+			std::error_code ignored;
+			std::filesystem::remove(outputPath, ignored);
+		}
+		return 1;
+	}
+
+	std::cerr << "Formatted " << rewriter.getFormattedCount() << " of " << rewriter.getMemberCount() << " members";
+	if (rewriter.getFailedCount() > 0)
+	{
+		std::cerr << ", " << rewriter.getFailedCount() << " failed (kept as is)";
+	}
+	std::cerr << "." << std::endl;
+	return (rewriter.getFailedCount() > 0 ? 1 : 0);
+}
+
+// Split the records of a document into files of recordsPerFile records each, in a single forward pass. The parts are written next to the input file, or to outputDirectory,
+// by max(jobs, 1) writer threads, optionally formatted.
+int splitRecords(const std::string& inputFile, const std::string& spec, size_t recordsPerFile, const std::filesystem::path& outputDirectory, bool format, const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements, XmlOutputCache* cache, size_t jobs, bool validate, bool verify)
+{
+	if (recordsPerFile == 0)
+	{
+		std::cerr << "Error: --split-records needs at least one record per file\n";
+		return 1;
+	}
+
+	QuickXml::XmlMappedFile input;
+	if (!input.open(inputFile))
+	{
+		std::cerr << "Error: Cannot open input file: " << inputFile << std::endl;
+		return 1;
+	}
+
+	std::filesystem::path inputPath(inputFile);
+	std::filesystem::path directory = (outputDirectory.empty() ? inputPath.parent_path() : outputDirectory);
+	try
+	{
+		if (!directory.empty())
+		{
+			std::filesystem::create_directories(directory);
+		}
+
+		XmlCleanupProcessor processor(indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache, validate, verify);
+		XmlRecordSplitter splitter(spec, (format ? &processor : NULL), jobs, XML_PIPELINE_MAX_BYTES_IN_FLIGHT);
+		bool success = splitter.run(input.getData(), input.getLength(), directory, inputPath.stem().string(), recordsPerFile);
+		std::cout << "Split " << splitter.getRecordCount() << " records into " << splitter.getPartCount() << " files";
+		if (splitter.getFailedCount() > 0)
+		{
+			std::cout << ", " << splitter.getFailedCount() << " failed";
+		}
+		std::cout << "." << std::endl;
+		return (success ? 0 : 1);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+}
+
+// Process all XML and XSD files of a directory and its subdirectories. When jobs is not zero, files go through the pipeline with that many formatter threads.
+// When shardCount is not zero, only the files of the given shard are processed. When outputDirectory is not empty, the outputs go to a mirror of the directory tree under it instead of the files.
+int processDirectory(const std::filesystem::path& directoryPath, const std::filesystem::path& outputDirectory, const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements, XmlOutputCache* cache, size_t jobs, bool validate, bool verify, size_t shard, size_t shardCount)
+{
+	// Find all XML and XSD files in the directory and subdirectories. A mirror inside the tree is not input: the next run would format it into a mirror of itself.
+	std::vector<std::filesystem::path> xmlFiles = findXmlAndXsdFiles(directoryPath, outputDirectory);
+	if (shardCount > 0)
+	{
+		size_t totalCount = xmlFiles.size();
+		xmlFiles = selectShard(xmlFiles, directoryPath, shard, shardCount);
+		std::cout << "Shard " << (shard + 1) << "/" << shardCount << ": " << xmlFiles.size() << " of " << totalCount << " files.\n";
+	}
+
+	if (xmlFiles.empty())
+	{
+		std::cout << "No XML or XSD files found.\n";
+		return 0;
+	}
+
+	std::cout << "Found " << xmlFiles.size() << " XML/XSD files to process.\n";
+
+	if (!outputDirectory.empty())
+	{
+		XmlPipeline::createMirrorDirectories(xmlFiles, directoryPath, outputDirectory);
+	}
+
+	if (jobs > 0)
+	{
+		XmlCleanupProcessor processor(indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache, validate, verify);
+		XmlPipeline pipeline(processor, jobs, XML_PIPELINE_MAX_BYTES_IN_FLIGHT);
+		pipeline.setMirror(outputDirectory.empty() ? std::filesystem::path() : directoryPath, outputDirectory);
+		size_t successCount = pipeline.run(xmlFiles);
+		std::cout << "Successfully processed " << successCount << " out of " << xmlFiles.size() << " files.\n";
+		return 0;
+	}
+
+	// Process each file.
+	int successCount = 0;
+	for (const std::filesystem::path& file : xmlFiles)
+	{
+		std::filesystem::path outputPath = (outputDirectory.empty() ? file : XmlPipeline::mirrorPath(file, directoryPath, outputDirectory));
+		if (processXmlFile(file, outputPath, indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache, validate, verify))
+		{
+			successCount++;
+		}
+	}
+
+	std::cout << "Successfully processed " << successCount << " out of " << xmlFiles.size() << " files.\n";
+
+	return 0;
+}
+
+// Format several inputs (files, or all XML and XSD files of directories) to stdout, in input order. When jobs is not zero, files go through the pipeline with that many formatter threads and a sequencer restores the order.
+int formatToStdout(const std::vector<std::string>& inputs, const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements, XmlOutputCache* cache, size_t jobs, bool validate, bool verify)
+{
+	std::vector<std::filesystem::path> xmlFiles;
+	for (const std::string& input : inputs)
+	{
+		if (std::filesystem::is_directory(input))
+		{
+			std::vector<std::filesystem::path> directoryFiles = findXmlAndXsdFiles(input);
+			xmlFiles.insert(xmlFiles.end(), directoryFiles.begin(), directoryFiles.end());
+		}
+		else
+		{
+			xmlFiles.push_back(input);
+		}
+	}
+
+	if (jobs > 0)
+	{
+		XmlCleanupProcessor processor(indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache, validate, verify);
+		XmlPipeline pipeline(processor, jobs, XML_PIPELINE_MAX_BYTES_IN_FLIGHT);
+		pipeline.setOrderedOutput(&std::cout);
+		return (pipeline.run(xmlFiles) == xmlFiles.size() ? 0 : 1);
+	}
+
+	int res = 0;
+	for (const std::filesystem::path& file : xmlFiles)
+	{
+		// A file failing to be read or formatted is reported, the following ones are still written, as by the pipeline.
+		std::string xmlContent;
+		std::string formattedXml;
+		QuickXml::XmlValidator validator;
+		try
+		{
+			xmlContent = readFile(file.string());
+			uint64_t reportBegin = beginFileReports();
+			formattedXml = formatXmlContent(xmlContent, indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache, validate ? &validator : NULL);
+			endFileReports(file.string(), xmlContent, reportBegin);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Error processing " << file.string() << ": " << e.what() << std::endl;
+			res = 1;
+			continue;
+		}
+
+		if (!validator.isValid())
+		{
+			std::cerr << "Invalid: " << file.string() << "\n" << formatValidationErrors(file.string(), validator);
+			res = 1;
+			continue;
+		}
+
+		std::string difference = (verify ? describeDifference(file.string(), xmlContent, "formatted", formattedXml) : std::string());
+		if (!difference.empty())
+		{
+			std::cerr << "Verification failed: " << difference << std::endl;
+			res = 1;
+			continue;
+		}
+
+		std::string path = (XmlTrace::isEnabled() ? file.string() : std::string());
+		XmlTraceScope trace("write", &path);
+		std::cout << formattedXml;
+	}
+	return res;
+}
+
+// Format a concatenation of documents (such as message logs), each document on its own: a malformed document cannot change the indentation of the others.
+// The documents are formatted by jobs threads (one when zero) and joined in input order. The line breaks between two documents are kept, other text between them is dropped as at the end of a document.
+std::string formatDocuments(const std::string& name, const std::string& content, const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements, XmlOutputCache* cache, size_t jobs)
+{
+	std::vector<size_t> starts = QuickXml::XmlStructureScanner::documentStarts(content.data(), content.length());
+	starts.insert(starts.begin(), 0);
+	starts.push_back(content.length());
+	size_t documentCount = starts.size() - 1;
+
+	std::vector<std::string> outputs(documentCount);
+	std::vector<std::string> errors(documentCount);
+	std::atomic<size_t> nextDocument(0);
+	auto worker = [&]()
+	{
+		size_t i;
+		while ((i = nextDocument.fetch_add(1, std::memory_order_relaxed)) < documentCount)
+		{
+			std::string document = content.substr(starts[i], starts[i + 1] - starts[i]);
+			try
+			{
+				uint64_t reportBegin = beginFileReports();
+				outputs[i] = formatXmlContent(document, indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache, NULL);
+				endFileReports(name + "[" + std::to_string(i + 1) + "]", document, reportBegin);
+			}
+			catch (const std::exception& e)
+			{
+				errors[i] = e.what();
+				continue;
+			}
+
+			// The formatter drops the text after the last markup, the line breaks separating the next document are put back.
+			if (i + 1 < documentCount)
+			{
+				size_t last = document.rfind('>');
+				for (size_t j = (last == std::string::npos ? 0 : last + 1); j < document.length(); ++j)
+				{
+					if (document[j] == '\n' || (document[j] == '\r' && (j + 1 == document.length() || document[j + 1] != '\n')))
+					{
+						outputs[i] += "\r\n";
+					}
+				}
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < std::min(std::max<size_t>(jobs, 1), documentCount); ++i)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	std::string res;
+	for (size_t i = 0; i < documentCount; ++i)
+	{
+		if (!errors[i].empty())
+		{
+			throw std::runtime_error("Document " + std::to_string(i + 1) + " of " + name + ": " + errors[i]);
+		}
+		res += outputs[i];
+	}
+	return res;
+}
+
+// Run the pipeline over all XML and XSD files of a directory at 1, 2, 4, ... maxThreads formatter threads, and report the throughput, the parallel efficiency and where the time went.
+// Outputs are not written. A first unreported run warms the page cache, so every run reads the same cached files.
+int runThreadScaling(const std::filesystem::path& directoryPath, size_t maxThreads, const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements, bool validate, bool verify)
+{
+	std::vector<std::filesystem::path> xmlFiles = findXmlAndXsdFiles(directoryPath);
+	if (xmlFiles.empty())
+	{
+		std::cout << "No XML or XSD files found.\n";
+		return 0;
+	}
+
+	std::vector<size_t> threadCounts;
+	for (size_t threads = 1; threads < maxThreads; threads *= 2)
+	{
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(maxThreads);
+
+	XmlBenchmarkProcessor processor(indentStr, eolStr, indentOnly, autoCloseEmptyElements, NULL, validate, verify);
+	XmlPipeline warmUp(processor, maxThreads, XML_PIPELINE_MAX_BYTES_IN_FLIGHT);
+	warmUp.setQuiet(true);
+	warmUp.run(xmlFiles);
+
+	// Formatter times are shares of the formatter threads time, reader times are shares of the wall time.
+	std::cout << "Benchmark of " << xmlFiles.size() << " files (" << std::thread::hardware_concurrency() << " hardware threads)\n";
+	std::cout << "Threads    Files/s     MB/s  Speedup  Efficiency  Format  Starved  Blocked    Read  Reader blocked\n";
+	double baseThroughput = 0;
+	for (size_t threads : threadCounts)
+	{
+		XmlPipeline pipeline(processor, threads, XML_PIPELINE_MAX_BYTES_IN_FLIGHT);
+		pipeline.setQuiet(true);
+		pipeline.run(xmlFiles);
+		const XmlPipelineStats& stats = pipeline.getStats();
+
+		double seconds = std::max(stats.wallTime, static_cast<uint64_t>(1)) / 1e9;
+		double formatterTime = seconds * 1e9 * threads;
+		double throughput = stats.bytesRead / seconds;
+		if (baseThroughput == 0)
+		{
+			baseThroughput = throughput;
+		}
+		double speedup = throughput / baseThroughput;
+
+		std::cout << std::fixed << std::setprecision(1);
+		std::cout << std::setw(7) << threads << std::setw(11) << xmlFiles.size() / seconds << std::setw(9) << throughput / (1024 * 1024);
+		std::cout << std::setw(8) << std::setprecision(2) << speedup << "x" << std::setw(11) << std::setprecision(0) << 100 * speedup / threads << "%";
+		std::cout << std::setw(7) << 100 * stats.formatTime / formatterTime << "%" << std::setw(8) << 100 * stats.formatterIdleTime / formatterTime << "%" << std::setw(8) << 100 * stats.formatterWaitTime / formatterTime << "%";
+		std::cout << std::setw(7) << 100 * stats.readTime / (seconds * 1e9) << "%" << std::setw(15) << 100 * stats.readerWaitTime / (seconds * 1e9) << "%\n";
+	}
+	std::cout << std::defaultfloat;
+	std::cout << "Format: formatting, Starved: waiting for files to read, Blocked: waiting for the writer, Read: reading files, Reader blocked: waiting for the memory budget or the formatters.\n";
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	// Default settings.
+	std::string indentStr = "\t";
+	std::string eolStr = "\n";
+	bool indentOnly = true;
+	bool autoCloseEmptyElements = true;
+	std::string inputFile;
+	std::string outputFile;
+	std::string cacheDir;
+	uint64_t cacheSizeMB = 512;
+	size_t jobs = 0;
+	std::vector<std::string> pathQueries;
+	bool validate = false;
+	bool fingerprint = false;
+	bool verify = false;
+	bool compare = false;
+	std::string byteRange;
+	std::vector<std::pair<std::string, std::string>> variantSpecs;
+	std::vector<std::string> inputs;
+	bool toStdout = false;
+	std::string lineRange;
+	size_t shard = 0;
+	size_t shardCount = 0;
+	size_t stressMB = 0;
+	size_t fuzzIterations = 0;
+	uint64_t seed = std::random_device()();
+	size_t benchThreads = 0;
+	std::string outputDirectory;
+	bool multiDocument = false;
+	double slowThreshold = 0;
+	std::string captureDir = "slow-inputs";
+	size_t captureBytes = 0;
+	bool buildIndex = false;
+	bool statsStructure = false;
+	bool tarArchive = false;
+	std::string splitSpec;
+	size_t splitRecordsPerFile = 1;
+	bool splitFormat = false;
+
+	// Check if no arguments were provided.
+	if (argc == 1)
+	{
+		std::cout << "No arguments provided. Processing all XML and XSD files in current directory and subdirectories...\n";
+		return processDirectory(".", std::filesystem::path(), indentStr, eolStr, indentOnly, autoCloseEmptyElements, NULL, 0, false, false, 0, 0);
+	}
+
+	// Parse command-line arguments.
+	std::vector<std::string> args(argv + 1, argv + argc);
+
+	for (size_t i = 0; i < args.size(); ++i)
+	{
+		if (args[i] == "-h" || args[i] == "--help")
+		{
+			printUsage();
+			return 0;
+		}
+		else if (args[i] == "-t" || args[i] == "--tabs")
+		{
+			indentStr = "\t";
+		}
+		else if (args[i] == "-s" || args[i] == "--spaces")
+		{
+			if (i + 1 < args.size() && args[i + 1][0] != '-')
+			{
+				int spaces = std::stoi(args[i + 1]);
+				indentStr = std::string(spaces, ' ');
+				i++;
+			}
+			else
+			{
+				indentStr = "  "; // Default to 2 spaces.
+			}
+		}
+		else if (args[i] == "-i" || args[i] == "--indent-only")
+		{
+			indentOnly = true;
+		}
+		else if (args[i] == "-f" || args[i] == "--full-format")
+		{
+			indentOnly = false;
+		}
+		else if (args[i] == "-a" || args[i] == "--auto-close")
+		{
+			autoCloseEmptyElements = true;
+		}
+		else if (args[i] == "-n" || args[i] == "--no-auto-close")
+		{
+			autoCloseEmptyElements = false;
+		}
+		else if ((args[i] == "-j" || args[i] == "--jobs") && i + 1 < args.size())
+		{
+			jobs = std::stoul(args[++i]);
+			if (jobs == 0)
+			{
+				jobs = std::max<size_t>(1, std::thread::hardware_concurrency());
+			}
+		}
+		else if (args[i] == "--shard" && i + 1 < args.size())
+		{
+			// "I/N" with I in [1, N].
+			std::string str = args[++i];
+			if (!parseNumberPair(str, '/', shard, shardCount) || shard == 0 || shard > shardCount)
+			{
+				std::cerr << "Error: Invalid shard " << str << ", expected I/N with 1 <= I <= N\n";
+				return 1;
+			}
+			--shard;
+		}
+		else if (args[i] == "--cache" && i + 1 < args.size())
+		{
+			cacheDir = args[++i];
+		}
+		else if (args[i] == "--cache-size" && i + 1 < args.size())
+		{
+			cacheSizeMB = std::stoull(args[++i]);
+		}
+		else if (args[i] == "--range" && i + 1 < args.size())
+		{
+			byteRange = args[++i];
+		}
+		else if (args[i] == "--lines" && i + 1 < args.size())
+		{
+			lineRange = args[++i];
+		}
+		else if (args[i] == "--variant" && i + 2 < args.size())
+		{
+			variantSpecs.push_back({ args[i + 1], args[i + 2] });
+			i += 2;
+		}
+		else if (args[i] == "--verify")
+		{
+			verify = true;
+		}
+		else if (args[i] == "--compare")
+		{
+			compare = true;
+		}
+		else if (args[i] == "--fingerprint")
+		{
+			fingerprint = true;
+		}
+		else if (args[i] == "--validate")
+		{
+			validate = true;
+		}
+		else if (args[i] == "--stress" && i + 1 < args.size())
+		{
+			stressMB = std::stoul(args[++i]);
+		}
+		else if (args[i] == "--fuzz" && i + 1 < args.size())
+		{
+			fuzzIterations = std::stoul(args[++i]);
+		}
+		else if (args[i] == "--seed" && i + 1 < args.size())
+		{
+			seed = std::stoull(args[++i]);
+		}
+		else if (args[i] == "--trace" && i + 1 < args.size())
+		{
+			XmlTrace::start(args[++i]);
+		}
+		else if ((args[i] == "-o" || args[i] == "--output-dir") && i + 1 < args.size())
+		{
+			outputDirectory = args[++i];
+		}
+		else if (args[i] == "--multi-document")
+		{
+			multiDocument = true;
+		}
+		else if (args[i] == "--bench-threads" && i + 1 < args.size())
+		{
+			benchThreads = std::stoul(args[++i]);
+			if (benchThreads == 0)
+			{
+				benchThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+			}
+		}
+		else if (args[i] == "--slow-threshold" && i + 1 < args.size())
+		{
+			slowThreshold = std::stod(args[++i]);
+		}
+		else if (args[i] == "--capture-dir" && i + 1 < args.size())
+		{
+			captureDir = args[++i];
+		}
+		else if (args[i] == "--capture-bytes" && i + 1 < args.size())
+		{
+			captureBytes = std::stoull(args[++i]);
+		}
+		else if (args[i] == "--counters")
+		{
+			// Formatting goes on without counters when the kernel refuses them.
+			std::string message;
+			if (!XmlPerfCounters::start(message))
+			{
+				std::cerr << "Warning: Hardware counters unavailable, " << message << std::endl;
+			}
+		}
+		else if (args[i] == "--path" && i + 1 < args.size())
+		{
+			pathQueries.push_back(args[++i]);
+		}
+		else if (args[i] == "--index")
+		{
+			buildIndex = true;
+		}
+		else if (args[i] == "--stats-structure")
+		{
+			statsStructure = true;
+		}
+		else if (args[i] == "--tar")
+		{
+			tarArchive = true;
+		}
+		else if (args[i] == "--split" && i + 1 < args.size())
+		{
+			splitSpec = args[++i];
+		}
+		else if (args[i] == "--split-records" && i + 1 < args.size())
+		{
+			splitRecordsPerFile = std::stoull(args[++i]);
+		}
+		else if (args[i] == "--split-format")
+		{
+			splitFormat = true;
+		}
+		else if (args[i] == "--stdout")
+		{
+			toStdout = true;
+		}
+		else if (toStdout && args[i][0] != '-')
+		{
+			inputs.push_back(args[i]);
+		}
+		else if (inputFile.empty() && args[i][0] != '-')
+		{
+			inputFile = args[i];
+			inputs.push_back(args[i]);
+		}
+		else if (!inputFile.empty() && outputFile.empty() && args[i][0] != '-')
+		{
+			outputFile = args[i];
+		}
+	}
+
+	if (multiDocument && validate)
+	{
+		std::cerr << "Error: --validate cannot be used with --multi-document\n";
+		return 1;
+	}
+
+	if (stressMB > 0 || fuzzIterations > 0)
+	{
+		return runStress(stressMB, fuzzIterations, seed);
+	}
+
+	// Check if input file is provided (we only get here if arguments were passed).
+	if (inputFile.empty() && inputs.empty())
+	{
+		std::cerr << "Error: No valid input file specified\n";
+		printUsage();
+		return 1;
+	}
+
+	try
+	{
+		if (slowThreshold > 0)
+		{
+			// The reports keep the command line, to reproduce the formatting of the captured inputs.
+			std::string options = "XmlCleanup";
+			for (const std::string& arg : args)
+			{
+				options += " " + arg;
+			}
+			XmlSlowCapture::start(captureDir, slowThreshold, captureBytes, options);
+		}
+
+		std::unique_ptr<XmlOutputCache> cache;
+		if (!cacheDir.empty())
+		{
+			cache = std::make_unique<XmlOutputCache>(cacheDir, cacheSizeMB * 1024 * 1024);
+		}
+
+		if (toStdout)
+		{
+			int res = formatToStdout(inputs, indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache.get(), jobs, validate, verify);
+			if (cache)
+			{
+				cache->trim();
+			}
+			return res;
+		}
+
+		if (compare)
+		{
+			if (outputFile.empty())
+			{
+				std::cerr << "Error: --compare needs two files\n";
+				return 1;
+			}
+
+			std::string difference = describeDifference(inputFile, readFile(inputFile), outputFile, readFile(outputFile));
+			if (!difference.empty())
+			{
+				std::cout << "Different: " << difference << std::endl;
+				return 1;
+			}
+			std::cout << "Equivalent" << std::endl;
+			return 0;
+		}
+
+		if (benchThreads > 0)
+		{
+			if (!std::filesystem::is_directory(inputFile))
+			{
+				std::cerr << "Error: --bench-threads needs a directory\n";
+				return 1;
+			}
+			return runThreadScaling(inputFile, benchThreads, indentStr, eolStr, indentOnly, autoCloseEmptyElements, validate, verify);
+		}
+
+		if (fingerprint)
+		{
+			return printFingerprints(inputFile, jobs, shard, shardCount);
+		}
+
+		if (statsStructure)
+		{
+			return printStructureStats(inputFile, jobs, shard, shardCount);
+		}
+
+		if (tarArchive)
+		{
+			return rewriteTarArchive(inputFile, outputFile, indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache.get(), validate, verify);
+		}
+
+		if (!splitSpec.empty())
+		{
+			return splitRecords(inputFile, splitSpec, splitRecordsPerFile, outputDirectory, splitFormat, indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache.get(), jobs, validate, verify);
+		}
+
+		if (std::filesystem::is_directory(inputFile))
+		{
+			if (!outputFile.empty())
+			{
+				std::cerr << "Error: An output file cannot be used with a directory input\n";
+				return 1;
+			}
+
+			int res = processDirectory(inputFile, outputDirectory, indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache.get(), jobs, validate, verify, shard, shardCount);
+			if (cache)
+			{
+				cache->trim();
+			}
+			return res;
+		}
+
+		if (!outputDirectory.empty())
+		{
+			std::cerr << "Error: An output directory needs a directory input, use an output-file\n";
+			return 1;
+		}
+
+		// Path queries on an indexed file only read the pages around the queried positions.
+		QuickXml::XmlStructureIndex index;
+		if (!pathQueries.empty())
+		{
+			QuickXml::XmlMappedFile input;
+			if (!input.open(inputFile))
+			{
+				std::cerr << "Error: Cannot open input file: " << inputFile << std::endl;
+				return 1;
+			}
+			bool indexed = openStructureIndex(inputFile, input.getData(), input.getLength(), buildIndex, index);
+			return printPaths(input.getData(), input.getLength(), pathQueries, indexed ? &index : NULL);
+		}
+
+		// Read input file.
+		std::string xmlContent = readFile(inputFile);
+
+		if (!byteRange.empty() || !lineRange.empty())
+		{
+			// Range formatting: the output is the replacement text of the range, its widened bounds are reported on stderr.
+			size_t begin = 0;
+			size_t end = 0;
+			if (!parseNumberPair(byteRange.empty() ? lineRange : byteRange, ':', begin, end) || begin > end)
+			{
+				std::cerr << "Error: Invalid range " << (byteRange.empty() ? lineRange : byteRange) << std::endl;
+				return 1;
+			}
+
+			bool indexed = openStructureIndex(inputFile, xmlContent.c_str(), xmlContent.length(), buildIndex, index);
+			if (byteRange.empty() && indexed)
+			{
+				// Lines past the last one end the range at the end of the document, as below.
+				begin = index.offsetOf(xmlContent.c_str(), xmlContent.length(), { begin, 1 });
+				try
+				{
+					end = index.offsetOf(xmlContent.c_str(), xmlContent.length(), { end + 1, 1 });
+				}
+				catch (const std::out_of_range&)
+				{
+					end = xmlContent.length();
+				}
+			}
+			else if (byteRange.empty())
+			{
+				QuickXml::XmlLineIndex lines(xmlContent.c_str(), xmlContent.length());
+				begin = lines.offsetOf({ begin, 1 });
+				end = (end < lines.lineCount() ? lines.offsetOf({ end + 1, 1 }) : xmlContent.length());
+			}
+
+			QuickXml::XmlStructureRange range;
+			XmlIndenter indenter(xmlContent, indentStr, eolStr, indentOnly, autoCloseEmptyElements);
+			std::string replacement = indenter.indentXMLRange(begin, end, range, indexed ? &index : NULL);
+			std::cerr << "Range: " << range.begin << ":" << range.end << std::endl;
+			if (!outputFile.empty())
+			{
+				writeFile(outputFile, replacement);
+			}
+			else
+			{
+				std::cout << replacement;
+			}
+			return 0;
+		}
+
+		if (buildIndex)
+		{
+			return (openStructureIndex(inputFile, xmlContent.c_str(), xmlContent.length(), true, index) ? 0 : 1);
+		}
+
+		if (!variantSpecs.empty())
+		{
+			// Fan-out: the normal output and every variant come from the same parse of the input, the normal output is the first one.
+			std::vector<QuickXml::XmlFormatterVariant> variants(variantSpecs.size() + 1);
+			variants[0].linearize = false;
+			variants[0].params = XmlIndenter::makeFormatterParams(indentStr, eolStr, indentOnly, autoCloseEmptyElements);
+			for (size_t i = 0; i < variantSpecs.size(); ++i)
+			{
+				if (!parseVariant(variantSpecs[i].first, indentStr, eolStr, indentOnly, autoCloseEmptyElements, variants[i + 1]))
+				{
+					std::cerr << "Error: Invalid variant " << variantSpecs[i].first << std::endl;
+					return 1;
+				}
+			}
+
+			uint64_t reportBegin = beginFileReports();
+			QuickXml::XmlValidator validator;
+			XmlIndenter indenter(xmlContent, indentStr, eolStr, indentOnly, autoCloseEmptyElements);
+			indenter.setValidator(validate ? &validator : NULL);
+			std::vector<std::string> outputs = indenter.indentXMLVariants(variants);
+			endFileReports(inputFile, xmlContent, reportBegin);
+			if (!validator.isValid())
+			{
+				std::cerr << formatValidationErrors(inputFile, validator);
+				return 1;
+			}
+
+			// Without an output file, the normal output goes to stdout: the messages go to stderr then.
+			std::ostream& messages = (outputFile.empty() ? std::cerr : std::cout);
+			int res = 0;
+			for (size_t i = 0; i < outputs.size(); ++i)
+			{
+				std::string path = (i == 0 ? outputFile : variantSpecs[i - 1].second);
+				std::string difference = (verify ? describeDifference(inputFile, xmlContent, (path.empty() ? "formatted" : path), outputs[i]) : std::string());
+				if (!difference.empty())
+				{
+					std::cerr << "Verification failed: " << difference << std::endl;
+					res = 1;
+					continue;
+				}
+				if (path.empty())
+				{
+					std::cout << outputs[i];
+					continue;
+				}
+				writeFile(path, outputs[i]);
+				messages << "Formatted XML written to " << path << std::endl;
+			}
+			return res;
+		}
+
+		// Indent XML.
+		uint64_t reportBegin = beginFileReports();
+		QuickXml::XmlValidator validator;
+		std::string formattedXml;
+		if (multiDocument)
+		{
+			formattedXml = formatDocuments(inputFile, xmlContent, indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache.get(), jobs);
+		}
+		else
+		{
+			formattedXml = formatXmlContent(xmlContent, indentStr, eolStr, indentOnly, autoCloseEmptyElements, cache.get(), validate ? &validator : NULL);
+			endFileReports(inputFile, xmlContent, reportBegin);
+		}
+		if (cache)
+		{
+			cache->trim();
+		}
+
+		// Nothing is written for invalid documents.
+		if (!validator.isValid())
+		{
+			std::cerr << formatValidationErrors(inputFile, validator);
+			return 1;
+		}
+
+		std::string difference = (verify ? describeDifference(inputFile, xmlContent, "formatted", formattedXml) : std::string());
+		if (!difference.empty())
+		{
+			std::cerr << "Verification failed: " << difference << std::endl;
+			return 1;
+		}
 
 		// Output formatted XML.
 		if (!outputFile.empty())
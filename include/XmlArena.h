@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+namespace QuickXml
+{
+	// XmlArenaUpstream: Serves the arena overflow blocks and counts them, so the next documents get a bigger initial block.
+	class XmlArenaUpstream : public std::pmr::memory_resource
+	{
+	private:
+		size_t allocatedBytes = 0;
+
+		void* do_allocate(size_t bytes, size_t alignment) override;
+		void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+	public:
+		// Bytes requested since the last call to resetCount().
+		size_t getAllocatedBytes() const { return this->allocatedBytes; }
+
+		// Restart counting.
+		void resetCount() { this->allocatedBytes = 0; }
+	};
+
+	// XmlArena: A per-thread monotonic arena for all the short-lived allocations of a document (token copies, trimmed temporaries, path entries, lexer stacks).
+	// The arena is only used while an XmlArenaScope is alive on the thread; otherwise resource() is the general-purpose allocator.
+	class XmlArena
+	{
+	private:
+		XmlArenaUpstream upstream;
+		std::unique_ptr<char[]> initialBlock;
+		size_t initialSize;
+		std::unique_ptr<std::pmr::monotonic_buffer_resource> monotonic;
+		size_t depth;
+
+		// Constructor.
+		XmlArena();
+
+		// The arena of the calling thread.
+		static XmlArena& local();
+
+	public:
+		// Destructor.
+		~XmlArena();
+
+		// Memory resource to use for per-document allocations on the calling thread.
+		static std::pmr::memory_resource* resource();
+
+		// Activate the arena of the calling thread (scopes can be nested).
+		static void enter();
+
+		// Leave a scope. Leaving the outermost scope releases every allocation at once.
+		static void leave();
+	};
+
+	// XmlArenaScope: Activates the thread arena for the lifetime of the object. Everything allocated from the arena must be destroyed before the scope.
+	class XmlArenaScope
+	{
+	public:
+		// Constructor.
+		XmlArenaScope() { XmlArena::enter(); }
+
+		// Destructor.
+		~XmlArenaScope() { XmlArena::leave(); }
+
+		// Disable copying.
+		XmlArenaScope(const XmlArenaScope&) = delete;
+		XmlArenaScope& operator=(const XmlArenaScope&) = delete;
+	};
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "XmlParser.h"
+
+namespace QuickXml
+{
+	// A significant token: its kind, its offset in the document and its canonical text.
+	// Opening tags give TagOpening (name), closing and self-closing tags both give TagClosing (name), so that <a></a> and <a/> read the same.
+	struct XmlCanonicalToken
+	{
+		XmlTokenType type;
+		size_t pos;
+		std::string_view text;       // Valid until the next call of XmlCanonicalReader::next.
+	};
+
+	// The first semantic difference between two documents.
+	struct XmlCanonicalDifference
+	{
+		bool equivalent;             // True when the documents have the same significant tokens (other fields are unset then).
+		size_t leftOffset;           // Offset of the differing token in the first document (its length when it ended first).
+		size_t rightOffset;          // Offset of the differing token in the second document.
+		std::string description;
+	};
+
+	// XmlCanonicalReader: Reads the significant tokens of a document, ignoring the formatting.
+	// Whitespace inside tags and whitespace-only text are skipped, as linearize does. Text, comments and instructions are trimmed, except under xml:space="preserve": the formatter
+	// only changes their ends, so a change of the whitespace inside them (x  y for x y) is a difference. The space runs of single-line comments, which the formatter turns into one
+	// space, and the whitespace runs of declarations, whose internal subsets it indents, are collapsed to one space.
+	// Line breaks are normalized to '\n' everywhere, as an XML parser does. Attribute values are read without their quotes.
+	class XmlCanonicalReader
+	{
+	private:
+		XmlParser parser;
+		bool applySpacePreserve;
+		std::string buffer;          // Storage of the canonical text, reused for every token.
+		std::string_view tagName;    // Name of the current opening tag, for self-closing tags.
+
+		// Copy chars to the buffer with whitespace runs collapsed and ends trimmed.
+		std::string_view collapse(const char* chars, size_t size);
+
+		// Copy chars to the buffer with line breaks normalized to '\n'.
+		std::string_view normalizeLineBreaks(const char* chars, size_t size);
+
+		// Copy chars to the buffer with ends trimmed and line breaks normalized to '\n'.
+		std::string_view trim(const char* chars, size_t size);
+
+	public:
+		// Constructor. The data must stay valid while reading.
+		XmlCanonicalReader(const char* data, size_t length, bool applySpacePreserve = true);
+
+		// Read the next significant token. Returns false at end of document.
+		bool next(XmlCanonicalToken& token);
+
+		// Read both documents at the same time and stop at the first significant token which differs.
+		static XmlCanonicalDifference compare(const char* leftData, size_t leftLength, const char* rightData, size_t rightLength, bool applySpacePreserve = true);
+
+		// Compute the fingerprint of a document: a hash of its significant tokens, which does not change when the document is reformatted.
+		static uint64_t fingerprint(const char* data, size_t length, bool applySpacePreserve = true);
+	};
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace QuickXml
+{
+	// Character classes used by the lexer delimiter scans. A character can belong to several classes.
+	enum XmlCharClass
+	{
+		CharSpace = 1 << 0,               // ' ' '\t'.
+		CharLineBreak = 1 << 1,           // '\r' '\n'.
+		CharTagNameEnd = 1 << 2,          // End of an opening tag name: " />\t\r\n".
+		CharClosingTagNameEnd = 1 << 3,   // End of a closing tag name: "> \r\n".
+		CharAttrNameEnd = 1 << 4,         // End of an attribute name: "= /\t\r\n".
+		CharWordEnd = 1 << 5,             // End of an unquoted word: " \t\r\n=\"'<>".
+		CharDeclarationStop = 1 << 6,     // Declaration scan stops: "[>\"'".
+		CharMarkupStart = 1 << 7,         // '<'.
+		CharNameStart = 1 << 8,           // First char of a name: letters, "_:" and non-ASCII bytes.
+		CharName = 1 << 9                 // Char of a name: the first ones, digits and ".-".
+	};
+
+	typedef uint16_t XmlCharClasses; // Combined classes (ex: XmlCharClass::CharSpace | XmlCharClass::CharLineBreak).
+
+	// Actions selected by the first char of a token. Each lexer state has its own mapping.
+	enum XmlLexAction : uint8_t
+	{
+		LexOther = 0,
+		LexMarkup,        // '<'.
+		LexTagEnd,        // '>'.
+		LexSpace,         // ' ' '\t'.
+		LexLineBreak,     // '\r' '\n'.
+		LexSlash,         // '/'.
+		LexEqual,         // '='.
+		LexQuote,         // '"' '\''.
+		LexBracketClose   // ']'.
+	};
+
+	// Lexer states, they select the dispatch table.
+	enum XmlLexState
+	{
+		LexStateText = 0,
+		LexStateOpeningTag,
+		LexStateClosingTag,
+		LexStateDeclaration,
+		LexStateCount
+	};
+
+	constexpr XmlCharClasses xmlCharClassesOf(unsigned char c)
+	{
+		XmlCharClasses res = 0;
+		if (c == ' ' || c == '\t')
+		{
+			res |= CharSpace;
+		}
+
+		if (c == '\r' || c == '\n')
+		{
+			res |= CharLineBreak;
+		}
+
+		if (c == ' ' || c == '/' || c == '>' || c == '\t' || c == '\r' || c == '\n')
+		{
+			res |= CharTagNameEnd;
+		}
+
+		if (c == '>' || c == ' ' || c == '\r' || c == '\n')
+		{
+			res |= CharClosingTagNameEnd;
+		}
+
+		if (c == '=' || c == ' ' || c == '/' || c == '\t' || c == '\r' || c == '\n')
+		{
+			res |= CharAttrNameEnd;
+		}
+
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '=' || c == '"' || c == '\'' || c == '<' || c == '>')
+		{
+			res |= CharWordEnd;
+		}
+
+		if (c == '[' || c == '>' || c == '"' || c == '\'')
+		{
+			res |= CharDeclarationStop;
+		}
+
+		if (c == '<')
+		{
+			res |= CharMarkupStart;
+		}
+
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ':' || c >= 0x80)
+		{
+			res |= CharNameStart | CharName;
+		}
+
+		if ((c >= '0' && c <= '9') || c == '.' || c == '-')
+		{
+			res |= CharName;
+		}
+
+		return res;
+	}
+
+	constexpr XmlLexAction xmlLexActionOf(XmlLexState state, unsigned char c)
+	{
+		// Markup starts in every state.
+		if (c == '<')
+		{
+			return LexMarkup;
+		}
+
+		switch (state)
+		{
+			case LexStateOpeningTag:
+				switch (c)
+				{
+					case '>':
+						return LexTagEnd;
+
+					case ' ':
+					case '\t':
+						return LexSpace;
+
+					case '\r':
+					case '\n':
+						return LexLineBreak;
+
+					case '/':
+						return LexSlash;
+
+					case '=':
+						return LexEqual;
+
+					case '"':
+					case '\'':
+						return LexQuote;
+
+					default:
+						return LexOther;
+				}
+
+			case LexStateClosingTag:
+			case LexStateDeclaration:
+				switch (c)
+				{
+					case '>':
+						return LexTagEnd;
+
+					case ' ':
+					case '\t':
+						return LexSpace;
+
+					case '\r':
+					case '\n':
+						return LexLineBreak;
+
+					case ']':
+						return (state == LexStateDeclaration ? LexBracketClose : LexOther);
+
+					default:
+						return LexOther;
+				}
+
+			case LexStateText:
+			default:
+				return LexOther;
+		}
+	}
+
+	constexpr std::array<XmlCharClasses, 256> makeXmlCharClassTable()
+	{
+		std::array<XmlCharClasses, 256> table = {};
+		for (int c = 0; c < 256; ++c)
+		{
+			table[c] = xmlCharClassesOf(static_cast<unsigned char>(c));
+		}
+		return table;
+	}
+
+	constexpr std::array<std::array<XmlLexAction, 256>, LexStateCount> makeXmlLexActionTables()
+	{
+		std::array<std::array<XmlLexAction, 256>, LexStateCount> tables = {};
+		for (int state = 0; state < LexStateCount; ++state)
+		{
+			for (int c = 0; c < 256; ++c)
+			{
+				tables[state][c] = xmlLexActionOf(static_cast<XmlLexState>(state), static_cast<unsigned char>(c));
+			}
+		}
+		return tables;
+	}
+
+	// Class of every byte, built at compile time.
+	inline constexpr std::array<XmlCharClasses, 256> XML_CHAR_CLASSES = makeXmlCharClassTable();
+
+	// Token dispatch of every lexer state, built at compile time.
+	inline constexpr std::array<std::array<XmlLexAction, 256>, LexStateCount> XML_LEX_ACTIONS = makeXmlLexActionTables();
+}
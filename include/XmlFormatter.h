@@ -1,10 +1,15 @@
 #pragma once
 
 #include <map>
+#include <memory_resource>
 #include <sstream>
+#include <string>
 #include <vector>
 
+#include "XmlArena.h"
+#include "XmlLineIndex.h"
 #include "XmlParser.h"
+#include "XmlStructureScanner.h"
 
 #define XPATH_MODE_BASIC            (1 << 0)
 #define XPATH_MODE_WITHNAMESPACE    (1 << 1)
@@ -28,6 +33,13 @@ namespace QuickXml
 		bool dumpIdAttributesName = true;           // Make the currentPath dump the identity attributes name (when XPATH_MODE_KEEPIDATTRIBUTE active).
 	};
 
+	// A formatting variant: pretty print (or linearize) with given parameters.
+	struct XmlFormatterVariant
+	{
+		XmlFormatterParamsType params;
+		bool linearize = false;                     // Linearize instead of pretty printing.
+	};
+
 	struct XmlFormatterKeyValType
 	{
 		std::string key;
@@ -36,16 +48,24 @@ namespace QuickXml
 
 	struct XmlFormatterXPathEntry
 	{
-		std::string name;
+		std::pmr::string name;
 		size_t position;
-		std::string attr;                           // Last attribute parsed.
+		std::pmr::string attr;                      // Last attribute parsed.
 		std::vector<XmlFormatterKeyValType> attributes; // Ident attributes.
+
+		// Constructor. Entries live in the thread arena while one is active.
+		XmlFormatterXPathEntry(std::pmr::memory_resource* resource = XmlArena::resource()) : name(resource), position(0), attr(resource)
+		{
+		}
 	};
 
 	class XmlFormatter
 	{
 	private:
 		XmlParser* parser = NULL;
+		const char* data = NULL;                    // The formatted data.
+		size_t length = 0;
+		XmlTokenObserver* observer = NULL;          // Notified of every token the parser fetches.
 
 		XmlFormatterParamsType params;
 
@@ -53,7 +73,21 @@ namespace QuickXml
 		size_t indentLevel;                         // The real applied indent level.
 		size_t levelCounter;                        // The level counter.
 
-		bool isIdentAttribute(std::string attr);
+		// Token by token formatting state (see beginTokens).
+		bool linearizing = false;
+		XmlTokenType lastAppliedTokenType = XmlTokenType::Undefined;
+		bool lastTextHasLineBreaks = false;
+		bool applyAutoclose = false;
+		size_t numAttr = 0;
+		size_t currTagNameLength = 0;
+
+		// Indent-only engine state (see indentLines): the pending copy of input chars, and the whitespace dropped before the current markup.
+		size_t copyBegin = 0;
+		size_t copyEnd = 0;
+		size_t droppedBegin = 0;
+		size_t droppedEnd = 0;
+
+		bool isIdentAttribute(const std::pmr::string& attr);
 
 		// Adds an EOL char to output stream.
 		void writeEOL();
@@ -64,9 +98,47 @@ namespace QuickXml
 		// Adds a custom string into output stream. The string can be added several times by specifying the num parameter.
 		void writeElement(std::string str, size_t num = 1);
 
+		// Prepare a token by token pretty print (or linearize). When atLineStart is set, the first line is indented as if it followed a line break.
+		void beginTokens(bool linearize, bool atLineStart);
+
+		// Format a token of given parser, which must still be positioned on it (its next token and xml:space state are used).
+		void formatToken(XmlParser& parser, const XmlToken& token);
+
+		// Linearize a token of given parser.
+		void linearizeToken(XmlParser& parser, const XmlToken& token);
+
+		// Pretty print a token of given parser.
+		void prettyPrintToken(XmlParser& parser, const XmlToken& token);
+
 		// Change the current indentLevel. The function maintains the level in limits [0 .. params.maxIndentLevel].
 		void updateIndentLevel(int change);
 
+		// Copy the input chars [begin, end) to output stream. Contiguous copies are merged, and written at once by flushInput.
+		void copyInput(size_t begin, size_t end);
+
+		// Write the pending copy of input chars.
+		void flushInput();
+
+		// Write indentations followed by given number of spaces. The input chars [begin, end) are copied instead when they are the same.
+		void writeIndentation(size_t begin, size_t end, size_t spaces);
+
+		// Indicates if a markup construct of the structural scan can be indented by copy: the parser reads it as the scanner does, and only its line breaks are kept from its spacing.
+		bool isCopyableMarkup(const XmlStructureEvent& event) const;
+
+		// Indent-only formatting of the text [begin, end) between markup constructs. The type of the following token tells whether an empty text is applied.
+		void indentText(size_t begin, size_t end, XmlTokenType nextType);
+
+		// Indent-only formatting of a copyable markup construct.
+		void indentMarkup(const XmlStructureEvent& event);
+
+		// Pretty print [begin, end) token by token, from the current formatting state. Returns false when the parser does not end a construct at end.
+		bool prettyPrintSpan(size_t begin, size_t end);
+
+		// Indent-only pretty print driven by the structural scan: the input is copied span by span and only the whitespace around markup is rewritten,
+		// text and markup of unchanged lines go out in a single copy. Markup which cannot be copied is pretty printed token by token.
+		// Returns false when the data needs the token path from start (xml:space handling, or markup the scanner and the parser end differently).
+		bool indentLines();
+
 	public:
 		// Constructor.
 		XmlFormatter(const char* data, size_t length);
@@ -83,6 +155,9 @@ namespace QuickXml
 		// Initialize the formatter with input data.
 		void init(const char* data, size_t length, XmlFormatterParamsType params);
 
+		// Set an observer notified of every token fetched while formatting (NULL to remove it).
+		void setTokenObserver(XmlTokenObserver* observer);
+
 		// Make internal parameters ready for formatting.
 		void reset();
 
@@ -95,9 +170,20 @@ namespace QuickXml
 		// Performs pretty print formatting.
 		std::stringstream* prettyPrint();
 
+		// Performs pretty print formatting of [begin, end) only. The range is widened to whole lines and markup constructs (see XmlStructureScanner::lineRange), the widened range is set in range.
+		// The starting indentation comes from a structural pre-scan of the content before the range, from given state when set. The result is the replacement text of the widened range.
+		std::stringstream* prettyPrintRange(size_t begin, size_t end, XmlStructureRange& range, const XmlStructureScanState* resume = NULL);
+
+		// Format the data with several variants at once. The data is lexed once and each token drives the formatters of all variants, so a variant only costs its output.
+		// Returns one output per variant. The observer, if any, is notified of every token once.
+		static std::vector<std::string> formatVariants(const char* data, size_t length, const std::vector<XmlFormatterVariant>& variants, XmlTokenObserver* observer = NULL);
+
 		// Construct the path of given position.
 		std::stringstream* currentPath(size_t position, int xpathMode = XPATH_MODE_WITHNAMESPACE);
 
+		// Construct the path of given line:column position. The index must have been built on the formatter data.
+		std::stringstream* currentPath(const XmlLineIndex& lines, const XmlLinePosition& position, int xpathMode = XPATH_MODE_WITHNAMESPACE);
+
 		// Construct a default formatter parameters object.
 		static XmlFormatterParamsType getDefaultParams();
 	};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace QuickXml
+{
+	// XmlHasher: A streaming 64-bit hash (XXH64 algorithm). Fast enough to run over whole documents at memory speed.
+	class XmlHasher
+	{
+	private:
+		uint64_t seed;
+		uint64_t acc[4];               // The four stripe accumulators.
+		unsigned char pending[32];     // Bytes waiting for a complete 32 bytes stripe.
+		size_t pendingSize;
+		uint64_t totalLength;
+
+		// Mix a complete 32 bytes stripe into the accumulators.
+		void consumeStripe(const unsigned char* stripe);
+
+	public:
+		// Constructor.
+		XmlHasher(uint64_t seed = 0);
+
+		// Restart hashing with the given seed.
+		void reset(uint64_t seed = 0);
+
+		// Feed some bytes to the hash.
+		void update(const char* data, size_t length);
+
+		// Feed a string to the hash.
+		void update(const std::string& str);
+
+		// Compute the hash of all bytes fed so far. The hasher state is left untouched.
+		uint64_t digest() const;
+
+		// Hash a buffer in one call.
+		static uint64_t hash(const char* data, size_t length, uint64_t seed = 0);
+
+		// Format a hash value as 16 lowercase hexadecimal digits.
+		static std::string toHex(uint64_t value);
+	};
+}
@@ -3,8 +3,11 @@
 #include <memory>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "XmlFormatter.h"
+#include "XmlStructureIndex.h"
+#include "XmlValidator.h"
 
 // XmlIndenter: A wrapper class for different XML formatting engines.
 class XmlIndenter
@@ -19,6 +22,18 @@ private:
 	bool indentOnly;
 	bool autoCloseEmptyElements;
 
+	// Optional well-formedness checker fed while formatting.
+	QuickXml::XmlValidator* validator;
+
+	// Build the formatter parameters of the current settings.
+	QuickXml::XmlFormatterParamsType makeFormatterParams() const;
+
+	// Pre-process the XML content for formatting. Sets the offset of the kept content, and the offset of the unterminated markup removed from its end (npos if none).
+	std::string preprocessContent(size_t& startIndex, size_t& truncatedMarkup) const;
+
+	// Complete the validation of the processed content, locating the errors in the original content.
+	void finishValidation(const std::string& processedContent, size_t startIndex, size_t truncatedMarkup);
+
 public:
 	// Constructor with default settings.
 	XmlIndenter(const std::string& xmlContent);
@@ -32,12 +47,26 @@ public:
 	// Indent XML content using QuickXml formatter.
 	std::string indentXML();
 
+	// Indent XML content with several variants at once, for publishing a document in several layouts. The content is lexed once for all variants.
+	// Returns one output per variant, post-processed like indentXML outputs.
+	std::vector<std::string> indentXMLVariants(const std::vector<QuickXml::XmlFormatterVariant>& variants);
+
+	// Indent only the lines of [begin, end), for editors reformatting a selection. The range is widened to whole lines and markup constructs and set in range.
+	// Returns the replacement text of the widened range. The content before the range is only pre-scanned for the indentation depth, from the nearest checkpoint of given index when set.
+	std::string indentXMLRange(size_t begin, size_t end, QuickXml::XmlStructureRange& range, const QuickXml::XmlStructureIndex* index = NULL);
+
+	// Build the formatter parameters of given settings, as used by indentXML.
+	static QuickXml::XmlFormatterParamsType makeFormatterParams(const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements);
+
 	// Setters for options.
 	void setIndentString(const std::string& str);
 	void setEOLString(const std::string& str);
 	void setIndentOnly(bool indentOnly);
 	void setAutoCloseEmptyElements(bool autoClose);
 
+	// Validate the document in the same pass as it is formatted. Errors offsets and positions refer to the original content.
+	void setValidator(QuickXml::XmlValidator* validator);
+
 	// Getters for options.
 	std::string getIndentString() const;
 	std::string getEOLString() const;
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace QuickXml
+{
+	// A line:column position. Both are 1-based, the column counts bytes.
+	struct XmlLinePosition
+	{
+		size_t line;
+		size_t column;
+
+		// Format the position as "line:column".
+		std::string toString() const;
+
+		// Parse a "line:column" string. Returns false when the string is not a valid position.
+		static bool parse(const std::string& str, XmlLinePosition& position);
+	};
+
+	// XmlLineIndex: The start offset of every line of a document, to convert byte offsets from/to line:column positions in O(log n).
+	// "\r\n", lone "\r" and lone "\n" all count as one line break, as normalizeLineEndings does.
+	class XmlLineIndex
+	{
+	private:
+		std::vector<size_t> lineStarts; // Offset of the first byte of every line.
+		size_t length;                  // The document length.
+
+		// Record the line break found at given offset.
+		void addLineBreak(const char* data, size_t offset);
+
+	public:
+		// Constructor. The index is built at once, the data is not kept.
+		XmlLineIndex(const char* data, size_t length);
+
+		// Get the number of lines of the document.
+		size_t lineCount() const;
+
+		// Get the position of given byte offset. Offsets of line break chars belong to the line they end.
+		XmlLinePosition positionOf(size_t offset) const;
+
+		// Get the byte offset of given position. Throws std::out_of_range when the position is outside of the document.
+		size_t offsetOf(const XmlLinePosition& position) const;
+	};
+}
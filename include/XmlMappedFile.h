@@ -0,0 +1,38 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+namespace QuickXml
+{
+	// XmlMappedFile: A read-only view of a whole file. The file is memory mapped where the system supports it, so only the pages used are read; otherwise it is read at once.
+	class XmlMappedFile
+	{
+	private:
+		const char* data = NULL;
+		size_t length = 0;
+		void* mapping = NULL;                       // The mapped pages (NULL when the file was read).
+		std::string buffer;                         // The content when the file was read.
+
+	public:
+		// Constructor.
+		XmlMappedFile() {}
+
+		// Destructor.
+		~XmlMappedFile();
+
+		// Disable copying.
+		XmlMappedFile(const XmlMappedFile&) = delete;
+		XmlMappedFile& operator=(const XmlMappedFile&) = delete;
+
+		// Open a file, closing the current one. Returns false when it cannot be opened.
+		bool open(const std::filesystem::path& path);
+
+		// Close the file.
+		void close();
+
+		// Getters.
+		const char* getData() const { return this->data; }
+		size_t getLength() const { return this->length; }
+	};
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// Result of a cache lookup.
+enum class XmlCacheResult
+{
+	Miss,      // Nothing cached for this content and options.
+	Clean,     // The content is already formatted, output equals input.
+	Formatted  // The formatted output has been loaded.
+};
+
+// XmlOutputCache: A content-addressed cache of formatted outputs, shareable between concurrent processes.
+class XmlOutputCache
+{
+private:
+	// Root directory of the cache.
+	std::filesystem::path directory;
+
+	// Size bound enforced by trim().
+	uint64_t maxBytes;
+
+	// Bytes stored by this process (trim() is skipped when nothing was stored).
+	std::atomic<uint64_t> storedBytes;
+
+	// Builds the entry key (32 hex digits) from the content and the options key.
+	std::string entryKey(const std::string& content, const std::string& optionsKey) const;
+
+	// Builds the entry path from its key. Entries are spread in 256 sub-directories.
+	std::filesystem::path entryPath(const std::string& key) const;
+
+public:
+	// Constructor.
+	XmlOutputCache(const std::filesystem::path& directory, uint64_t maxBytes);
+
+	// Destructor.
+	~XmlOutputCache();
+
+	// Search the cache. The output is only filled when the result is XmlCacheResult::Formatted.
+	XmlCacheResult lookup(const std::string& content, const std::string& optionsKey, std::string& output);
+
+	// Store the result of a formatting. Clean entries only store a marker.
+	void store(const std::string& content, const std::string& optionsKey, const std::string& output);
+
+	// Evict least recently used entries until the cache fits in its size bound.
+	void trim();
+
+	// Builds the options key of the given formatting settings. Entries stored with validate set only exist for well-formed documents.
+	static std::string makeOptionsKey(const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements, bool validate = false);
+};
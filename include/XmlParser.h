@@ -1,9 +1,15 @@
 #pragma once
 
+#include <deque>
 #include <list>
+#include <memory_resource>
 #include <sstream>
 #include <stack>
 
+#include "XmlArena.h"
+#include "XmlCharClass.h"
+#include "XmlStructureScanner.h"
+
 namespace QuickXml
 {
 	struct XmlContext
@@ -51,6 +57,17 @@ namespace QuickXml
 
 	const XmlToken undefinedToken = { XmlTokenType::Undefined, 0, "", 0 };
 
+	// XmlTokenObserver: Receives every token once, in document order, as the parser fetches it.
+	class XmlTokenObserver
+	{
+	public:
+		// Destructor.
+		virtual ~XmlTokenObserver() {}
+
+		// Called for every fetched token, except the end of file.
+		virtual void onToken(const XmlToken& token) = 0;
+	};
+
 	class XmlParser
 	{
 	private:
@@ -69,17 +86,44 @@ namespace QuickXml
 		XmlToken currtoken;    // The current parsed token.
 		XmlToken nexttoken;    // The following token.
 
+		XmlTokenObserver* observer = NULL; // Notified of every fetched token.
+
+		// Fetch next token from the stream and notify the observer.
 		XmlToken fetchToken();
 
-		// A queue of read tokens.
-		std::list<XmlToken> buffer;
+		// Read next token from the stream.
+		XmlToken scanToken();
+
+		// Fetch a token starting with '<'.
+		XmlToken fetchMarkupToken();
+
+		// Fetch an attribute name or value token of an opening tag.
+		XmlToken fetchAttributeToken(bool startsWithQuote);
+
+		// Drop the xml:space entry of an element ending. It is dropped at the end of its end tag, so that its last text is still in its xml:space context for the lookahead.
+		void popSpacePreserve();
+
+		// Drop the xml:space entry of the element of an end tag missing its '>', when the next markup starts.
+		void closeUnterminatedTag();
 
-		// A stack maintaining xml:space.
-		std::stack<bool> preserveSpace;
+		// Gets the lexer state selecting the dispatch table.
+		XmlLexState lexState() const;
+
+		// Indicates if the stream continues with given chars (never reads past the end of stream).
+		bool lookingAt(const char* str, size_t length) const;
+
+		// Find the first occurrence of str from given position, never reading past the end of stream. Returns srcLength when not found.
+		size_t findString(size_t from, const char* str, size_t length) const;
+
+		// A queue of read tokens (allocated in the thread arena).
+		std::pmr::list<XmlToken> buffer;
+
+		// A stack maintaining xml:space (allocated in the thread arena).
+		std::stack<bool, std::pmr::deque<bool>> preserveSpace;
 
 	public:
-		// Constructor.
-		XmlParser(const char* data, size_t length);
+		// Constructor. The lexer stacks are allocated from given resource (the thread arena by default).
+		XmlParser(const char* data, size_t length, std::pmr::memory_resource* resource = XmlArena::resource());
 
 		// Destructor.
 		~XmlParser();
@@ -87,38 +131,65 @@ namespace QuickXml
 		// Reset the parser settings.
 		void reset();
 
+		// Start inside depth open elements with given xml:space state, for a parser of a part of a document (see XmlStructureScanner::lineRange).
+		void setOpenElements(size_t depth, const XmlSpaceSwitches& spaceSwitches);
+
+		// Set the observer notified of every fetched token (NULL to remove it).
+		void setObserver(XmlTokenObserver* observer) { this->observer = observer; }
+
 		// Getters.
 		XmlToken getPrevToken() { return this->prevtoken; }
 		XmlToken getCurrToken() { return this->currtoken; }
 		XmlToken getNextToken() { return this->nexttoken; }
+		size_t getPosition() const { return this->currpos; }
 
 		// Indicates if the current node is in xml:space="preserve" context.
 		bool isSpacePreserve();
 
+		// Indicates if an attribute name or an '=' waits for its value. It carries over to the next tag of malformed markup.
+		bool hasPendingAttribute() const { return (this->hasAttrName || this->expectAttrValue); }
+
 		// Get the next non-text token. This function feeds the tokens queue until it finds a structural token. The queue is popped on next "parseNext()" calls.
 		XmlToken getNextStructureToken();
 
 		// Fetch next token.
 		XmlToken parseNext();
 
+		// Continue over a longer copy of the stream: data starts with the same chars, followed by new ones. Positions stay valid, the chars of tokens fetched before are moved to data.
+		void extend(const char* data, size_t length);
+
+		// Fetch the next token, without lookahead, of a stream which may continue (moreData set). A token reaching the end of the available chars may be incomplete then:
+		// the lexer state is restored and false is returned, to fetch it again after extend. The end of file is only returned when moreData is not set.
+		bool lexNext(XmlToken& token, bool moreData);
+
 		// Parse input until first token of given type. Multiple tokens can be passed using OR operator (ex. XmlTokenType::Declaration | XmlTokenType::TagOpening).
 		XmlToken parseUntil(XmlTokensType type);
 
 		// Reads some chars in main stream.
 		size_t readChars(size_t nchars = 1);
 
-		// Reads the next word in main stream and update cursor position.
+		// Reads the next word in main stream and update cursor position. With skipQuotedStrings (unquoted attribute values), the word also ends at the tag end.
 		size_t readNextWord(bool skipQuotedStrings = false);
 
 		// Reads stream (and update cursor position) until given delimiter. A delimiter which introduce a segment to ignore can be used with skipDelimiter parameter.
+		// The stream is read once in linear time and never past its end, an unterminated segment ends with the stream.
 		size_t readUntil(const char* delimiter, size_t offset = 0, bool goAfter = false, std::string skipDelimiter = "");
 
 		// Reads stream (and update cursor position) until it finds one of given characters.
 		size_t readUntilFirstOf(const char* characters, size_t offset = 0, bool goAfter = false);
 
+		// Reads stream (and update cursor position) until it finds a character of given classes.
+		size_t readUntilFirstOf(XmlCharClasses classes, size_t offset = 0, bool goAfter = false);
+
+		// Reads stream (and update cursor position) until it finds given character.
+		size_t readUntilChar(char character, size_t offset = 0, bool goAfter = false);
+
 		// Reads stream (and update cursor position) until it finds any characters which differs from given characters.
 		size_t readUntilFirstNotOf(const char* characters, size_t offset = 0);
 
+		// Reads stream (and update cursor position) until it finds a character which belongs to none of given classes.
+		size_t readUntilFirstNotOf(XmlCharClasses classes, size_t offset = 0);
+
 		// Reads stream until end of incoming declaration.
 		size_t readDeclaration();
 
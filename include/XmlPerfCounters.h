@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Counted phases of the formatting of a file.
+enum XmlCounterPhase
+{
+	CounterPreprocess = 0,
+	CounterFormat,                      // Lexing and pretty printing, the parser lexes tokens as the formatter asks for them.
+	CounterPostprocess,
+	CounterPhaseCount
+};
+
+// Counted hardware events.
+enum XmlCounterEvent
+{
+	CounterCycles = 0,
+	CounterInstructions,
+	CounterBranchMisses,
+	CounterCacheMisses,                 // Last level cache misses.
+	CounterEventCount
+};
+
+// Hardware event counts. An event the CPU or the kernel does not provide is not available.
+struct XmlCounterValues
+{
+	uint64_t values[CounterEventCount] = {};
+	bool available[CounterEventCount] = {};
+
+	// Accumulate other counts.
+	XmlCounterValues& operator+=(const XmlCounterValues& other);
+};
+
+// The counts of the phases of a file.
+struct XmlFileCounters
+{
+	std::string path;
+	XmlCounterValues phases[CounterPhaseCount];
+};
+
+// The counters of a thread. Only the owner thread updates them, they are read once every thread is done.
+struct XmlCounterThread
+{
+	int fds[CounterEventCount] = { -1, -1, -1, -1 };
+	int slots[CounterEventCount] = { -1, -1, -1, -1 };  // Position of each event in the group reads (-1: not available).
+	int groupSize = 0;
+	XmlCounterValues current[CounterPhaseCount];        // Counts of the file being formatted.
+	bool counted = false;                               // A phase of the current file was counted.
+	std::vector<XmlFileCounters> files;
+	XmlCounterThread* next = NULL;                      // Next registered thread.
+};
+
+// XmlPerfCounters: Hardware performance counters (cycles, instructions, branch misses, LLC misses) read around the formatting phases of every file, on every thread.
+// Uses perf_event_open: when the kernel refuses it (or on other systems), counting is turned off with a message and formatting goes on.
+class XmlPerfCounters
+{
+private:
+	static std::atomic<bool> enabled;
+	static std::atomic<XmlCounterThread*> threads;      // Lock-free list of the registered threads.
+
+	// The counters of the calling thread, opened and registered on first use. NULL when they cannot be opened.
+	static XmlCounterThread* local();
+
+	// Print the report to stderr, at exit.
+	static void reportAtExit();
+
+public:
+	// Indicates if phases are counted.
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	// Start counting. Returns false, with the reason in message, when the counters are not available.
+	static bool start(std::string& message);
+
+	// Read the counters of the calling thread. Returns false when they are not available.
+	static bool read(XmlCounterValues& values);
+
+	// Add counts to a phase of the file being formatted on the calling thread.
+	static void addPhase(XmlCounterPhase phase, const XmlCounterValues& values);
+
+	// The file being formatted on the calling thread is done: keep its counts under given path. Files without counted phases (cache hits) are skipped.
+	static void endFile(const std::string& path);
+
+	// Write the counts of every file and the totals of every phase, sorted by path. Every counted thread must be done.
+	static void report(std::ostream& out);
+};
+
+// XmlCounterScope: Counts a phase of the calling thread for the lifetime of the object.
+class XmlCounterScope
+{
+private:
+	XmlCounterPhase phase;
+	XmlCounterValues begin;
+	bool counting;
+
+public:
+	// Constructor.
+	XmlCounterScope(XmlCounterPhase phase) : phase(phase), counting(XmlPerfCounters::isEnabled() && XmlPerfCounters::read(this->begin))
+	{
+	}
+
+	// Destructor.
+	~XmlCounterScope();
+
+	// Disable copying.
+	XmlCounterScope(const XmlCounterScope&) = delete;
+	XmlCounterScope& operator=(const XmlCounterScope&) = delete;
+};
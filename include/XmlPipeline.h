@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "XmlQueue.h"
+
+// A file travelling through the pipeline stages.
+struct XmlPipelineJob
+{
+	size_t index = 0;                   // Position of the file in the input list.
+	std::filesystem::path path;
+	std::string input;                  // Content read by the reader stage.
+	std::string output;                 // Content produced by the formatter stage.
+	bool writeOutput = false;           // Set by the formatter stage when the output must be written.
+	bool failed = false;
+	std::string message;                // Status line printed by the writer stage.
+	size_t bytesReserved = 0;           // Bytes accounted for this job in the in-flight budget.
+};
+
+// Where the time of a pipeline run went, in nanoseconds summed over the threads of each stage.
+struct XmlPipelineStats
+{
+	uint64_t wallTime = 0;
+	uint64_t readTime = 0;              // Reader: reading files.
+	uint64_t readerWaitTime = 0;        // Reader: waiting for the bytes budget or for room in the format queue.
+	uint64_t formatTime = 0;            // Formatters: processing jobs.
+	uint64_t formatterIdleTime = 0;     // Formatters: waiting for a job.
+	uint64_t formatterWaitTime = 0;     // Formatters: waiting for room in the write queue.
+	uint64_t writeTime = 0;             // Writer: writing outputs and reporting status.
+	uint64_t writerIdleTime = 0;        // Writer: waiting for a job.
+	uint64_t bytesRead = 0;
+};
+
+// XmlJobProcessor: The formatting stage of the pipeline. The process method is called concurrently from several threads.
+class XmlJobProcessor
+{
+public:
+	// Destructor.
+	virtual ~XmlJobProcessor() {}
+
+	// Format the job input. Set job.output and job.writeOutput, or job.failed and job.message on errors.
+	virtual void process(XmlPipelineJob& job) = 0;
+};
+
+// XmlPipeline: A three-stage read/format/write pipeline. The stages are connected by bounded lock-free queues and the bytes in flight are capped, so disk and CPUs stay busy together.
+class XmlPipeline
+{
+private:
+	XmlJobProcessor& processor;
+	size_t formatterThreads;
+	size_t maxBytesInFlight;
+
+	XmlBoundedQueue<std::unique_ptr<XmlPipelineJob>> formatQueue;
+	XmlBoundedQueue<std::unique_ptr<XmlPipelineJob>> writeQueue;
+
+	std::atomic<size_t> bytesInFlight;
+	std::atomic<bool> readerDone;
+	std::atomic<size_t> activeFormatters;
+	std::atomic<size_t> successCount;
+
+	// Time spent by the stages, added by each thread when it ends.
+	std::atomic<uint64_t> readTime;
+	std::atomic<uint64_t> readerWaitTime;
+	std::atomic<uint64_t> formatTime;
+	std::atomic<uint64_t> formatterIdleTime;
+	std::atomic<uint64_t> formatterWaitTime;
+	std::atomic<uint64_t> bytesRead;
+	XmlPipelineStats stats;
+	bool quiet = false;                                                 // Success status lines are not printed.
+	std::filesystem::path mirrorInput;                                  // Outputs go to mirrorOutput/(path relative to mirrorInput) instead of the files (empty: files are written).
+	std::filesystem::path mirrorOutput;
+
+	std::ostream* orderedOutput = NULL;                                 // Receives the outputs in input order instead of the files (NULL: files are written).
+	std::map<size_t, std::unique_ptr<XmlPipelineJob>> pendingJobs;      // Jobs done out of order, waiting for the ones before them (writer stage only).
+	size_t nextIndex = 0;                                               // Index of the next job to emit in order.
+
+	// Reader stage: reads files in order, hinting the kernel about the next ones.
+	void readerLoop(const std::vector<std::filesystem::path>& files);
+
+	// Formatter stage (one per formatter thread).
+	void formatterLoop();
+
+	// Writer stage: writes outputs and reports status.
+	void writerLoop();
+
+	// Write the output of a job (or emit it to the ordered output), report its status and release its bytes.
+	void finishJob(std::unique_ptr<XmlPipelineJob>& job);
+
+	// Push a job, waiting while the queue is full. Returns the nanoseconds waited.
+	static uint64_t pushJob(XmlBoundedQueue<std::unique_ptr<XmlPipelineJob>>& queue, std::unique_ptr<XmlPipelineJob>& job);
+
+public:
+	// Constructor.
+	XmlPipeline(XmlJobProcessor& processor, size_t formatterThreads, size_t maxBytesInFlight);
+
+	// Destructor.
+	~XmlPipeline();
+
+	// Emit the outputs to given stream in input order instead of writing the files, as concatenating build rules expect (NULL to write files again).
+	// Unchanged files are emitted as read, success status lines are not printed. The jobs done ahead of their turn are held in the bytes in flight budget, so memory stays bounded.
+	void setOrderedOutput(std::ostream* output) { this->orderedOutput = output; }
+
+	// Write the outputs to a mirror of the inputRoot tree under outputRoot instead of the files (empty paths to write files again). Unchanged files are copied by the kernel.
+	// The directories of the mirror must exist, see createMirrorDirectories.
+	void setMirror(const std::filesystem::path& inputRoot, const std::filesystem::path& outputRoot) { this->mirrorInput = inputRoot; this->mirrorOutput = outputRoot; }
+
+	// Do not print the success status lines, for benchmarks.
+	void setQuiet(bool quiet) { this->quiet = quiet; }
+
+	// Process the files. Returns the number of files successfully processed.
+	size_t run(const std::vector<std::filesystem::path>& files);
+
+	// Where the time of the last run went.
+	const XmlPipelineStats& getStats() const { return this->stats; }
+
+	// Ask the kernel to start reading a file ahead of its use.
+	static void adviseWillNeed(const std::filesystem::path& path);
+
+	// Read a whole file. Throws on errors.
+	static std::string readWholeFile(const std::filesystem::path& path);
+
+	// Write a whole file. Throws on errors.
+	static void writeWholeFile(const std::filesystem::path& path, const std::string& content);
+
+	// Copy a whole file without going through user space: a reflink where the filesystem shares extents, else an in-kernel copy. Throws on errors.
+	static void copyWholeFile(const std::filesystem::path& from, const std::filesystem::path& to);
+
+	// The path of a file of the inputRoot tree in its mirror under outputRoot.
+	static std::filesystem::path mirrorPath(const std::filesystem::path& path, const std::filesystem::path& inputRoot, const std::filesystem::path& outputRoot);
+
+	// Create the directories of the mirror of given files at once: each directory is created once, parents first, instead of checking the whole chain per file. Throws on errors.
+	static void createMirrorDirectories(const std::vector<std::filesystem::path>& files, const std::filesystem::path& inputRoot, const std::filesystem::path& outputRoot);
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+// XmlBoundedQueue: A bounded lock-free multi-producer multi-consumer queue (Vyukov's sequenced ring buffer).
+template<typename T>
+class XmlBoundedQueue
+{
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence; // Ticket telling which lap of the ring may use the cell.
+		T data;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+
+	// Producers and consumers positions live on separate cache lines.
+	alignas(64) std::atomic<size_t> enqueuePos;
+	alignas(64) std::atomic<size_t> dequeuePos;
+
+public:
+	// Constructor. The capacity is rounded up to the next power of two.
+	XmlBoundedQueue(size_t capacity) : mask(0), enqueuePos(0), dequeuePos(0)
+	{
+		size_t size = 2;
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+
+		this->cells = std::make_unique<Cell[]>(size);
+		this->mask = size - 1;
+		for (size_t i = 0; i < size; ++i)
+		{
+			this->cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	// Disable copying.
+	XmlBoundedQueue(const XmlBoundedQueue&) = delete;
+	XmlBoundedQueue& operator=(const XmlBoundedQueue&) = delete;
+
+	// Push an item, the item is moved only on success. Returns false when the queue is full.
+	bool tryPush(T& item)
+	{
+		Cell* cell;
+		size_t pos = this->enqueuePos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			cell = &this->cells[pos & this->mask];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (dif == 0)
+			{
+				if (this->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (dif < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = this->enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->data = std::move(item);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Pop an item. Returns false when the queue is empty.
+	bool tryPop(T& item)
+	{
+		Cell* cell;
+		size_t pos = this->dequeuePos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			cell = &this->cells[pos & this->mask];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if (dif == 0)
+			{
+				if (this->dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (dif < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = this->dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		item = std::move(cell->data);
+		cell->sequence.store(pos + this->mask + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+// XmlBackoff: Waiting strategy of the queues users. Spins first, then yields, then sleeps so idle stages don't burn a core.
+class XmlBackoff
+{
+private:
+	unsigned int count = 0;
+	std::chrono::steady_clock::time_point waitBegin;    // Start of the current wait.
+	uint64_t waitedTime = 0;                            // Nanoseconds spent in the finished waits.
+
+public:
+	// Wait a little, longer at each call.
+	void pause()
+	{
+		if (this->count == 0)
+		{
+			this->waitBegin = std::chrono::steady_clock::now();
+		}
+
+		if (this->count < 64)
+		{
+			++this->count;
+		}
+		else if (this->count < 128)
+		{
+			++this->count;
+			std::this_thread::yield();
+		}
+		else
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	}
+
+	// Restart with the short waits (call it after progress). Ends the current wait.
+	void reset()
+	{
+		if (this->count > 0)
+		{
+			this->waitedTime += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->waitBegin).count());
+		}
+		this->count = 0;
+	}
+
+	// Nanoseconds spent waiting, up to the last reset.
+	uint64_t getWaitedTime() const
+	{
+		return this->waitedTime;
+	}
+};
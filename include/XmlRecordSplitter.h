@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "XmlPipeline.h"
+#include "XmlQueue.h"
+
+// Capacity of the queue of parts waiting for the writers.
+#define XML_RECORD_SPLITTER_QUEUE_CAPACITY 64
+
+// Digits of the part numbers in output file names (more are used past them).
+#define XML_RECORD_SPLITTER_PART_DIGITS 6
+
+// XmlRecordSplitter: Splits a document into files of a given number of records, the records being the outermost elements matching a name or an absolute path.
+// The document is lexed in a single forward pass. Every part is wrapped in the XML declaration and the start tags of the ancestors of its records, copied as found,
+// and their end tags, so that parts are well-formed documents; a record under other ancestors than the previous one starts a new part. Parts are handed to a pool of writer threads, which optionally run them through a job processor and write them,
+// so that disk I/O overlaps with lexing; the bytes of the parts in flight are capped.
+class XmlRecordSplitter
+{
+private:
+	// An open element of the document.
+	struct OpenElement
+	{
+		std::string_view name;
+		size_t begin;                           // Offset of its start tag.
+		size_t end;                             // Offset after its start tag (0 until the tag is complete).
+	};
+
+	std::vector<std::string> path;             // Names of the path of the records, from the root (a single name: matches at any depth).
+	bool absolute;
+	XmlJobProcessor* processor;                // Formats the parts (NULL: parts are written as found).
+	size_t writerThreads;
+	size_t maxBytesInFlight;
+	XmlBoundedQueue<std::unique_ptr<XmlPipelineJob>> queue;
+	std::atomic<size_t> bytesInFlight;
+	std::atomic<bool> lexerDone;
+	std::atomic<size_t> failedCount;
+	size_t recordCount = 0;
+	size_t partCount = 0;
+
+	// Check whether the innermost open element is a record.
+	bool isRecord(const std::vector<OpenElement>& elements) const;
+
+	// Check whether the count outermost open elements are the given ancestors, by the offsets of their start tags.
+	static bool sameAncestors(const std::vector<OpenElement>& elements, size_t count, const std::vector<size_t>& ancestors);
+
+	// Hand a part to the writers, waiting for room in the bytes budget.
+	void pushPart(const std::filesystem::path& outputPath, std::string& content);
+
+	// Writer thread: process and write parts until the lexer is done and the queue is empty.
+	void writerLoop();
+
+public:
+	// Constructor. spec is an element name, a path of element names matching the innermost elements (records/record), or an absolute path (/export/records/record).
+	// With a processor, parts are run through it before being written. Throws std::runtime_error on empty names.
+	XmlRecordSplitter(const std::string& spec, XmlJobProcessor* processor, size_t writerThreads, size_t maxBytesInFlight);
+
+	// Split a document into files of recordsPerFile records, named outputDirectory/baseName-NNNNNN.xml. Returns false when some part failed to be processed
+	// (it is written as found) or written, failures are reported on stderr.
+	bool run(const char* data, size_t length, const std::filesystem::path& outputDirectory, const std::string& baseName, size_t recordsPerFile);
+
+	// Getters.
+	size_t getRecordCount() const { return this->recordCount; }
+	size_t getPartCount() const { return this->partCount; }
+	size_t getFailedCount() const { return this->failedCount.load(); }
+};
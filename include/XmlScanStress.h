@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The timings of an adversarial input at two sizes.
+struct XmlScanStressResult
+{
+	std::string name;
+	size_t smallSize = 0;
+	size_t largeSize = 0;
+	double smallSeconds = 0;
+	double largeSeconds = 0;
+	bool superLinear = false;           // The time grew much faster than the size.
+	bool outOfBounds = false;           // A token was found outside of the input.
+};
+
+// XmlScanStress: Runs the whole formatting path (tokenizing, formatting with and without validation, fingerprinting and structural scanning) over hostile inputs, to check that no scan is super-linear.
+// Every input is processed at a size and at four times that size: a linear scan takes about four times longer, a quadratic one sixteen times.
+class XmlScanStress
+{
+private:
+	// Time growth factor above which a 4x larger input is reported as super-linear.
+	static constexpr double MAX_GROWTH = 10.0;
+
+	// Time of the larger input below which no growth is reported: page faults and cache warm-up dominate such short times, while a super-linear scan of megabytes takes seconds.
+	static constexpr double MIN_REPORTED_SECONDS = 0.1;
+
+	// Process an input the way a batch worker does. Returns the best time of a few runs, and checks that the tokens stay inside the input.
+	static double timeInput(const std::string& input, bool& outOfBounds);
+
+	// Time an input made of a prefix, a repeated unit and a suffix, at two sizes. Super-linear inputs are timed again, and only reported when confirmed.
+	static XmlScanStressResult measure(const std::string& name, const std::string& prefix, const std::string& unit, const std::string& suffix, size_t size);
+
+public:
+	// Benchmark the adversarial inputs (unterminated comments, CDATA sections and instructions, unbalanced quotes, deep nesting, ...) at the given size.
+	static std::vector<XmlScanStressResult> benchmark(size_t size);
+
+	// Fuzz with random inputs made of markup fragments. Every input is checked like the benchmark ones, the failing ones are returned (their name holds the seed).
+	static std::vector<XmlScanStressResult> fuzz(size_t iterations, size_t size, uint64_t seed);
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "XmlTrace.h"
+
+// Files formatted faster than this are never captured, whatever their size: fixed costs dominate the time per byte of small files.
+#define XML_SLOW_CAPTURE_MIN_NANOSECONDS 1000000ULL
+
+// XmlSlowCapture: Keeps a reproducer of every file formatted slower than a time per byte threshold. The input (truncated to a bound) is copied to a capture directory,
+// with a report of the timing breakdown and of the options next to it. Files are captured from any thread.
+class XmlSlowCapture
+{
+private:
+	static std::atomic<bool> enabled;
+	static std::filesystem::path directory;
+	static double thresholdNanosecondsPerByte;
+	static size_t maxBytes;                           // Bound of the copied input (0: whole input).
+	static std::string options;                       // The command line, stored in the reports.
+	static std::atomic<size_t> capturedCount;
+
+public:
+	// Indicates if slow files are captured.
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	// Start capturing files formatted slower than given nanoseconds per byte to given directory, which is created if needed. Throws on errors.
+	static void start(const std::filesystem::path& directory, double thresholdNanosecondsPerByte, size_t maxBytes, const std::string& options);
+
+	// Capture a file whose formatting took given nanoseconds, with the phase times of its formatting, if it is slow. Returns true when captured.
+	static bool check(const std::string& path, const std::string& content, uint64_t elapsed, const std::vector<XmlTracePhaseTime>& phases);
+
+	// Number of files captured.
+	static size_t getCapturedCount() { return capturedCount.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "XmlLineIndex.h"
+#include "XmlMappedFile.h"
+#include "XmlStructureScanner.h"
+
+// Distance in bytes between two checkpoints of a structural index. Queries scan at most this much content (more inside very long text or comments).
+#define XML_STRUCTURE_INDEX_INTERVAL 8192
+
+// Extension of the index file saved next to a document.
+#define XML_STRUCTURE_INDEX_EXTENSION ".xcidx"
+
+namespace QuickXml
+{
+	// No element (or parent).
+	const uint64_t XML_INDEX_NONE = UINT64_MAX;
+
+	// The identity of an indexed file: an index is only used for the file content it was built from.
+	struct XmlIndexSource
+	{
+		uint64_t size;
+		int64_t time;                   // Last write time, in the file clock ticks.
+		uint64_t hash;                  // Hash of the size and of the first and last 64 KB.
+	};
+
+	// A saved state of the structure scan, before the markup construct at offset. Every field is 64-bit so that the layout is the same in memory and in the file.
+	struct XmlIndexCheckpoint
+	{
+		uint64_t offset;
+		uint64_t line;                  // 1-based line of offset.
+		uint64_t lineBegin;             // Start of that line.
+		uint64_t depth;                 // Number of open elements.
+		uint64_t element;               // The innermost open element (XML_INDEX_NONE at depth 0).
+		uint64_t textBegin;             // End of the previous construct.
+		uint64_t lineStart;             // Last line start outside of markup before offset (see XmlStructureScanner::lineRange).
+		uint64_t lineStartDepth;        // Depth at that line start.
+		uint64_t spaceSwitches;         // First entry of the xml:space state at offset in the switches table, followed by the one at the line start.
+		uint64_t spaceSwitchCount;      // Entries of the state at offset.
+		uint64_t lineStartSpaceSwitchCount; // Entries of the state at the line start.
+	};
+
+	// An element open at one checkpoint at least. Elements opened and closed between two checkpoints are not stored, a query finds them again by scanning.
+	struct XmlIndexElement
+	{
+		uint64_t begin;                 // Offset of the start tag.
+		uint64_t close;                 // Offset of the '>' of the end tag (XML_INDEX_NONE when not closed).
+		uint64_t parent;                // Index of the parent element (XML_INDEX_NONE for a root).
+		uint32_t name;                  // Index of the interned name.
+		uint32_t depth;                 // Number of ancestors.
+	};
+
+	// Head of an index file, followed by the checkpoints, the elements, the xml:space switches, the name offsets (nameCount + 1) and the name chars.
+	struct XmlIndexHeader
+	{
+		char magic[8];
+		uint64_t version;
+		XmlIndexSource source;
+		uint64_t checkpointCount;
+		uint64_t elementCount;
+		uint64_t spaceSwitchCount;
+		uint64_t nameCount;
+		uint64_t nameBytes;
+	};
+
+	// XmlStructureIndex: A compact structural index of a document, saved next to it, so that later runs answer path queries, position conversions and range formatting
+	// without scanning the document from its beginning. The document structure is saved every XML_STRUCTURE_INDEX_INTERVAL bytes: the scan state with its xml:space state
+	// and the chain of open elements (offsets, depths, parent links and interned names). A loaded index is memory mapped, its size is about 1% of the document.
+	class XmlStructureIndex
+	{
+	private:
+		XmlIndexHeader header = {};
+		const XmlIndexCheckpoint* checkpoints = NULL;
+		const XmlIndexElement* elements = NULL;
+		const uint64_t* spaceSwitches = NULL;       // Depths of the xml:space states of the checkpoints (see XmlSpaceSwitches).
+		const uint64_t* nameOffsets = NULL;
+		const char* names = NULL;
+
+		// Storage of a built index (a loaded one stays in its mapping).
+		std::vector<XmlIndexCheckpoint> builtCheckpoints;
+		std::vector<XmlIndexElement> builtElements;
+		std::vector<uint64_t> builtSpaceSwitches;
+		std::vector<uint64_t> builtNameOffsets;
+		std::string builtNames;
+		XmlMappedFile mapping;
+
+		// Get the last checkpoint at or before given offset.
+		const XmlIndexCheckpoint& checkpointBefore(size_t offset) const;
+
+		// Check that the loaded tables only refer to entries that exist.
+		bool checkTables() const;
+
+	public:
+		// Constructor.
+		XmlStructureIndex() {}
+
+		// Disable copying.
+		XmlStructureIndex(const XmlStructureIndex&) = delete;
+		XmlStructureIndex& operator=(const XmlStructureIndex&) = delete;
+
+		// Build the index of a document, in a single scan.
+		void build(const char* data, size_t length, const XmlIndexSource& source);
+
+		// Load an index file. Returns false when it is missing, damaged, or was built from another content than given source.
+		bool load(const std::filesystem::path& path, const XmlIndexSource& source);
+
+		// Save the index. The file is replaced at once, readers never see a partial index. Returns false on write errors.
+		bool save(const std::filesystem::path& path) const;
+
+		// Get the path of the index file of a document.
+		static std::filesystem::path sidecarPath(const std::filesystem::path& file);
+
+		// Get the identity of a document file with its content.
+		static XmlIndexSource describe(const std::filesystem::path& file, const char* data, size_t length);
+
+		// Get the element path at given offset, as XmlFormatter::currentPath does with XPATH_MODE_WITHNAMESPACE.
+		std::string path(const char* data, size_t length, size_t offset) const;
+
+		// Get the position of given byte offset (see XmlLineIndex::positionOf).
+		XmlLinePosition positionOf(const char* data, size_t length, size_t offset) const;
+
+		// Get the byte offset of given position. Throws std::out_of_range when the position is outside of the document (see XmlLineIndex::offsetOf).
+		size_t offsetOf(const char* data, size_t length, const XmlLinePosition& position) const;
+
+		// Get the state to resume XmlStructureScanner::lineRange from, for a range beginning at given offset.
+		XmlStructureScanState scanStateBefore(const char* data, size_t offset) const;
+
+		// Getters.
+		size_t getCheckpointCount() const { return static_cast<size_t>(this->header.checkpointCount); }
+		size_t getElementCount() const { return static_cast<size_t>(this->header.elementCount); }
+	};
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+namespace QuickXml
+{
+	enum XmlStructureEventType
+	{
+		StructElementStart,          // <name ...>
+		StructElementEnd,            // </name>
+		StructEmptyElement,          // <name .../>
+		StructOther                  // Comment, CDATA section, instruction or declaration.
+	};
+
+	// A markup construct found by the scanner, spanning [begin, end).
+	struct XmlStructureEvent
+	{
+		XmlStructureEventType type;
+		size_t begin;
+		size_t end;
+		std::string_view name;       // Element name (empty for StructOther).
+	};
+
+	// The xml:space state of the open elements: the depths (numbers of ancestors) of the ones switching it, in document order, alternately to preserve and back to default.
+	// Content is preserved when the count is odd. Empty outside of preserve regions.
+	typedef std::vector<size_t> XmlSpaceSwitches;
+
+	// A range of a document with the element depth and the xml:space state at its beginning.
+	struct XmlStructureRange
+	{
+		size_t begin;
+		size_t end;
+		size_t depth;
+		XmlSpaceSwitches spaceSwitches;
+	};
+
+	// The state of the lineRange scan before a markup construct, to resume the scan there instead of at the beginning of the document (see XmlStructureIndex).
+	struct XmlStructureScanState
+	{
+		size_t offset;               // Begin of the construct.
+		size_t depth;                // Element depth before it.
+		size_t textBegin;            // End of the previous construct.
+		size_t lineStart;            // Last line start outside of markup before the construct (0 when none).
+		size_t lineStartDepth;       // Element depth at that line start.
+		XmlSpaceSwitches spaceSwitches;             // xml:space state before the construct.
+		XmlSpaceSwitches lineStartSpaceSwitches;    // xml:space state at the line start.
+	};
+
+	// XmlStructureScanner: A fast scan of the markup constructs of a document, without tokenizing text and attributes.
+	// It jumps from '<' to '<' with memchr and only looks inside tags for quotes and their end, so it runs at memory speed on large documents.
+	class XmlStructureScanner
+	{
+	private:
+		const char* data;
+		size_t length;
+		size_t pos;
+
+		// Find the first occurrence of str from given offset. Returns the length when not found.
+		size_t find(size_t from, const char* str, size_t strLength) const;
+
+		// Find the end of a tag (after its '>'), skipping quoted attribute values.
+		size_t findTagEnd(size_t from) const;
+
+		// Find the end of a declaration (after its '>' or "]>"), skipping quoted strings and internal subsets.
+		size_t findDeclarationEnd(size_t from) const;
+
+	public:
+		// Constructor. Scanning starts at given offset, which must not be inside markup.
+		XmlStructureScanner(const char* data, size_t length, size_t offset = 0);
+
+		// Read the next markup construct. Returns false at end of document.
+		bool next(XmlStructureEvent& event);
+
+		// Get the element depth at an offset, and the construct containing it if any. Scans the document up to offset.
+		// When offset is inside a construct, markup is set to it and the depth is the one before the construct.
+		static size_t depthAt(const char* data, size_t length, size_t offset, XmlStructureEvent* markup = NULL);
+
+		// Find where the documents of a concatenation of documents start: at each XML declaration ("<?xml" followed by a space) after the first char.
+		// Terminated comments and CDATA sections are skipped. A declaration inside any other construct (an unterminated one, or a tag with an unbalanced quote) also starts a document,
+		// so a malformed document cannot swallow the next ones.
+		static std::vector<size_t> documentStarts(const char* data, size_t length);
+
+		// Get the xml:space value set by the attributes of a start tag: 1 for preserve, 0 for default, -1 when it has none (or another value).
+		// Only whole attribute names and quoted values match, as in XmlParser; text inside other attribute values is skipped.
+		static int spaceAttribute(const char* data, const XmlStructureEvent& event);
+
+		// Update an xml:space state with an element start or end tag, depth being the number of open elements before it.
+		static void updateSpaceSwitches(XmlSpaceSwitches& switches, const char* data, const XmlStructureEvent& event, size_t depth);
+
+		// Widen [begin, end) to whole lines, and to whole markup constructs for the ones crossing its bounds, so that it can be formatted on its own.
+		// The scan of the content before the range starts from given state when it is before the line of begin. The range depth and xml:space state are those at its beginning.
+		static XmlStructureRange lineRange(const char* data, size_t length, size_t begin, size_t end, const XmlStructureScanState* resume = NULL);
+	};
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+namespace QuickXml
+{
+	// The largest node of a kind found so far.
+	struct XmlLargestNode
+	{
+		size_t size = 0;
+		std::string file;
+		size_t offset = 0;
+	};
+
+	// XmlStructureStats: Statistics of the structure of documents, collected from their token stream in one pass: element and attribute name frequencies, depths,
+	// the largest text, comment and CDATA nodes and the xml:space="preserve" regions. Statistics of several threads are merged at the end.
+	class XmlStructureStats
+	{
+	private:
+		uint64_t files = 0;
+		uint64_t bytes = 0;
+		uint64_t elements = 0;
+		uint64_t attributes = 0;
+		uint64_t depthSum = 0;                                      // Sum of the depths of all elements, for the mean depth.
+		size_t maxDepth = 0;
+		std::string maxDepthFile;
+		uint64_t preserveRegions = 0;                               // Elements with xml:space="preserve".
+		XmlLargestNode largestText;
+		XmlLargestNode largestComment;
+		XmlLargestNode largestCDATA;
+		std::unordered_map<std::string, uint64_t> elementNames;
+		std::unordered_map<std::string, uint64_t> attributeNames;
+
+		// Keep a node if it is larger than the largest one.
+		static void updateLargest(XmlLargestNode& largest, size_t size, const std::string& file, size_t offset);
+
+	public:
+		// Collect the statistics of a document.
+		void add(const char* data, size_t length, const std::string& file);
+
+		// Add the statistics of another collector.
+		void merge(const XmlStructureStats& other);
+
+		// Write the report, names by decreasing frequency.
+		void report(std::ostream& out) const;
+	};
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "XmlPipeline.h"
+
+// Size of a tar block. Headers take one block, member data is padded to a whole number of blocks.
+#define XML_TAR_BLOCK_SIZE 512
+
+// XmlTarRewriter: Rewrites a tar archive stream in a single forward pass, running its XML and XSD members through a job processor and fixing the sizes and checksums of their headers.
+// Other members are copied through block by block. Only one XML member (with its output) is held in memory at a time, larger members than a bound are copied untouched.
+// Supports ustar headers, base-256 sizes, GNU long names and pax extended headers (their size record is updated).
+class XmlTarRewriter
+{
+private:
+	XmlJobProcessor& processor;
+	uint64_t maxMemberBytes;
+	std::istream* in = NULL;
+	std::ostream* out = NULL;
+	uint64_t offset = 0;                        // Offset of the next input block, for errors.
+	size_t memberCount = 0;
+	size_t formattedCount = 0;
+	size_t failedCount = 0;
+
+	// Read whole blocks. Returns false at the end of the stream before the first byte, throws on a truncated block.
+	bool readBlocks(char* data, size_t blocks);
+
+	// Read the data of a member into content (its padding is skipped).
+	void readData(uint64_t size, std::string& content);
+
+	// Copy the data of a member (and its padding) to the output.
+	void copyData(uint64_t size);
+
+	// Write data followed by its padding.
+	void writeData(const std::string& content);
+
+	// Write a header. Its size field and checksum are updated when the member size changed, otherwise it is written as read.
+	void writeHeader(char* header, uint64_t size, uint64_t newSize);
+
+public:
+	// Constructor. XML members larger than maxMemberBytes are copied untouched.
+	XmlTarRewriter(XmlJobProcessor& processor, uint64_t maxMemberBytes);
+
+	// Rewrite the archive read from in to out. Throws std::runtime_error on malformed archives and I/O errors.
+	void run(std::istream& in, std::ostream& out);
+
+	// Getters.
+	size_t getMemberCount() const { return this->memberCount; }
+	size_t getFormattedCount() const { return this->formattedCount; }
+	size_t getFailedCount() const { return this->failedCount; }
+
+	// Read a numeric header field, octal or base-256.
+	static uint64_t parseNumber(const char* field, size_t length);
+
+	// Write a numeric header field, in octal when it fits, else in base-256.
+	static void formatNumber(char* field, size_t length, uint64_t value);
+
+	// Compute the checksum of a header, its checksum field counting as spaces.
+	static uint64_t checksum(const char* header);
+};
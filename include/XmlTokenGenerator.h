@@ -0,0 +1,138 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <string>
+#include <string_view>
+
+#include "XmlParser.h"
+
+namespace QuickXml
+{
+	// A token yielded by the generator. The chars are a view of the source data, valid until the next chunk is pushed.
+	struct XmlTokenView
+	{
+		XmlTokenType type;
+		size_t pos;                  // The token position in stream.
+		std::string_view chars;
+		XmlContext context;          // The token parsing context.
+	};
+
+	// XmlChunkSource: An input fed by chunks, for async readers. The lexer suspends on it when its data runs out, and is resumed by the push growing the data past the length
+	// it waits for, or by close. The data is kept whole, consumed chars included: a document fed by chunks takes as much memory as a document read at once.
+	class XmlChunkSource
+	{
+	private:
+		std::string data;
+		bool closed = false;
+		std::coroutine_handle<> waiting;                // The lexer suspended for more data.
+		size_t waitingLength = 0;                       // The length of data it waits to be exceeded.
+
+		// Resume the lexer waiting for data, if any.
+		void resumeWaiting();
+
+	public:
+		// Awaiter suspending the lexer until the data grows past given length or the input is closed.
+		struct MoreData
+		{
+			XmlChunkSource& source;
+			size_t length;
+
+			bool await_ready() const noexcept { return (this->source.closed || this->source.data.length() > this->length); }
+			void await_suspend(std::coroutine_handle<> handle) noexcept { this->source.waiting = handle; this->source.waitingLength = this->length; }
+			void await_resume() const noexcept {}
+		};
+
+		// Append a chunk. A lexer waiting for data runs on the calling thread until it needs more, once the data is longer than it waits for.
+		void push(const char* chunk, size_t length);
+
+		// Signal the end of the input.
+		void close();
+
+		// Awaitable resuming when data is available after the current data.
+		MoreData moreData() { return { *this, this->data.length() }; }
+
+		// Awaitable resuming when the data is longer than given length, or the input is closed.
+		MoreData moreData(size_t length) { return { *this, length }; }
+
+		// Getters.
+		const char* getData() const { return this->data.data(); }
+		size_t getLength() const { return this->data.length(); }
+		bool isClosed() const { return this->closed; }
+	};
+
+	// XmlTokenGenerator: A lazy token generator. Tokens are lexed on demand, one at a time, and the lexer suspends on its source when a chunk runs out instead of blocking a thread.
+	// Consumers either co_await next() from a coroutine, or call tryNext() when they feed the source themselves.
+	class XmlTokenGenerator
+	{
+	public:
+		struct promise_type;
+		typedef std::coroutine_handle<promise_type> Handle;
+
+		// Awaiter of the lexer coroutine: when it yields or ends, the consumer waiting for a token resumes.
+		struct YieldAwaiter
+		{
+			bool await_ready() const noexcept { return false; }
+			std::coroutine_handle<> await_suspend(Handle handle) noexcept;
+			void await_resume() const noexcept {}
+		};
+
+		struct promise_type
+		{
+			XmlTokenView current = { XmlTokenType::Undefined, 0, std::string_view(), { false, false, 0 } };
+			bool pending = false;                       // A token was yielded and not taken yet.
+			std::coroutine_handle<> continuation;       // The consumer waiting for a token.
+			std::exception_ptr exception;
+
+			XmlTokenGenerator get_return_object() { return XmlTokenGenerator(Handle::from_promise(*this)); }
+			std::suspend_always initial_suspend() const noexcept { return {}; }
+			YieldAwaiter final_suspend() const noexcept { return {}; }
+			YieldAwaiter yield_value(const XmlTokenView& token) noexcept;
+			void return_void() const noexcept {}
+			void unhandled_exception() { this->exception = std::current_exception(); }
+		};
+
+		// Awaiter of the consumer: resumes the lexer until it yields a token (true) or ends (false).
+		struct NextAwaiter
+		{
+			Handle generator;
+
+			bool await_ready() const noexcept { return (this->generator.promise().pending || this->generator.done()); }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) noexcept;
+			bool await_resume();
+		};
+
+	private:
+		Handle handle;
+
+		// Constructor.
+		explicit XmlTokenGenerator(Handle handle) : handle(handle) {}
+
+		// Take the pending token, if any. Rethrows the lexer exceptions.
+		static bool take(Handle handle);
+
+	public:
+		// Destructor.
+		~XmlTokenGenerator();
+
+		// Move only.
+		XmlTokenGenerator(XmlTokenGenerator&& other) noexcept : handle(other.handle) { other.handle = NULL; }
+		XmlTokenGenerator(const XmlTokenGenerator&) = delete;
+		XmlTokenGenerator& operator=(const XmlTokenGenerator&) = delete;
+
+		// Awaitable giving true when a new token is available in current(), false at the end of the input.
+		NextAwaiter next() { return { this->handle }; }
+
+		// Lex until the next token without suspending the caller. Returns false at the end of the input, or when the lexer waits for data (see isDone).
+		bool tryNext();
+
+		// Indicates that every token has been yielded.
+		bool isDone() const { return this->handle.done(); }
+
+		// The last token taken.
+		const XmlTokenView& current() const { return this->handle.promise().current; }
+
+		// Lex the tokens of a source lazily. The source must outlive the generator. The lexer does not use the thread arena, it can be resumed from any thread.
+		static XmlTokenGenerator tokens(XmlChunkSource& source);
+	};
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A timed phase of a thread. Names are string literals, the detail (a file path) is only copied while tracing.
+struct XmlTraceEvent
+{
+	const char* name;
+	uint64_t begin;                     // Nanoseconds since the start of the trace.
+	uint64_t end;
+	std::string detail;
+};
+
+// The time spent in a phase while formatting a file.
+struct XmlTracePhaseTime
+{
+	const char* name;
+	uint64_t duration;                  // Nanoseconds.
+};
+
+// The events of a thread. Only the owner thread appends, the buffer is read once every thread is done.
+struct XmlTraceBuffer
+{
+	size_t threadId = 0;
+	std::string threadName;
+	std::vector<XmlTraceEvent> events;
+	std::vector<XmlTracePhaseTime> phaseTimes;   // Times of the phases of the current file (see takePhaseTimes).
+	XmlTraceBuffer* next = NULL;        // Next registered buffer.
+};
+
+// XmlTrace: A timeline of the processing phases of every thread (discovery, read, pre-process, format, post-process, write), written as Chrome trace-event JSON for chrome://tracing or Perfetto.
+// Each thread records into its own buffer without locking. When tracing is off, a phase costs a relaxed load and a branch.
+// The phases can also be summed per file instead of (or besides) being kept in the timeline.
+class XmlTrace
+{
+private:
+	static std::atomic<bool> enabled;
+	static bool timeline;                             // Events are kept for the trace file.
+	static bool phaseTimes;                           // Phase durations are summed per file.
+	static std::atomic<XmlTraceBuffer*> buffers;      // Lock-free list of the registered buffers.
+	static std::atomic<size_t> threadCount;
+	static uint64_t origin;
+	static std::string outputPath;
+
+	// The buffer of the calling thread, registered on first use.
+	static XmlTraceBuffer& local();
+
+	// Write the trace to the output path, at exit.
+	static void writeAtExit();
+
+public:
+	// Indicates if phases are recorded.
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	// Start recording. The trace is written to given file at exit.
+	static void start(const std::string& path);
+
+	// Start summing the phase durations of every file, see takePhaseTimes.
+	static void startPhaseTimes();
+
+	// Take the phase durations summed on the calling thread since the last call, in order of first appearance.
+	static std::vector<XmlTracePhaseTime> takePhaseTimes();
+
+	// Current time of the trace clock.
+	static uint64_t now();
+
+	// Record a phase of the calling thread.
+	static void record(const char* name, uint64_t begin, uint64_t end, const std::string& detail);
+
+	// Name the calling thread in the timeline.
+	static void setThreadName(const char* name);
+
+	// Write the recorded events as Chrome trace-event JSON. Every traced thread must be done. Returns false on write errors.
+	static bool write(const std::string& path);
+};
+
+// XmlTraceScope: Records a phase of the calling thread for the lifetime of the object.
+class XmlTraceScope
+{
+private:
+	const char* name;                   // NULL when tracing is off.
+	uint64_t begin = 0;
+	const std::string* detail;
+
+public:
+	// Constructor. The detail must outlive the scope.
+	XmlTraceScope(const char* name, const std::string* detail = NULL) : name(XmlTrace::isEnabled() ? name : NULL), detail(detail)
+	{
+		if (this->name != NULL)
+		{
+			this->begin = XmlTrace::now();
+		}
+	}
+
+	// Destructor.
+	~XmlTraceScope()
+	{
+		if (this->name != NULL)
+		{
+			XmlTrace::record(this->name, this->begin, XmlTrace::now(), this->detail != NULL ? *this->detail : std::string());
+		}
+	}
+
+	// Disable copying.
+	XmlTraceScope(const XmlTraceScope&) = delete;
+	XmlTraceScope& operator=(const XmlTraceScope&) = delete;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "XmlLineIndex.h"
+#include "XmlParser.h"
+
+namespace QuickXml
+{
+	struct XmlValidationError
+	{
+		size_t offset;               // Byte offset of the faulty construct.
+		XmlLinePosition position;    // Its line:column position (set by locate).
+		std::string message;
+	};
+
+	struct XmlValidatorElement
+	{
+		std::string_view name;
+		size_t offset;
+	};
+
+	// XmlValidator: A well-formedness checker fed with the tokens of the parser, so that a document is validated in the same pass as it is formatted.
+	// It checks tag balance, tag names matching, attribute quoting, duplicated attributes and unterminated comments, CDATA sections and instructions.
+	class XmlValidator : public XmlTokenObserver
+	{
+	private:
+		std::vector<XmlValidatorElement> elements;   // The open elements (names point into the parsed data).
+		std::unordered_map<std::string_view, size_t> openNames; // Number of open elements of each name.
+		std::vector<std::string_view> attributes;    // Attribute names of the current opening tag.
+		std::vector<XmlValidationError> errors;
+		bool inTag;                                  // An opening or closing tag is not terminated yet.
+		size_t tagOffset;
+		std::string_view tagName;
+		bool hasPendingAttr;                         // An attribute name was read and waits for its value.
+		bool pendingAttrHasEqual;
+		XmlToken pendingAttr;
+
+		// Record an error.
+		void addError(size_t offset, const std::string& message);
+
+		// Check that the pending attribute got a value.
+		void checkPendingAttr();
+
+		// Check the tag being closed by a new token.
+		void checkTagTerminated();
+
+		// Open and close an element.
+		void pushElement(std::string_view name, size_t offset);
+		void popElement();
+
+		// Check that a token ends with given delimiter.
+		void checkTerminated(const XmlToken& token, const char* delimiter, const char* what);
+
+	public:
+		// Constructor.
+		XmlValidator();
+
+		// Forget all errors and state, to validate a new document.
+		void reset();
+
+		// Check a token fetched by the parser.
+		void onToken(const XmlToken& token) override;
+
+		// Check the end of document. Must be called once all tokens have been fetched.
+		void finish();
+
+		// Compute the position of every error, and move them to the source document when the parsed data was a pre-processed copy of it.
+		// The parsed data starts at origin in the source document, and has the same line:column layout as the source from there.
+		void locate(const XmlLineIndex& lines, const XmlLineIndex& sourceLines, const XmlLinePosition& origin);
+
+		// Record an error found in the source document outside of the parsed data.
+		void addSourceError(size_t offset, const XmlLinePosition& position, const std::string& message);
+
+		// Indicates if no error was found.
+		bool isValid() const;
+
+		// Get the errors found, in document order.
+		const std::vector<XmlValidationError>& getErrors() const;
+	};
+}
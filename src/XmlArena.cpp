@@ -0,0 +1,86 @@
+#include "XmlArena.h"
+
+// Size of the first arena block of every thread.
+#define XML_ARENA_INITIAL_SIZE (256 * 1024)
+
+// The initial block grows up to this size, bigger documents keep using overflow blocks.
+#define XML_ARENA_MAX_INITIAL_SIZE (64 * 1024 * 1024)
+
+namespace QuickXml
+{
+	void* XmlArenaUpstream::do_allocate(size_t bytes, size_t alignment)
+	{
+		this->allocatedBytes += bytes;
+		return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+	}
+
+	void XmlArenaUpstream::do_deallocate(void* p, size_t bytes, size_t alignment)
+	{
+		std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+	}
+
+	bool XmlArenaUpstream::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+	{
+		return this == &other;
+	}
+
+	XmlArena::XmlArena() : initialSize(XML_ARENA_INITIAL_SIZE), depth(0)
+	{
+		this->initialBlock.reset(new char[this->initialSize]); // Left uninitialized on purpose.
+		this->monotonic = std::make_unique<std::pmr::monotonic_buffer_resource>(this->initialBlock.get(), this->initialSize, &this->upstream);
+	}
+
+	XmlArena::~XmlArena()
+	{
+		this->monotonic.reset();
+	}
+
+	XmlArena& XmlArena::local()
+	{
+		static thread_local XmlArena arena;
+		return arena;
+	}
+
+	std::pmr::memory_resource* XmlArena::resource()
+	{
+		XmlArena& arena = local();
+		if (arena.depth == 0)
+		{
+			return std::pmr::new_delete_resource();
+		}
+		return arena.monotonic.get();
+	}
+
+	void XmlArena::enter()
+	{
+		++local().depth;
+	}
+
+	void XmlArena::leave()
+	{
+		XmlArena& arena = local();
+		if (arena.depth == 0 || --arena.depth > 0)
+		{
+			return;
+		}
+
+		size_t overflow = arena.upstream.getAllocatedBytes();
+		arena.upstream.resetCount();
+		if (overflow == 0 || arena.initialSize >= XML_ARENA_MAX_INITIAL_SIZE)
+		{
+			// Common case: the document fitted in the initial block, releasing only rewinds a pointer.
+			arena.monotonic->release();
+			return;
+		}
+
+		// The document overflowed: free the overflow blocks and grow the initial block so the next documents of this size fit in it.
+		arena.monotonic.reset();
+		arena.initialSize += overflow;
+		if (arena.initialSize > XML_ARENA_MAX_INITIAL_SIZE)
+		{
+			arena.initialSize = XML_ARENA_MAX_INITIAL_SIZE;
+		}
+		arena.initialBlock.reset(new char[arena.initialSize]);
+		arena.monotonic = std::make_unique<std::pmr::monotonic_buffer_resource>(arena.initialBlock.get(), arena.initialSize, &arena.upstream);
+	}
+}
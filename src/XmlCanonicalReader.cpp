@@ -0,0 +1,279 @@
+#include "XmlCanonicalReader.h"
+
+#include <algorithm>
+
+#include "XmlArena.h"
+#include "XmlCharClass.h"
+#include "XmlHash.h"
+
+// Bumped when the canonical token stream changes, so that fingerprints of different versions never match.
+#define XML_FINGERPRINT_VERSION 2
+
+namespace QuickXml
+{
+	// Describe a significant token for difference reports.
+	static std::string describeToken(const XmlCanonicalToken& token)
+	{
+		// Long texts are shortened, only the beginning is needed to locate the difference.
+		std::string text(token.text.substr(0, 40));
+		if (token.text.size() > 40)
+		{
+			text += "...";
+		}
+
+		switch (token.type)
+		{
+			case XmlTokenType::TagOpening:
+				return "element <" + text + ">";
+
+			case XmlTokenType::TagClosing:
+				return "end of element <" + text + ">";
+
+			case XmlTokenType::AttrName:
+				return "attribute '" + text + "'";
+
+			case XmlTokenType::AttrValue:
+				return "attribute value \"" + text + "\"";
+
+			case XmlTokenType::Text:
+				return "text \"" + text + "\"";
+
+			case XmlTokenType::Comment:
+				return "comment \"" + text + "\"";
+
+			case XmlTokenType::CDATA:
+				return "CDATA section \"" + text + "\"";
+
+			case XmlTokenType::Instruction:
+				return "instruction \"" + text + "\"";
+
+			case XmlTokenType::DeclarationBeg:
+			case XmlTokenType::DeclarationEnd:
+			case XmlTokenType::DeclarationSelfClosing:
+				return "declaration \"" + text + "\"";
+
+			case XmlTokenType::EndOfFile:
+				return "end of document";
+
+			default:
+				return "\"" + text + "\"";
+		}
+	}
+
+	XmlCanonicalReader::XmlCanonicalReader(const char* data, size_t length, bool applySpacePreserve) : parser(data, length), applySpacePreserve(applySpacePreserve)
+	{
+	}
+
+	std::string_view XmlCanonicalReader::collapse(const char* chars, size_t size)
+	{
+		const XmlCharClasses whitespace = CharSpace | CharLineBreak;
+		this->buffer.clear();
+
+		size_t i = 0;
+		while (i < size)
+		{
+			// Skip a whitespace run, then copy the following word.
+			while (i < size && (XML_CHAR_CLASSES[static_cast<unsigned char>(chars[i])] & whitespace))
+			{
+				++i;
+			}
+
+			size_t wordStart = i;
+			while (i < size && !(XML_CHAR_CLASSES[static_cast<unsigned char>(chars[i])] & whitespace))
+			{
+				++i;
+			}
+
+			if (i > wordStart)
+			{
+				if (!this->buffer.empty())
+				{
+					this->buffer.push_back(' ');
+				}
+				this->buffer.append(chars + wordStart, i - wordStart);
+			}
+		}
+
+		return this->buffer;
+	}
+
+	std::string_view XmlCanonicalReader::normalizeLineBreaks(const char* chars, size_t size)
+	{
+		// Line breaks are written with the configured end of line: "\r\n", "\r" and "\n" read the same, as for an XML parser.
+		this->buffer.clear();
+		for (size_t i = 0; i < size; ++i)
+		{
+			if (chars[i] == '\r')
+			{
+				this->buffer.push_back('\n');
+				if (i + 1 < size && chars[i + 1] == '\n')
+				{
+					++i;
+				}
+			}
+			else
+			{
+				this->buffer.push_back(chars[i]);
+			}
+		}
+		return this->buffer;
+	}
+
+	std::string_view XmlCanonicalReader::trim(const char* chars, size_t size)
+	{
+		const XmlCharClasses whitespace = CharSpace | CharLineBreak;
+		while (size > 0 && (XML_CHAR_CLASSES[static_cast<unsigned char>(chars[0])] & whitespace))
+		{
+			++chars;
+			--size;
+		}
+		while (size > 0 && (XML_CHAR_CLASSES[static_cast<unsigned char>(chars[size - 1])] & whitespace))
+		{
+			--size;
+		}
+		return this->normalizeLineBreaks(chars, size);
+	}
+
+	bool XmlCanonicalReader::next(XmlCanonicalToken& token)
+	{
+		XmlToken current;
+		while ((current = this->parser.parseNext()).type != XmlTokenType::EndOfFile)
+		{
+			token.type = current.type;
+			token.pos = current.pos;
+			switch (current.type)
+			{
+				case XmlTokenType::TagOpening:
+					this->tagName = std::string_view(current.chars + 1, current.size - 1);
+					token.text = this->tagName;
+					return true;
+
+				case XmlTokenType::TagClosing:
+					token.text = std::string_view(current.chars + 2, current.size - 2);
+					return true;
+
+				case XmlTokenType::TagSelfClosingEnd:
+					token.type = XmlTokenType::TagClosing;
+					token.text = this->tagName;
+					return true;
+
+				case XmlTokenType::CDATA:
+					token.text = this->normalizeLineBreaks(current.chars, current.size);
+					return true;
+
+				case XmlTokenType::AttrName:
+				case XmlTokenType::Undefined:
+					token.text = std::string_view(current.chars, current.size);
+					return true;
+
+				case XmlTokenType::AttrValue:
+					token.text = std::string_view(current.chars, current.size);
+					if (current.size >= 2 && (current.chars[0] == '"' || current.chars[0] == '\'') && current.chars[current.size - 1] == current.chars[0])
+					{
+						token.text = token.text.substr(1, current.size - 2);
+					}
+					return true;
+
+				case XmlTokenType::Text:
+					if (this->applySpacePreserve && this->parser.isSpacePreserve())
+					{
+						token.text = this->normalizeLineBreaks(current.chars, current.size);
+						return true;
+					}
+
+					token.text = this->trim(current.chars, current.size);
+					if (!token.text.empty())
+					{
+						return true;
+					}
+					break;
+
+				case XmlTokenType::Comment:
+				{
+					// Braces needed - declaring variables.
+					// The comment delimiters are left out, so that "<!--a-->" and "<!-- a -->" read the same.
+					std::string_view chars(current.chars, current.size);
+					size_t begin = (chars.substr(0, 4) == "<!--" ? 4 : 0);
+					size_t end = (chars.size() >= begin + 3 && chars.substr(chars.size() - 3) == "-->" ? chars.size() - 3 : chars.size());
+					token.text = this->trim(current.chars + begin, end - begin);
+
+					// The formatter turns the space runs of single-line comments into one space.
+					if (chars.substr(begin, end - begin).find_first_of("\r\n") == std::string_view::npos)
+					{
+						this->buffer.erase(std::unique(this->buffer.begin(), this->buffer.end(), [](char a, char b) { return a == ' ' && b == ' '; }), this->buffer.end());
+						token.text = this->buffer;
+					}
+					return true;
+				}
+
+				case XmlTokenType::Instruction:
+					token.text = this->trim(current.chars, current.size);
+					return true;
+
+				case XmlTokenType::DeclarationBeg:
+				case XmlTokenType::DeclarationEnd:
+				case XmlTokenType::DeclarationSelfClosing:
+					token.text = this->collapse(current.chars, current.size);
+					return true;
+
+				case XmlTokenType::TagOpeningEnd:
+				case XmlTokenType::TagClosingEnd:
+				case XmlTokenType::Equal:
+				case XmlTokenType::Whitespace:
+				case XmlTokenType::LineBreak:
+				default:
+					break;
+			}
+		}
+
+		return false;
+	}
+
+	XmlCanonicalDifference XmlCanonicalReader::compare(const char* leftData, size_t leftLength, const char* rightData, size_t rightLength, bool applySpacePreserve)
+	{
+		XmlArenaScope arenaScope;
+		XmlCanonicalReader left(leftData, leftLength, applySpacePreserve);
+		XmlCanonicalReader right(rightData, rightLength, applySpacePreserve);
+		XmlCanonicalToken leftToken;
+		XmlCanonicalToken rightToken;
+		while (true)
+		{
+			// Token texts point into each reader buffer, both stay valid until the next call.
+			if (!left.next(leftToken))
+			{
+				leftToken = { XmlTokenType::EndOfFile, leftLength, std::string_view() };
+			}
+
+			if (!right.next(rightToken))
+			{
+				rightToken = { XmlTokenType::EndOfFile, rightLength, std::string_view() };
+			}
+
+			if (leftToken.type != rightToken.type || leftToken.text != rightToken.text)
+			{
+				return { false, leftToken.pos, rightToken.pos, describeToken(leftToken) + " differs from " + describeToken(rightToken) };
+			}
+
+			if (leftToken.type == XmlTokenType::EndOfFile)
+			{
+				return { true, 0, 0, std::string() };
+			}
+		}
+	}
+
+	uint64_t XmlCanonicalReader::fingerprint(const char* data, size_t length, bool applySpacePreserve)
+	{
+		XmlArenaScope arenaScope;
+		XmlCanonicalReader reader(data, length, applySpacePreserve);
+		XmlHasher hasher(XML_FINGERPRINT_VERSION);
+		XmlCanonicalToken token;
+		while (reader.next(token))
+		{
+			// Every token is framed by its type and length, so that token boundaries are part of the hash.
+			uint64_t header[2] = { static_cast<uint64_t>(token.type), static_cast<uint64_t>(token.text.size()) };
+			hasher.update(reinterpret_cast<const char*>(header), sizeof(header));
+			hasher.update(token.text.data(), token.text.size());
+		}
+		return hasher.digest();
+	}
+}
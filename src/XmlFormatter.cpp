@@ -1,10 +1,14 @@
 #include "XmlFormatter.h"
 
 #include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string_view>
 
 namespace QuickXml
 {
-	static inline void ltrim(std::string& s)
+	template<typename String>
+	static inline void ltrim(String& s)
 	{
 		s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch)
 		{
@@ -12,7 +16,8 @@ namespace QuickXml
 		}));
 	}
 
-	static inline void rtrim(std::string& s)
+	template<typename String>
+	static inline void rtrim(String& s)
 	{
 		s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch)
 		{
@@ -20,13 +25,15 @@ namespace QuickXml
 		}).base(), s.end());
 	}
 
-	static inline void trim(std::string& s)
+	template<typename String>
+	static inline void trim(String& s)
 	{
 		ltrim(s);
 		rtrim(s);
 	}
 
-	static inline void ltrim_s(std::string& s)
+	template<typename String>
+	static inline void ltrim_s(String& s)
 	{
 		s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch)
 		{
@@ -34,7 +41,8 @@ namespace QuickXml
 		}));
 	}
 
-	static inline void rtrim_s(std::string& s)
+	template<typename String>
+	static inline void rtrim_s(String& s)
 	{
 		s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch)
 		{
@@ -42,7 +50,8 @@ namespace QuickXml
 		}).base(), s.end());
 	}
 
-	static inline void trim_s(std::string& s)
+	template<typename String>
+	static inline void trim_s(String& s)
 	{
 		ltrim_s(s);
 		rtrim_s(s);
@@ -54,6 +63,26 @@ namespace QuickXml
 		return text;
 	}
 
+	static inline bool is_name_start(unsigned char ch)
+	{
+		return (XML_CHAR_CLASSES[ch] & CharNameStart);
+	}
+
+	static inline bool is_name_char(unsigned char ch)
+	{
+		return (XML_CHAR_CLASSES[ch] & CharName);
+	}
+
+	// Get the end of the spaces and line breaks of a tag from given position. A lone '\r' is not skipped.
+	static inline size_t tag_space_end(const char* data, size_t pos, size_t end)
+	{
+		while (pos < end && (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\n' || (data[pos] == '\r' && pos + 1 < end && data[pos + 1] == '\n')))
+		{
+			++pos;
+		}
+		return pos;
+	}
+
 	static inline bool ends_with(std::string const& text, std::string const& suffix)
 	{
 		if (text.length() >= suffix.length())
@@ -66,11 +95,11 @@ namespace QuickXml
 		}
 	}
 
-	bool XmlFormatter::isIdentAttribute(std::string attr)
+	bool XmlFormatter::isIdentAttribute(const std::pmr::string& attr)
 	{
+		std::string lw_attr = to_lowercase(std::string(attr));
 		for (std::vector<std::string>::iterator it = this->params.identityAttribues.begin(); it != this->params.identityAttribues.end(); ++it)
 		{
-			std::string lw_attr = to_lowercase(attr);
 			if (!lw_attr.compare(*it) || ends_with(lw_attr, ":" + *it))
 			{
 				return true;
@@ -114,10 +143,22 @@ namespace QuickXml
 		}
 
 		this->parser = new XmlParser(data, length);
+		this->parser->setObserver(this->observer);
+		this->data = data;
+		this->length = length;
 		this->params = params;
 		this->reset();
 	}
 
+	void XmlFormatter::setTokenObserver(XmlTokenObserver* observer)
+	{
+		this->observer = observer;
+		if (this->parser != NULL)
+		{
+			this->parser->setObserver(observer);
+		}
+	}
+
 	void XmlFormatter::reset()
 	{
 		this->indentLevel = 0;
@@ -153,384 +194,844 @@ namespace QuickXml
 	{
 		this->reset();
 		this->parser->reset();
+		this->beginTokens(true, false);
+
+		XmlToken token;
+		while ((token = this->parser->parseNext()).type != XmlTokenType::EndOfFile)
+		{
+			this->linearizeToken(*this->parser, token);
+		}
+
+		return &(this->out);
+	}
+
+	std::stringstream* XmlFormatter::prettyPrint()
+	{
+		// Without tokens to notify, the indent-only mode copies the input instead of rebuilding it token by token.
+		if (this->params.indentOnly && this->observer == NULL && this->indentLines())
+		{
+			return &(this->out);
+		}
 
-		XmlToken token = { XmlTokenType::Undefined }, nexttoken;
-		XmlTokenType lastAppliedTokenType = XmlTokenType::Undefined;
-		bool applyAutoclose = false;
+		this->reset();
+		this->parser->reset();
+		this->beginTokens(false, false);
 
+		XmlToken token;
 		while ((token = this->parser->parseNext()).type != XmlTokenType::EndOfFile)
 		{
-			switch (token.type)
+			this->prettyPrintToken(*this->parser, token);
+		}
+
+		return &(this->out);
+	}
+
+	std::stringstream* XmlFormatter::prettyPrintRange(size_t begin, size_t end, XmlStructureRange& range, const XmlStructureScanState* resume)
+	{
+		this->reset();
+
+		// Only the content before the range is pre-scanned, for the starting depth and xml:space state. Only the range is parsed.
+		range = XmlStructureScanner::lineRange(this->data, this->length, begin, end, resume);
+		// Preserved content is copied as is: its line starts are not indented.
+		this->beginTokens(false, range.begin > 0 && range.spaceSwitches.size() % 2 == 0);
+		this->levelCounter = range.depth;
+		this->updateIndentLevel(0);
+
+		XmlParser rangeParser(this->data + range.begin, range.end - range.begin);
+		rangeParser.setOpenElements(range.depth, range.spaceSwitches);
+		XmlToken token;
+		while ((token = rangeParser.parseNext()).type != XmlTokenType::EndOfFile)
+		{
+			this->prettyPrintToken(rangeParser, token);
+		}
+
+		return &(this->out);
+	}
+
+	void XmlFormatter::copyInput(size_t begin, size_t end)
+	{
+		if (begin != this->copyEnd)
+		{
+			this->flushInput();
+			this->copyBegin = begin;
+		}
+		this->copyEnd = end;
+	}
+
+	void XmlFormatter::flushInput()
+	{
+		if (this->copyEnd > this->copyBegin)
+		{
+			this->out.write(this->data + this->copyBegin, this->copyEnd - this->copyBegin);
+		}
+		this->copyBegin = this->copyEnd;
+	}
+
+	void XmlFormatter::writeIndentation(size_t begin, size_t end, size_t spaces)
+	{
+		// Most lines are already indented: their whitespace is kept in the copy.
+		size_t indentLength = this->params.indentChars.length();
+		bool same = (end - begin == this->indentLevel * indentLength + spaces);
+		for (size_t i = 0; same && i < this->indentLevel; ++i)
+		{
+			same = !memcmp(this->data + begin + i * indentLength, this->params.indentChars.data(), indentLength);
+		}
+		for (size_t i = begin + this->indentLevel * indentLength; same && i < end; ++i)
+		{
+			same = (this->data[i] == ' ');
+		}
+
+		if (same)
+		{
+			this->copyInput(begin, end);
+		}
+		else
+		{
+			this->flushInput();
+			this->writeIndentation();
+			this->writeElement(" ", spaces);
+		}
+	}
+
+	bool XmlFormatter::isCopyableMarkup(const XmlStructureEvent& event) const
+	{
+		const char* markup = this->data + event.begin;
+		size_t size = event.end - event.begin;
+		if (event.type == StructOther)
+		{
+			// Declarations are indented by the parser (internal subsets).
+			if (size >= 5 && !memcmp(markup, "<!--", 4))
 			{
-				case XmlTokenType::LineBreak:
-					break;
+				return !memcmp(markup + size - 3, "-->", 3);
+			}
+			if (size >= 12 && !memcmp(markup, "<![CDATA[", 9))
+			{
+				return !memcmp(markup + size - 3, "]]>", 3);
+			}
+			return (size >= 3 && markup[1] == '?' && markup[size - 2] == '?' && markup[size - 1] == '>');
+		}
 
-				case XmlTokenType::Whitespace:
-					if (this->params.applySpacePreserve && this->parser->isSpacePreserve())
-					{
-						lastAppliedTokenType = XmlTokenType::Whitespace;
-						this->out.write(token.chars, token.size);
-					}
-					else if (token.context.inOpeningTag)
-					{
-						lastAppliedTokenType = XmlTokenType::Whitespace;
-						this->out << " ";
-					}
-					break;
+		// Tags: names, attributes with quoted values and spaces only.
+		size_t pos = event.begin + (event.type == StructElementEnd ? 2 : 1);
+		if (pos >= event.end || !is_name_start(this->data[pos]))
+		{
+			return false;
+		}
+		while (pos < event.end && is_name_char(this->data[pos]))
+		{
+			++pos;
+		}
+		if (event.type == StructElementEnd && pos < event.end && this->data[pos] == '\t')
+		{
+			// A tab does not end a closing tag name.
+			return false;
+		}
 
-				case XmlTokenType::Text:
+		for (;;)
+		{
+			size_t spaceEnd = tag_space_end(this->data, pos, event.end);
+			if (spaceEnd >= event.end)
+			{
+				return false;
+			}
+
+			char c = this->data[spaceEnd];
+			if (c == '>')
+			{
+				return (spaceEnd + 1 == event.end && event.type != StructEmptyElement);
+			}
+			if (c == '/')
+			{
+				return (spaceEnd + 2 == event.end && this->data[spaceEnd + 1] == '>' && event.type == StructEmptyElement);
+			}
+			if (spaceEnd == pos || event.type == StructElementEnd || !is_name_start(c))
+			{
+				return false;
+			}
+
+			pos = spaceEnd;
+			while (pos < event.end && is_name_char(this->data[pos]))
+			{
+				++pos;
+			}
+			if (pos + 1 >= event.end || this->data[pos] != '=' || (this->data[pos + 1] != '"' && this->data[pos + 1] != '\''))
+			{
+				return false;
+			}
+
+			const char* quote = static_cast<const char*>(memchr(this->data + pos + 2, this->data[pos + 1], event.end - pos - 2));
+			if (quote == NULL)
+			{
+				return false;
+			}
+			pos = quote - this->data + 1;
+		}
+	}
+
+	void XmlFormatter::indentText(size_t begin, size_t end, XmlTokenType nextType)
+	{
+		// As a text token: only spaces and tabs around the text are dropped.
+		size_t textBegin = begin;
+		size_t textEnd = end;
+		while (textBegin < textEnd && (this->data[textBegin] == ' ' || this->data[textBegin] == '\t'))
+		{
+			++textBegin;
+		}
+		while (textEnd > textBegin && (this->data[textEnd - 1] == ' ' || this->data[textEnd - 1] == '\t'))
+		{
+			--textEnd;
+		}
+		this->droppedBegin = textEnd;
+		this->droppedEnd = end;
+
+		if (textEnd > textBegin)
+		{
+			this->lastAppliedTokenType = XmlTokenType::Text;
+			this->copyInput(textBegin, textEnd);
+			std::string_view text(this->data + textBegin, textEnd - textBegin);
+			this->lastTextHasLineBreaks = (text.find_first_of("\r\n") != std::string_view::npos);
+		}
+		else if (begin < end && !(nextType & (XmlTokenType::TagOpening | XmlTokenType::Comment | XmlTokenType::DeclarationBeg)) && (nextType != XmlTokenType::TagClosing || this->lastAppliedTokenType == XmlTokenType::TagOpeningEnd))
+		{
+			this->lastAppliedTokenType = XmlTokenType::Text;
+			this->lastTextHasLineBreaks = false;
+		}
+	}
+
+	void XmlFormatter::indentMarkup(const XmlStructureEvent& event)
+	{
+		if (event.type == StructOther)
+		{
+			if (this->data[event.begin + 1] == '!' && this->data[event.begin + 2] == '-')
+			{
+				if (this->lastTextHasLineBreaks)
 				{
-					// Braces needed - declaring variables.
-					if (this->params.applySpacePreserve && this->parser->isSpacePreserve())
-					{
-						// Whitespace only text nodes must be conserved due to xml:space="preserve".
-						lastAppliedTokenType = XmlTokenType::Text;
-						this->out.write(token.chars, token.size);
-					}
-					else
-					{
-						std::string tmp(token.chars, token.size);
-						trim(tmp);
-						if (this->params.ensureConformity)
-						{
-							nexttoken = this->parser->getNextToken();
-							if (tmp.length() > 0 || ((nexttoken.type != XmlTokenType::TagOpening && nexttoken.type != XmlTokenType::Comment && nexttoken.type != XmlTokenType::DeclarationBeg) && (nexttoken.type != XmlTokenType::TagClosing || lastAppliedTokenType == XmlTokenType::TagOpeningEnd)))
-							{
-								lastAppliedTokenType = XmlTokenType::Text;
-								this->out.write(token.chars, token.size);
-							}
-						}
-						else
-						{
-							lastAppliedTokenType = XmlTokenType::Text;
-							this->out << tmp;
-						}
-					}
-					break;
+					this->writeIndentation(this->droppedBegin, this->droppedEnd, 0);
 				}
+				this->lastAppliedTokenType = XmlTokenType::Comment;
+			}
+			else
+			{
+				this->lastAppliedTokenType = (this->data[event.begin + 1] == '!' ? XmlTokenType::CDATA : XmlTokenType::Instruction);
+			}
+			this->copyInput(event.begin, event.end);
+			this->lastTextHasLineBreaks = false;
+			return;
+		}
 
-				case XmlTokenType::TagOpeningEnd:
-					if (this->params.ensureConformity)
-					{
-						nexttoken = this->parser->getNextToken();
-					}
-					else
-					{
-						nexttoken = this->parser->getNextStructureToken();
-					}
+		size_t pos = event.begin + (event.type == StructElementEnd ? 2 : 1);
+		while (is_name_char(this->data[pos]))
+		{
+			++pos;
+		}
 
-					if (this->params.autoCloseTags && nexttoken.type == XmlTokenType::TagClosing)
-					{
-						lastAppliedTokenType = XmlTokenType::TagSelfClosingEnd;
-						this->out << "/>";
-						applyAutoclose = true;
-					}
-					else
-					{
-						lastAppliedTokenType = XmlTokenType::TagOpeningEnd;
-						this->out << ">";
-						applyAutoclose = false;
-					}
-					break;
+		if (event.type == StructElementEnd)
+		{
+			if (!this->applyAutoclose)
+			{
+				this->updateIndentLevel(-1);
+				if (this->lastTextHasLineBreaks)
+				{
+					this->writeIndentation(this->droppedBegin, this->droppedEnd, 0);
+				}
+				this->lastAppliedTokenType = XmlTokenType::TagClosing;
+				this->copyInput(event.begin, pos);
+			}
+		}
+		else
+		{
+			this->currTagNameLength = pos - event.begin;
+			if (this->lastTextHasLineBreaks)
+			{
+				this->writeIndentation(this->droppedBegin, this->droppedEnd, 0);
+			}
+			this->lastAppliedTokenType = XmlTokenType::TagOpening;
+			this->copyInput(event.begin, pos);
+		}
+		this->lastTextHasLineBreaks = false;
 
-				case XmlTokenType::TagClosing:
-					// "</ns:sample".
-					if (!applyAutoclose)
-					{
-						lastAppliedTokenType = XmlTokenType::TagClosing;
-						this->out.write(token.chars, token.size);
-					}
-					break;
+		for (;;)
+		{
+			// Spaces are dropped, line breaks are kept.
+			size_t spaceBegin = pos;
+			size_t lineBegin = pos;
+			while (pos < event.end && (this->data[pos] == ' ' || this->data[pos] == '\t' || this->data[pos] == '\n' || this->data[pos] == '\r'))
+			{
+				if (this->data[pos] == ' ' || this->data[pos] == '\t')
+				{
+					++pos;
+					continue;
+				}
 
-				case XmlTokenType::TagClosingEnd:
-					if (!applyAutoclose)
+				size_t lineBreakEnd = pos + (this->data[pos] == '\r' ? 2 : 1);
+				this->lastAppliedTokenType = XmlTokenType::LineBreak;
+				this->copyInput(pos, lineBreakEnd);
+				this->lastTextHasLineBreaks = true;
+				pos = lineBreakEnd;
+				lineBegin = pos;
+			}
+
+			if (this->data[pos] == '>')
+			{
+				if (event.type == StructElementEnd)
+				{
+					if (!this->applyAutoclose)
 					{
-						lastAppliedTokenType = XmlTokenType::TagClosingEnd;
-						this->out << ">";
+						this->lastAppliedTokenType = XmlTokenType::TagClosingEnd;
+						this->copyInput(pos, pos + 1);
 					}
-					applyAutoclose = false;
-					break;
+				}
+				else
+				{
+					this->numAttr = 0;
+					this->lastAppliedTokenType = XmlTokenType::TagOpeningEnd;
+					this->copyInput(pos, pos + 1);
+					this->updateIndentLevel(1);
+				}
+				break;
+			}
+			if (this->data[pos] == '/')
+			{
+				this->numAttr = 0;
+				this->lastAppliedTokenType = XmlTokenType::TagSelfClosingEnd;
+				this->copyInput(pos, pos + 2);
+				break;
+			}
 
-				case XmlTokenType::TagSelfClosingEnd:
-					lastAppliedTokenType = XmlTokenType::TagSelfClosingEnd;
-					this->out << "/>";
-					applyAutoclose = false;
-					break;
+			// An attribute on a new line is aligned after the tag name.
+			if (this->numAttr > 0 && this->lastTextHasLineBreaks)
+			{
+				this->writeIndentation(lineBegin, pos, this->currTagNameLength + 1);
+			}
+			else if (pos - spaceBegin == 1 && this->data[spaceBegin] == ' ')
+			{
+				this->copyInput(spaceBegin, pos);
+			}
+			else
+			{
+				this->flushInput();
+				this->out << " ";
+			}
+			++this->numAttr;
 
-				case XmlTokenType::TagOpening:
-				case XmlTokenType::AttrName:
-				case XmlTokenType::Comment:
-				case XmlTokenType::CDATA:
-				case XmlTokenType::DeclarationBeg:
-				case XmlTokenType::DeclarationEnd:
-				case XmlTokenType::AttrValue:
-				case XmlTokenType::Instruction:
-				case XmlTokenType::Equal:
-				case XmlTokenType::Undefined:
-				default:
-					lastAppliedTokenType = token.type;
-					this->out.write(token.chars, token.size);
-					break;
+			size_t attrBegin = pos;
+			while (this->data[pos] != '=')
+			{
+				++pos;
 			}
+			const char* quote = static_cast<const char*>(memchr(this->data + pos + 2, this->data[pos + 1], event.end - pos - 2));
+			pos = quote - this->data + 1;
+			this->lastAppliedTokenType = XmlTokenType::AttrValue;
+			this->copyInput(attrBegin, pos);
+			this->lastTextHasLineBreaks = false;
 		}
 
-		return &(this->out);
+		this->applyAutoclose = false;
+		this->lastTextHasLineBreaks = false;
 	}
 
-	std::stringstream* XmlFormatter::prettyPrint()
+	bool XmlFormatter::prettyPrintSpan(size_t begin, size_t end)
 	{
+		this->flushInput();
+
+		// The parser reads on after the span, so that its tokens and their lookahead are the ones of the whole data.
+		XmlParser spanParser(this->data + begin, this->length - begin);
+		XmlToken token;
+		while ((token = spanParser.parseNext()).type != XmlTokenType::EndOfFile)
+		{
+			if (token.pos + token.size > end - begin)
+			{
+				// The parser reads the construct further than the scanner.
+				return false;
+			}
+
+			this->prettyPrintToken(spanParser, token);
+			if (token.pos + token.size == end - begin)
+			{
+				break;
+			}
+		}
+
+		// Markup after the span is copied as read by the scanner, from the parser state of a new document.
+		return (token.type == XmlTokenType::EndOfFile || (token.context.declarationObjects == 0 && !token.context.inOpeningTag && !token.context.inClosingTag && !spanParser.hasPendingAttribute()));
+	}
+
+	bool XmlFormatter::indentLines()
+	{
+		// The xml:space state is only known to the parser.
+		if (this->params.applySpacePreserve && std::string_view(this->data, this->length).find("xml:space") != std::string_view::npos)
+		{
+			return false;
+		}
+
 		this->reset();
-		this->parser->reset();
+		this->beginTokens(false, false);
+		this->copyBegin = 0;
+		this->copyEnd = 0;
+
+		XmlStructureScanner scanner(this->data, this->length);
+		XmlStructureEvent event;
+		XmlStructureEvent next;
+		bool hasNext = scanner.next(next);
+		size_t textBegin = 0;
+		while (hasNext)
+		{
+			event = next;
+			hasNext = scanner.next(next);
+
+			// A start tag directly followed by an end tag may be auto-closed, which needs both.
+			bool copyable = this->isCopyableMarkup(event);
+			bool autoClose = (this->params.autoCloseTags && copyable && event.type == StructElementStart && hasNext && next.type == StructElementEnd && next.begin == event.end);
+			if (copyable && !autoClose)
+			{
+				XmlTokenType nextType = XmlTokenType::Instruction;
+				if (event.type == StructElementEnd)
+				{
+					nextType = XmlTokenType::TagClosing;
+				}
+				else if (event.type != StructOther)
+				{
+					nextType = XmlTokenType::TagOpening;
+				}
+				else if (this->data[event.begin + 1] == '!')
+				{
+					nextType = (this->data[event.begin + 2] == '-' ? XmlTokenType::Comment : XmlTokenType::CDATA);
+				}
+
+				this->indentText(textBegin, event.begin, nextType);
+				this->indentMarkup(event);
+				textBegin = event.end;
+				continue;
+			}
+
+			// The text before and the constructs which cannot be copied go to the parser.
+			while (hasNext && (autoClose || !this->isCopyableMarkup(next)))
+			{
+				event = next;
+				hasNext = scanner.next(next);
+				autoClose = false;
+			}
+			if (!this->prettyPrintSpan(textBegin, event.end))
+			{
+				return false;
+			}
+			textBegin = event.end;
+		}
+
+		this->indentText(textBegin, this->length, XmlTokenType::EndOfFile);
+		this->flushInput();
+		return true;
+	}
+
+	void XmlFormatter::beginTokens(bool linearize, bool atLineStart)
+	{
+		this->linearizing = linearize;
+		this->lastAppliedTokenType = XmlTokenType::Undefined;
+		this->lastTextHasLineBreaks = atLineStart;
+		this->applyAutoclose = false;
+		this->numAttr = 0;
+		this->currTagNameLength = 0;
 
 		// The indentOnly mode forces the indentAttributes.
-		if (this->params.indentOnly)
+		if (!linearize && this->params.indentOnly)
 		{
 			this->params.indentAttributes = true;
 		}
+	}
 
-		XmlToken token = { XmlTokenType::Undefined }, nexttoken;
-		XmlTokenType lastAppliedTokenType = XmlTokenType::Undefined;
-		bool lastTextHasLineBreaks = false;
-		bool applyAutoclose = false;
-		size_t numAttr = 0;
-		size_t currTagNameLength = 0;
+	void XmlFormatter::formatToken(XmlParser& parser, const XmlToken& token)
+	{
+		if (this->linearizing)
+		{
+			this->linearizeToken(parser, token);
+		}
+		else
+		{
+			this->prettyPrintToken(parser, token);
+		}
+	}
 
-		while ((token = this->parser->parseNext()).type != XmlTokenType::EndOfFile)
+	void XmlFormatter::linearizeToken(XmlParser& parser, const XmlToken& token)
+	{
+		XmlToken nexttoken;
+		switch (token.type)
 		{
-			switch (token.type)
+			case XmlTokenType::LineBreak:
+				break;
+
+			case XmlTokenType::Whitespace:
+				if (this->params.applySpacePreserve && parser.isSpacePreserve())
+				{
+					this->lastAppliedTokenType = XmlTokenType::Whitespace;
+					this->out.write(token.chars, token.size);
+				}
+				else if (token.context.inOpeningTag)
+				{
+					this->lastAppliedTokenType = XmlTokenType::Whitespace;
+					this->out << " ";
+				}
+				break;
+
+			case XmlTokenType::Text:
 			{
-				case XmlTokenType::TagOpening:
-					// "<ns:sample".
-					currTagNameLength = token.size;
-					if (this->params.indentOnly)
+				// Braces needed - declaring variables.
+				if (this->params.applySpacePreserve && parser.isSpacePreserve())
+				{
+					// Whitespace only text nodes must be conserved due to xml:space="preserve".
+					this->lastAppliedTokenType = XmlTokenType::Text;
+					this->out.write(token.chars, token.size);
+				}
+				else
+				{
+					std::pmr::string tmp(token.chars, token.size, XmlArena::resource());
+					trim(tmp);
+					if (this->params.ensureConformity)
 					{
-						if (lastTextHasLineBreaks)
+						nexttoken = parser.getNextToken();
+						if (tmp.length() > 0 || ((nexttoken.type != XmlTokenType::TagOpening && nexttoken.type != XmlTokenType::Comment && nexttoken.type != XmlTokenType::DeclarationBeg) && (nexttoken.type != XmlTokenType::TagClosing || this->lastAppliedTokenType == XmlTokenType::TagOpeningEnd)))
 						{
-							this->writeIndentation();
+							this->lastAppliedTokenType = XmlTokenType::Text;
+							this->out.write(token.chars, token.size);
 						}
 					}
-					else if (!(lastAppliedTokenType & (XmlTokenType::Text | XmlTokenType::CDATA | XmlTokenType::Undefined)))
+					else
 					{
-						this->writeEOL();
-						this->writeIndentation();
+						this->lastAppliedTokenType = XmlTokenType::Text;
+						this->out.write(tmp.data(), tmp.length());
 					}
-					lastAppliedTokenType = XmlTokenType::TagOpening;
+				}
+				break;
+			}
+
+			case XmlTokenType::TagOpeningEnd:
+				if (this->params.ensureConformity)
+				{
+					nexttoken = parser.getNextToken();
+				}
+				else
+				{
+					nexttoken = parser.getNextStructureToken();
+				}
+
+				if (this->params.autoCloseTags && nexttoken.type == XmlTokenType::TagClosing)
+				{
+					this->lastAppliedTokenType = XmlTokenType::TagSelfClosingEnd;
+					this->out << "/>";
+					this->applyAutoclose = true;
+				}
+				else
+				{
+					this->lastAppliedTokenType = XmlTokenType::TagOpeningEnd;
+					this->out << ">";
+					this->applyAutoclose = false;
+				}
+				break;
+
+			case XmlTokenType::TagClosing:
+				// "</ns:sample".
+				if (!this->applyAutoclose)
+				{
+					this->lastAppliedTokenType = XmlTokenType::TagClosing;
 					this->out.write(token.chars, token.size);
-					lastTextHasLineBreaks = false;
-					break;
+				}
+				break;
 
-				case XmlTokenType::TagOpeningEnd:
-					numAttr = 0;
-					nexttoken = this->parser->getNextToken();
-					if (this->params.autoCloseTags && nexttoken.type == XmlTokenType::TagClosing)
-					{
-						lastAppliedTokenType = XmlTokenType::TagSelfClosingEnd;
-						this->out << "/>";
-						applyAutoclose = true;
-					}
-					else
-					{
-						lastAppliedTokenType = XmlTokenType::TagOpeningEnd;
-						this->out << ">";
-						this->updateIndentLevel(1);
-						applyAutoclose = false;
-					}
-					lastTextHasLineBreaks = false;
-					break;
+			case XmlTokenType::TagClosingEnd:
+				if (!this->applyAutoclose)
+				{
+					this->lastAppliedTokenType = XmlTokenType::TagClosingEnd;
+					this->out << ">";
+				}
+				this->applyAutoclose = false;
+				break;
 
-				case XmlTokenType::TagClosing:
-					// "</ns:sample".
-					if (!applyAutoclose)
-					{
-						this->updateIndentLevel(-1);
-						if (this->params.indentOnly)
-						{
-							if (lastTextHasLineBreaks)
-							{
-								this->writeIndentation();
-							}
-						}
-						else if (!(lastAppliedTokenType & (XmlTokenType::Text | XmlTokenType::CDATA | XmlTokenType::TagOpeningEnd | XmlTokenType::Undefined)))
-						{
-							this->writeEOL();
-							this->writeIndentation();
-						}
-						lastAppliedTokenType = XmlTokenType::TagClosing;
-						this->out.write(token.chars, token.size);
-					}
-					lastTextHasLineBreaks = false;
-					break;
+			case XmlTokenType::TagSelfClosingEnd:
+				this->lastAppliedTokenType = XmlTokenType::TagSelfClosingEnd;
+				this->out << "/>";
+				this->applyAutoclose = false;
+				break;
 
-				case XmlTokenType::TagClosingEnd:
-					if (!applyAutoclose)
+			case XmlTokenType::TagOpening:
+			case XmlTokenType::AttrName:
+			case XmlTokenType::Comment:
+			case XmlTokenType::CDATA:
+			case XmlTokenType::DeclarationBeg:
+			case XmlTokenType::DeclarationEnd:
+			case XmlTokenType::AttrValue:
+			case XmlTokenType::Instruction:
+			case XmlTokenType::Equal:
+			case XmlTokenType::Undefined:
+			default:
+				this->lastAppliedTokenType = token.type;
+				this->out.write(token.chars, token.size);
+				break;
+		}
+	}
+
+	void XmlFormatter::prettyPrintToken(XmlParser& parser, const XmlToken& token)
+	{
+		XmlToken nexttoken;
+		switch (token.type)
+		{
+			case XmlTokenType::TagOpening:
+				// "<ns:sample".
+				this->currTagNameLength = token.size;
+				if (this->params.indentOnly)
+				{
+					if (this->lastTextHasLineBreaks)
 					{
-						lastAppliedTokenType = XmlTokenType::TagClosingEnd;
-						this->out << ">";
+						this->writeIndentation();
 					}
-					applyAutoclose = false;
-					lastTextHasLineBreaks = false;
-					break;
+				}
+				else if (!(this->lastAppliedTokenType & (XmlTokenType::Text | XmlTokenType::CDATA | XmlTokenType::Undefined)))
+				{
+					this->writeEOL();
+					this->writeIndentation();
+				}
+				this->lastAppliedTokenType = XmlTokenType::TagOpening;
+				this->out.write(token.chars, token.size);
+				this->lastTextHasLineBreaks = false;
+				break;
 
-				case XmlTokenType::TagSelfClosingEnd:
-					numAttr = 0;
-					lastAppliedTokenType = XmlTokenType::TagSelfClosingEnd;
+			case XmlTokenType::TagOpeningEnd:
+				this->numAttr = 0;
+				nexttoken = parser.getNextToken();
+				if (this->params.autoCloseTags && nexttoken.type == XmlTokenType::TagClosing)
+				{
+					this->lastAppliedTokenType = XmlTokenType::TagSelfClosingEnd;
 					this->out << "/>";
-					applyAutoclose = false;
-					lastTextHasLineBreaks = false;
-					break;
+					this->applyAutoclose = true;
+				}
+				else
+				{
+					this->lastAppliedTokenType = XmlTokenType::TagOpeningEnd;
+					this->out << ">";
+					this->updateIndentLevel(1);
+					this->applyAutoclose = false;
+				}
+				this->lastTextHasLineBreaks = false;
+				break;
 
-				case XmlTokenType::AttrName:
-					if (this->params.indentAttributes && numAttr > 0)
+			case XmlTokenType::TagClosing:
+				// "</ns:sample".
+				if (!this->applyAutoclose)
+				{
+					this->updateIndentLevel(-1);
+					if (this->params.indentOnly)
 					{
-						if (!this->params.indentOnly)
-						{
-							this->writeEOL();
-						}
-						if (!this->params.indentOnly || lastTextHasLineBreaks)
+						if (this->lastTextHasLineBreaks)
 						{
 							this->writeIndentation();
-							this->writeElement(" ", currTagNameLength);
 						}
 					}
-					++numAttr;
-					this->out << " ";
-					lastAppliedTokenType = XmlTokenType::AttrName;
-					this->out.write(token.chars, token.size);
-					lastTextHasLineBreaks = false;
-					break;
-
-				case XmlTokenType::Text:
-				{
-					// Braces needed - declaring variables.
-					if (this->params.applySpacePreserve && this->parser->isSpacePreserve())
+					else if (!(this->lastAppliedTokenType & (XmlTokenType::Text | XmlTokenType::CDATA | XmlTokenType::TagOpeningEnd | XmlTokenType::Undefined)))
 					{
-						lastAppliedTokenType = XmlTokenType::Text;
-						this->out.write(token.chars, token.size);
+						this->writeEOL();
+						this->writeIndentation();
 					}
-					else
-					{
-						// Check if text could be ignored.
-						XmlToken nexttoken = this->parser->getNextToken();
-						std::string tmp(token.chars, token.size);
-						if (this->params.indentOnly)
-						{
-							trim_s(tmp);
-						}
-						else
-						{
-							trim(tmp);
-						}
+					this->lastAppliedTokenType = XmlTokenType::TagClosing;
+					this->out.write(token.chars, token.size);
+				}
+				this->lastTextHasLineBreaks = false;
+				break;
 
-						if (tmp.length() > 0 || ((!(nexttoken.type & (XmlTokenType::TagOpening | XmlTokenType::Comment | XmlTokenType::DeclarationBeg))) && (nexttoken.type != XmlTokenType::TagClosing || lastAppliedTokenType == XmlTokenType::TagOpeningEnd)))
-						{
-							lastAppliedTokenType = XmlTokenType::Text;
-							if (this->params.indentOnly)
-							{
-								this->out << tmp;
-								lastTextHasLineBreaks = (tmp.find_first_of("\r\n") != std::string::npos);
-							}
-							else
-							{
-								this->out.write(token.chars, token.size);
-							}
-						}
-					}
-					break;
+			case XmlTokenType::TagClosingEnd:
+				if (!this->applyAutoclose)
+				{
+					this->lastAppliedTokenType = XmlTokenType::TagClosingEnd;
+					this->out << ">";
 				}
+				this->applyAutoclose = false;
+				this->lastTextHasLineBreaks = false;
+				break;
 
-				case XmlTokenType::LineBreak:
-					if (this->params.applySpacePreserve && this->parser->isSpacePreserve())
+			case XmlTokenType::TagSelfClosingEnd:
+				this->numAttr = 0;
+				this->lastAppliedTokenType = XmlTokenType::TagSelfClosingEnd;
+				this->out << "/>";
+				this->applyAutoclose = false;
+				this->lastTextHasLineBreaks = false;
+				break;
+
+			case XmlTokenType::AttrName:
+				if (this->params.indentAttributes && this->numAttr > 0)
+				{
+					if (!this->params.indentOnly)
 					{
-						lastAppliedTokenType = XmlTokenType::LineBreak;
-						this->out.write(token.chars, token.size);
+						this->writeEOL();
 					}
-					else if (this->params.indentOnly)
+					if (!this->params.indentOnly || this->lastTextHasLineBreaks)
 					{
-						lastAppliedTokenType = XmlTokenType::LineBreak;
-						this->out.write(token.chars, token.size);
-						lastTextHasLineBreaks = true;
+						this->writeIndentation();
+						this->writeElement(" ", this->currTagNameLength);
 					}
-					break;
+				}
+				++this->numAttr;
+				this->out << " ";
+				this->lastAppliedTokenType = XmlTokenType::AttrName;
+				this->out.write(token.chars, token.size);
+				this->lastTextHasLineBreaks = false;
+				break;
 
-				case XmlTokenType::DeclarationBeg:
-				case XmlTokenType::DeclarationSelfClosing:
-					// "<!...[".
+			case XmlTokenType::Text:
+			{
+				// Braces needed - declaring variables.
+				if (this->params.applySpacePreserve && parser.isSpacePreserve())
+				{
+					this->lastAppliedTokenType = XmlTokenType::Text;
+					this->out.write(token.chars, token.size);
+				}
+				else
+				{
+					// Check if text could be ignored.
+					XmlToken nexttoken = parser.getNextToken();
+					std::pmr::string tmp(token.chars, token.size, XmlArena::resource());
 					if (this->params.indentOnly)
 					{
-						if (lastTextHasLineBreaks)
-						{
-							this->writeIndentation();
-						}
-					}
-					else if (!(lastAppliedTokenType & (XmlTokenType::Text | XmlTokenType::CDATA | XmlTokenType::Undefined)))
-					{
-						this->writeEOL();
-						this->writeIndentation();
+						trim_s(tmp);
 					}
-					lastAppliedTokenType = token.type;
-					this->out.write(token.chars, token.size);
-					if (token.type == XmlTokenType::DeclarationBeg)
+					else
 					{
-						this->updateIndentLevel(1);
+						trim(tmp);
 					}
-					break;
 
-				case XmlTokenType::DeclarationEnd:
-					// > or ]>.
-					this->updateIndentLevel(-1);
-					if (token.chars[0] == ']')
+					if (tmp.length() > 0 || ((!(nexttoken.type & (XmlTokenType::TagOpening | XmlTokenType::Comment | XmlTokenType::DeclarationBeg))) && (nexttoken.type != XmlTokenType::TagClosing || this->lastAppliedTokenType == XmlTokenType::TagOpeningEnd)))
 					{
-						if (!this->params.indentOnly)
+						this->lastAppliedTokenType = XmlTokenType::Text;
+						if (this->params.indentOnly)
 						{
-							this->writeEOL();
+							this->out.write(tmp.data(), tmp.length());
+							this->lastTextHasLineBreaks = (tmp.find_first_of("\r\n") != std::pmr::string::npos);
+						}
+						else
+						{
+							this->out.write(token.chars, token.size);
 						}
-						this->writeIndentation();
 					}
-					lastAppliedTokenType = XmlTokenType::DeclarationEnd;
+				}
+				break;
+			}
+
+			case XmlTokenType::LineBreak:
+				if (this->params.applySpacePreserve && parser.isSpacePreserve())
+				{
+					this->lastAppliedTokenType = XmlTokenType::LineBreak;
 					this->out.write(token.chars, token.size);
-					break;
+				}
+				else if (this->params.indentOnly)
+				{
+					this->lastAppliedTokenType = XmlTokenType::LineBreak;
+					this->out.write(token.chars, token.size);
+					this->lastTextHasLineBreaks = true;
+				}
+				break;
 
-				case XmlTokenType::Comment:
-					if (this->params.indentOnly)
+			case XmlTokenType::DeclarationBeg:
+			case XmlTokenType::DeclarationSelfClosing:
+				// "<!...[".
+				if (this->params.indentOnly)
+				{
+					if (this->lastTextHasLineBreaks)
 					{
-						if (lastTextHasLineBreaks)
-						{
-							this->writeIndentation();
-						}
+						this->writeIndentation();
 					}
-					else if (!(lastAppliedTokenType & (XmlTokenType::Text | XmlTokenType::CDATA | XmlTokenType::Undefined)))
+				}
+				else if (!(this->lastAppliedTokenType & (XmlTokenType::Text | XmlTokenType::CDATA | XmlTokenType::Undefined)))
+				{
+					this->writeEOL();
+					this->writeIndentation();
+				}
+				this->lastAppliedTokenType = token.type;
+				this->out.write(token.chars, token.size);
+				if (token.type == XmlTokenType::DeclarationBeg)
+				{
+					this->updateIndentLevel(1);
+				}
+				break;
+
+			case XmlTokenType::DeclarationEnd:
+				// > or ]>.
+				this->updateIndentLevel(-1);
+				if (token.chars[0] == ']')
+				{
+					if (!this->params.indentOnly)
 					{
 						this->writeEOL();
-						this->writeIndentation();
 					}
-					lastAppliedTokenType = XmlTokenType::Comment;
-					this->out.write(token.chars, token.size);
-					lastTextHasLineBreaks = false;
-					break;
+					this->writeIndentation();
+				}
+				this->lastAppliedTokenType = XmlTokenType::DeclarationEnd;
+				this->out.write(token.chars, token.size);
+				break;
 
-				case XmlTokenType::Whitespace:
-					if (this->params.applySpacePreserve && this->parser->isSpacePreserve())
+			case XmlTokenType::Comment:
+				if (this->params.indentOnly)
+				{
+					if (this->lastTextHasLineBreaks)
 					{
-						lastAppliedTokenType = XmlTokenType::Whitespace;
-						this->out.write(token.chars, token.size);
+						this->writeIndentation();
 					}
-					break;
+				}
+				else if (!(this->lastAppliedTokenType & (XmlTokenType::Text | XmlTokenType::CDATA | XmlTokenType::Undefined)))
+				{
+					this->writeEOL();
+					this->writeIndentation();
+				}
+				this->lastAppliedTokenType = XmlTokenType::Comment;
+				this->out.write(token.chars, token.size);
+				this->lastTextHasLineBreaks = false;
+				break;
 
-				case XmlTokenType::CDATA:
-				case XmlTokenType::AttrValue:
-				case XmlTokenType::Instruction:
-				case XmlTokenType::Equal:
-				case XmlTokenType::EndOfFile:
-				case XmlTokenType::Undefined:
-				default:
-					lastAppliedTokenType = token.type;
+			case XmlTokenType::Whitespace:
+				if (this->params.applySpacePreserve && parser.isSpacePreserve())
+				{
+					this->lastAppliedTokenType = XmlTokenType::Whitespace;
 					this->out.write(token.chars, token.size);
-					lastTextHasLineBreaks = false;
-					break;
+				}
+				break;
+
+			case XmlTokenType::CDATA:
+			case XmlTokenType::AttrValue:
+			case XmlTokenType::Instruction:
+			case XmlTokenType::Equal:
+			case XmlTokenType::EndOfFile:
+			case XmlTokenType::Undefined:
+			default:
+				this->lastAppliedTokenType = token.type;
+				this->out.write(token.chars, token.size);
+				this->lastTextHasLineBreaks = false;
+				break;
+		}
+	}
+
+	std::vector<std::string> XmlFormatter::formatVariants(const char* data, size_t length, const std::vector<XmlFormatterVariant>& variants, XmlTokenObserver* observer)
+	{
+		std::vector<std::unique_ptr<XmlFormatter>> formatters;
+		for (const XmlFormatterVariant& variant : variants)
+		{
+			formatters.push_back(std::make_unique<XmlFormatter>(data, length, variant.params));
+			formatters.back()->beginTokens(variant.linearize, false);
+		}
+
+		// One parser for all: every formatter sees each token with the parser positioned on it, as if it had parsed the data itself.
+		XmlParser parser(data, length);
+		parser.setObserver(observer);
+		XmlToken token;
+		while ((token = parser.parseNext()).type != XmlTokenType::EndOfFile)
+		{
+			for (const std::unique_ptr<XmlFormatter>& formatter : formatters)
+			{
+				formatter->formatToken(parser, token);
 			}
 		}
 
-		return &(this->out);
+		std::vector<std::string> res;
+		for (const std::unique_ptr<XmlFormatter>& formatter : formatters)
+		{
+			res.push_back(formatter->out.str());
+			formatter->out.str(std::string());
+		}
+		return res;
 	}
 
 	std::stringstream* XmlFormatter::currentPath(size_t position, int xpathMode)
@@ -545,11 +1046,11 @@ namespace QuickXml
 		}
 
 		XmlToken token = undefinedToken;
-		std::vector<XmlFormatterXPathEntry> vPath;
+		std::pmr::vector<XmlFormatterXPathEntry> vPath(XmlArena::resource());
 		bool keep_attr_value = false;
 
 		// Count elements of every depth layer in a map.
-		std::vector<std::map<std::string, size_t>> depthElementMap;
+		std::pmr::vector<std::pmr::map<std::pmr::string, size_t>> depthElementMap(XmlArena::resource());
 
 		while ((token = this->parser->parseNext()).type != XmlTokenType::EndOfFile)
 		{
@@ -564,16 +1065,18 @@ namespace QuickXml
 				case XmlTokenType::TagOpening:
 				{
 					// Braces needed - declaring variables.
-					std::string nodename = std::string(token.chars + 1, token.size - 1);
-					XmlFormatterXPathEntry pathElement;
+					std::pmr::string nodename(token.chars + 1, token.size - 1, XmlArena::resource());
+
+					// Entries are built in place so that their strings stay in the arena.
+					vPath.emplace_back();
+					XmlFormatterXPathEntry& pathElement = vPath.back();
 					pathElement.name = nodename;
 					pathElement.position = 0;
 
 					if ((xpathMode & XPATH_MODE_WITHNODEINDEX) != 0)
 					{
-						std::map<std::string, size_t> depthMap;
 						// Push a new map for the new layer onto the depthElementMap.
-						depthElementMap.push_back(depthMap);
+						depthElementMap.emplace_back();
 						size_t dem = depthElementMap.size();
 
 						if (dem > 1)
@@ -583,7 +1086,6 @@ namespace QuickXml
 						}
 					}
 
-					vPath.push_back(pathElement);
 					keep_attr_value = false;
 					break;
 				}
@@ -612,13 +1114,13 @@ namespace QuickXml
 				case XmlTokenType::AttrName:
 				{
 					// Braces needed - declaring variables.
-					std::string attr(token.chars, token.size);
+					std::pmr::string& attr = vPath.back().attr;
+					attr.assign(token.chars, token.size);
 					if ((xpathMode & XPATH_MODE_KEEPIDATTRIBUTE) != 0 && isIdentAttribute(attr))
 					{
 						// We must check if attribute is "id"; if true, we must rewrite the tag name and add the value of @id attribute.
 						keep_attr_value = true;
 					}
-					vPath.back().attr = attr;
 					break;
 				}
 
@@ -627,11 +1129,11 @@ namespace QuickXml
 					{
 						if (this->params.dumpIdAttributesName)
 						{
-							vPath.back().attributes.push_back({ vPath.back().attr, std::string(token.chars, token.size) });
+							vPath.back().attributes.push_back({ std::string(vPath.back().attr), std::string(token.chars, token.size) });
 						}
 						else
 						{
-							vPath.back().attributes.push_back({ vPath.back().attr, std::string(token.chars + 1, token.size - 2) });
+							vPath.back().attributes.push_back({ std::string(vPath.back().attr), std::string(token.chars + 1, token.size - 2) });
 						}
 					}
 					keep_attr_value = false;
@@ -667,8 +1169,8 @@ namespace QuickXml
 		for (size_t i = 0; i < size; ++i)
 		{
 			this->out << "/";
-			XmlFormatterXPathEntry tmp = vPath.at(i);
-			std::string::size_type p = tmp.name.find(':');
+			const XmlFormatterXPathEntry& tmp = vPath.at(i);
+			std::pmr::string::size_type p = tmp.name.find(':');
 
 			if ((xpathMode & XPATH_MODE_WITHNAMESPACE) == 0 && p != std::string::npos)
 			{
@@ -743,6 +1245,11 @@ namespace QuickXml
 		return &(this->out);
 	}
 
+	std::stringstream* XmlFormatter::currentPath(const XmlLineIndex& lines, const XmlLinePosition& position, int xpathMode)
+	{
+		return this->currentPath(lines.offsetOf(position), xpathMode);
+	}
+
 	void XmlFormatter::writeEOL()
 	{
 		this->out << this->params.eolChars;
@@ -0,0 +1,177 @@
+#include "XmlHash.h"
+
+#include <cstring>
+
+namespace QuickXml
+{
+	static const uint64_t PRIME64_1 = 0x9E37'79B1'85EB'CA87ULL;
+	static const uint64_t PRIME64_2 = 0xC2B2'AE3D'27D4'EB4FULL;
+	static const uint64_t PRIME64_3 = 0x1656'67B1'9E37'79F9ULL;
+	static const uint64_t PRIME64_4 = 0x85EB'CA77'C2B2'AE63ULL;
+	static const uint64_t PRIME64_5 = 0x27D4'EB2F'1656'67C5ULL;
+
+	static inline uint64_t rotl64(uint64_t value, int bits)
+	{
+		return (value << bits) | (value >> (64 - bits));
+	}
+
+	static inline uint64_t read64(const unsigned char* p)
+	{
+		uint64_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	static inline uint32_t read32(const unsigned char* p)
+	{
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	static inline uint64_t round64(uint64_t acc, uint64_t input)
+	{
+		acc += input * PRIME64_2;
+		acc = rotl64(acc, 31);
+		return acc * PRIME64_1;
+	}
+
+	static inline uint64_t mergeRound64(uint64_t acc, uint64_t value)
+	{
+		acc ^= round64(0, value);
+		return acc * PRIME64_1 + PRIME64_4;
+	}
+
+	XmlHasher::XmlHasher(uint64_t seed)
+	{
+		this->reset(seed);
+	}
+
+	void XmlHasher::reset(uint64_t seed)
+	{
+		this->seed = seed;
+		this->acc[0] = seed + PRIME64_1 + PRIME64_2;
+		this->acc[1] = seed + PRIME64_2;
+		this->acc[2] = seed;
+		this->acc[3] = seed - PRIME64_1;
+		this->pendingSize = 0;
+		this->totalLength = 0;
+	}
+
+	void XmlHasher::consumeStripe(const unsigned char* stripe)
+	{
+		this->acc[0] = round64(this->acc[0], read64(stripe));
+		this->acc[1] = round64(this->acc[1], read64(stripe + 8));
+		this->acc[2] = round64(this->acc[2], read64(stripe + 16));
+		this->acc[3] = round64(this->acc[3], read64(stripe + 24));
+	}
+
+	void XmlHasher::update(const char* data, size_t length)
+	{
+		const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+		const unsigned char* end = p + length;
+		this->totalLength += length;
+
+		// Complete the pending stripe first.
+		if (this->pendingSize > 0)
+		{
+			size_t missing = 32 - this->pendingSize;
+			if (length < missing)
+			{
+				memcpy(this->pending + this->pendingSize, p, length);
+				this->pendingSize += length;
+				return;
+			}
+			memcpy(this->pending + this->pendingSize, p, missing);
+			this->consumeStripe(this->pending);
+			this->pendingSize = 0;
+			p += missing;
+		}
+
+		while (end - p >= 32)
+		{
+			this->consumeStripe(p);
+			p += 32;
+		}
+
+		if (p < end)
+		{
+			memcpy(this->pending, p, end - p);
+			this->pendingSize = end - p;
+		}
+	}
+
+	void XmlHasher::update(const std::string& str)
+	{
+		this->update(str.data(), str.length());
+	}
+
+	uint64_t XmlHasher::digest() const
+	{
+		uint64_t h;
+		if (this->totalLength >= 32)
+		{
+			h = rotl64(this->acc[0], 1) + rotl64(this->acc[1], 7) + rotl64(this->acc[2], 12) + rotl64(this->acc[3], 18);
+			h = mergeRound64(h, this->acc[0]);
+			h = mergeRound64(h, this->acc[1]);
+			h = mergeRound64(h, this->acc[2]);
+			h = mergeRound64(h, this->acc[3]);
+		}
+		else
+		{
+			h = this->seed + PRIME64_5;
+		}
+		h += this->totalLength;
+
+		// Process the tail which didn't fill a complete stripe.
+		const unsigned char* p = this->pending;
+		const unsigned char* end = this->pending + this->pendingSize;
+		while (end - p >= 8)
+		{
+			h ^= round64(0, read64(p));
+			h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+			p += 8;
+		}
+
+		if (end - p >= 4)
+		{
+			h ^= static_cast<uint64_t>(read32(p)) * PRIME64_1;
+			h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+			p += 4;
+		}
+
+		while (p < end)
+		{
+			h ^= (*p) * PRIME64_5;
+			h = rotl64(h, 11) * PRIME64_1;
+			++p;
+		}
+
+		// Final avalanche.
+		h ^= h >> 33;
+		h *= PRIME64_2;
+		h ^= h >> 29;
+		h *= PRIME64_3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	uint64_t XmlHasher::hash(const char* data, size_t length, uint64_t seed)
+	{
+		XmlHasher hasher(seed);
+		hasher.update(data, length);
+		return hasher.digest();
+	}
+
+	std::string XmlHasher::toHex(uint64_t value)
+	{
+		static const char digits[] = "0123456789abcdef";
+		std::string res(16, '0');
+		for (int i = 15; i >= 0; --i)
+		{
+			res[i] = digits[value & 0xF];
+			value >>= 4;
+		}
+		return res;
+	}
+}
@@ -1,14 +1,20 @@
 #include "XmlIndenter.h"
 
+#include <memory_resource>
+#include <string_view>
+
+#include "XmlArena.h"
 #include "XmlFormatter.h"
+#include "XmlPerfCounters.h"
+#include "XmlTrace.h"
 
 // Constructor with default settings.
-XmlIndenter::XmlIndenter(const std::string& xmlContent) : xmlContent(xmlContent), indentStr("\t"), eolStr("\n"), indentOnly(true), autoCloseEmptyElements(true)
+XmlIndenter::XmlIndenter(const std::string& xmlContent) : xmlContent(xmlContent), indentStr("\t"), eolStr("\n"), indentOnly(true), autoCloseEmptyElements(true), validator(NULL)
 {
 }
 
 // Constructor with custom settings.
-XmlIndenter::XmlIndenter(const std::string& xmlContent, const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements) : xmlContent(xmlContent), indentStr(indentStr), eolStr(eolStr), indentOnly(indentOnly), autoCloseEmptyElements(autoCloseEmptyElements)
+XmlIndenter::XmlIndenter(const std::string& xmlContent, const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements) : xmlContent(xmlContent), indentStr(indentStr), eolStr(eolStr), indentOnly(indentOnly), autoCloseEmptyElements(autoCloseEmptyElements), validator(NULL)
 {
 }
 
@@ -18,52 +24,46 @@ XmlIndenter::~XmlIndenter()
 }
 
 // Helper function to replace all occurrences of a string with another string.
+// The result is built in one pass, replacing in place would move the rest of the string for every occurrence.
 std::string replaceAll(const std::string& source, const std::string& from, const std::string& to)
 {
-	std::string result = source;
+	std::string result;
+	result.reserve(source.length());
 	size_t pos = 0;
-	while ((pos = result.find(from, pos)) != std::string::npos)
+	size_t found;
+	while ((found = source.find(from, pos)) != std::string::npos)
 	{
-		result.replace(pos, from.length(), to);
-		pos += to.length();
+		result.append(source, pos, found - pos).append(to);
+		pos = found + from.length();
 	}
+	result.append(source, pos, std::string::npos);
 	return result;
 }
 
 // Ensure all line endings are Windows-style (\r\n).
 std::string normalizeLineEndings(const std::string& content)
 {
-	// This implementation more closely mirrors the C# Regex.Replace approach.
-	std::string result = content;
+	// Mac line endings (\r) and Unix line endings (\n) become Windows line endings (\r\n), in a single pass.
+	std::string finalResult;
+	finalResult.reserve(content.length() + content.length() / 10); // Estimate for potential added \r characters.
 
-	// Replace Mac line endings (\r) not followed by \n with Windows line endings (\r\n).
-	size_t pos = 0;
-	while ((pos = result.find('\r', pos)) != std::string::npos)
+	for (size_t i = 0; i < content.length(); i++)
 	{
-		if (pos + 1 >= result.length() || result[pos + 1] != '\n')
+		if (content[i] == '\r')
 		{
-			result.replace(pos, 1, "\r\n");
-			pos += 2;
+			finalResult.append("\r\n");
+			if (i + 1 < content.length() && content[i + 1] == '\n')
+			{
+				i++;
+			}
 		}
-		else
-		{
-			pos++;
-		}
-	}
-
-	// Ensure all line endings are Windows format (\r\n).
-	std::string finalResult;
-	finalResult.reserve(result.length() + result.length() / 10); // Estimate for potential added \r characters.
-
-	for (size_t i = 0; i < result.length(); i++)
-	{
-		if (result[i] == '\n' && (i == 0 || result[i - 1] != '\r'))
+		else if (content[i] == '\n')
 		{
 			finalResult.append("\r\n");
 		}
 		else
 		{
-			finalResult.push_back(result[i]);
+			finalResult.push_back(content[i]);
 		}
 	}
 
@@ -71,52 +71,47 @@ std::string normalizeLineEndings(const std::string& content)
 }
 
 // Formats single-line XML comments to ensure consistent spacing. Adds one space after <!-- and one space before --> for better readability. Normalizes multiple consecutive spaces within comment text to a single space. Only affects single-line comments; multi-line comments remain unchanged.
+// The result is built in one pass over the input: every char is looked at a bounded number of times.
 std::string formatSingleLineComments(const std::string& xml)
 {
-	std::string result = xml;
+	std::string result;
+	result.reserve(xml.length());
+	size_t copied = 0;
 	size_t pos = 0;
 
-	while ((pos = result.find("<!--", pos)) != std::string::npos)
+	while ((pos = xml.find("<!--", pos)) != std::string::npos)
 	{
-		// Find the end of this comment.
-		size_t endPos = result.find("-->", pos);
+		// Find the end of this comment. Without one, no later comment has an end either.
+		size_t endPos = xml.find("-->", pos);
 		if (endPos == std::string::npos)
 		{
-			// No end tag found, move past this one.
-			pos += 4;
-			continue;
+			break;
 		}
 
-		// Check if this is a single-line comment (no newlines between start and end).
-		std::string commentText = result.substr(pos, endPos - pos + 3);
-		if (commentText.find('\n') == std::string::npos && commentText.find('\r') == std::string::npos)
+		// Check if this is a single-line comment (no newlines between start and end). Comments like "<!-->" are left as is.
+		std::string_view commentText(xml.data() + pos, endPos - pos + 3);
+		if (endPos >= pos + 4 && commentText.find('\n') == std::string_view::npos && commentText.find('\r') == std::string_view::npos)
 		{
 			// Extract the comment content (between <!-- and -->).
-			std::string commentContent = result.substr(pos + 4, endPos - (pos + 4));
+			std::pmr::string commentContent(xml.data() + pos + 4, endPos - (pos + 4), QuickXml::XmlArena::resource());
 
 			// Trim leading and trailing spaces.
 			size_t startTrim = commentContent.find_first_not_of(' ');
 			size_t endTrim = commentContent.find_last_not_of(' ');
 
-			if (startTrim != std::string::npos && endTrim != std::string::npos)
+			if (startTrim != std::pmr::string::npos && endTrim != std::pmr::string::npos)
 			{
-				commentContent = commentContent.substr(startTrim, endTrim - startTrim + 1);
-			}
-			else if (startTrim != std::string::npos)
-			{
-				commentContent = commentContent.substr(startTrim);
-			}
-			else if (endTrim != std::string::npos)
-			{
-				commentContent = commentContent.substr(0, endTrim + 1);
+				// Trim in place, substr() would allocate its result outside the arena.
+				commentContent.erase(endTrim + 1);
+				commentContent.erase(0, startTrim);
 			}
 			else
 			{
-				commentContent = ""; // Comment was all spaces.
+				commentContent.clear(); // Comment was all spaces.
 			}
 
 			// Normalize multiple spaces to single space within the comment content.
-			std::string normalizedContent;
+			std::pmr::string normalizedContent(QuickXml::XmlArena::resource());
 			normalizedContent.reserve(commentContent.length());
 			bool lastWasSpace = false;
 
@@ -138,7 +133,7 @@ std::string formatSingleLineComments(const std::string& xml)
 			}
 
 			// Replace the original comment with the normalized one.
-			std::string newComment;
+			std::pmr::string newComment(QuickXml::XmlArena::resource());
 			if (normalizedContent.empty())
 			{
 				// For empty comments, use only one space between tags.
@@ -146,109 +141,241 @@ std::string formatSingleLineComments(const std::string& xml)
 			}
 			else
 			{
-				newComment = "<!-- " + normalizedContent + " -->";
+				newComment.append("<!-- ").append(normalizedContent).append(" -->");
 			}
-			result.replace(pos, endPos - pos + 3, newComment);
-
-			// Adjust position based on the new comment length.
-			pos += newComment.length();
+			result.append(xml, copied, pos - copied).append(newComment.data(), newComment.length());
+			copied = endPos + 3;
 		}
-		else
+
+		// Multi-line comments are copied unchanged.
+		pos = endPos + 3;
+	}
+
+	result.append(xml, copied, std::string::npos);
+	return result;
+}
+
+// Post-process the formatted XML.
+std::string postProcessFormattedXml(std::string formattedXml)
+{
+	// Replace specific patterns.
+	formattedXml = replaceAll(formattedXml, ">\t<!--", "> <!--");
+	formattedXml = replaceAll(formattedXml, "><!--", "> <!--");
+	formattedXml = replaceAll(formattedXml, "\"/>", "\" />");
+
+	// Ensure all self-closing tags have a space before />.
+	// First handle tags without attributes (like <flattenmapper/>).
+	formattedXml = replaceAll(formattedXml, "</>", "< />");  // Just in case.
+
+	// Handle tag names followed directly by />.
+	size_t pos = 0;
+	size_t copied = 0;
+	std::string resultStr;
+	resultStr.reserve(formattedXml.length() + formattedXml.length() / 16);
+	std::string pattern = "/>";
+
+	while ((pos = formattedXml.find(pattern, pos)) != std::string::npos)
+	{
+		// Only add space if there isn't already one and it's not part of "/>.
+		if (pos > 0 && formattedXml[pos - 1] != ' ' && formattedXml[pos - 1] != '"')
 		{
-			// This is a multi-line comment, skip it.
-			pos = endPos + 3;
+			resultStr.append(formattedXml, copied, pos - copied).push_back(' ');
+			copied = pos;
 		}
+		pos += pattern.length();
 	}
+	resultStr.append(formattedXml, copied, std::string::npos);
 
-	return result;
+	formattedXml = resultStr;
+
+	// Format single-line XML comments to ensure proper spacing.
+	formattedXml = formatSingleLineComments(formattedXml);
+
+	// Normalize all line endings to Windows style (\r\n).
+	formattedXml = normalizeLineEndings(formattedXml);
+
+	return formattedXml;
 }
 
-// Indent XML content using QuickXml formatter.
-std::string XmlIndenter::indentXML()
+// Pre-process the XML content: remove the content before the first < and after the last >, and normalize the line endings.
+std::string XmlIndenter::preprocessContent(size_t& startIndex, size_t& truncatedMarkup) const
 {
-	// Pre-process the XML content.
 	std::string processedContent = xmlContent;
 
 	// Remove all content until first < is reached.
-	size_t startIndex = processedContent.find('<');
+	startIndex = processedContent.find('<');
 	if (startIndex != std::string::npos)
 	{
 		processedContent = processedContent.substr(startIndex);
 	}
+	else
+	{
+		startIndex = 0;
+	}
 
 	// Remove all content after the last > character.
 	size_t endIndex = processedContent.rfind('>');
+	truncatedMarkup = std::string::npos;
 	if (endIndex != std::string::npos && endIndex < processedContent.length() - 1)
 	{
+		// Markup in the removed content was not terminated.
+		truncatedMarkup = processedContent.find('<', endIndex + 1);
+		if (truncatedMarkup != std::string::npos)
+		{
+			truncatedMarkup += startIndex;
+		}
 		processedContent = processedContent.substr(0, endIndex + 1);
 	}
 
 	// Replace Mac line endings (\r) with Windows line endings (\r\n).
 	// This more closely follows the C# code's regex approach.
-	processedContent = normalizeLineEndings(processedContent);
-
-	// Create formatter parameters.
-	QuickXml::XmlFormatterParamsType params;
-	params.indentChars = indentStr;
-	params.eolChars = eolStr;
-	params.maxIndentLevel = 255; // Reasonable default.
-	params.ensureConformity = true;
-	params.autoCloseTags = autoCloseEmptyElements;
-	params.indentAttributes = false; // Default for indent-only mode.
-	params.indentOnly = indentOnly;
-	params.applySpacePreserve = true; // Respect xml:space="preserve".
+	return normalizeLineEndings(processedContent);
+}
 
-	// Create formatter with processed XML content.
-	QuickXml::XmlFormatter formatter(processedContent.c_str(), processedContent.length(), params);
+// Complete the validation of the processed content.
+void XmlIndenter::finishValidation(const std::string& processedContent, size_t startIndex, size_t truncatedMarkup)
+{
+	// The pre-processing keeps the line:column layout, errors are moved back to the original content from it.
+	this->validator->finish();
+	QuickXml::XmlLineIndex lines(processedContent.c_str(), processedContent.length());
+	QuickXml::XmlLineIndex sourceLines(xmlContent.c_str(), xmlContent.length());
+	this->validator->locate(lines, sourceLines, sourceLines.positionOf(startIndex));
+	if (truncatedMarkup != std::string::npos)
+	{
+		std::string_view markup(xmlContent.data() + truncatedMarkup, xmlContent.length() - truncatedMarkup);
+		const char* what = (markup.substr(0, 4) == "<!--" ? "Unterminated comment" : (markup.substr(0, 9) == "<![CDATA[" ? "Unterminated CDATA section" : "Unterminated markup"));
+		this->validator->addSourceError(truncatedMarkup, sourceLines.positionOf(truncatedMarkup), what);
+	}
+}
 
-	// Format the XML.
-	std::stringstream* result = formatter.prettyPrint();
+// Indent XML content using QuickXml formatter.
+std::string XmlIndenter::indentXML()
+{
+	// Every short-lived allocation of the document goes to the thread arena, released at once when leaving.
+	QuickXml::XmlArenaScope arenaScope;
 
-	// Get the formatted string.
-	std::string formattedXml = result->str();
+	// Pre-process the XML content.
+	size_t startIndex;
+	size_t truncatedMarkup;
+	std::string processedContent;
+	{
+		XmlTraceScope trace("preprocess");
+		XmlCounterScope counters(CounterPreprocess);
+		processedContent = this->preprocessContent(startIndex, truncatedMarkup);
+	}
 
-	// Clear the stringstream (good practice).
-	result->str(std::string());
+	// The parser lexes tokens as the formatter asks for them, both are a single phase.
+	std::string formattedXml;
+	{
+		XmlTraceScope trace("lex+format");
+		XmlCounterScope counters(CounterFormat);
 
-	// Post-process the formatted XML.
-	// Replace specific patterns.
-	formattedXml = replaceAll(formattedXml, ">\t<!--", "> <!--");
-	formattedXml = replaceAll(formattedXml, "><!--", "> <!--");
-	formattedXml = replaceAll(formattedXml, "\"/>", "\" />");
+		// Create formatter with processed XML content.
+		QuickXml::XmlFormatter formatter(processedContent.c_str(), processedContent.length(), this->makeFormatterParams());
 
-	// Ensure all self-closing tags have a space before />.
-	// First handle tags without attributes (like <flattenmapper/>).
-	formattedXml = replaceAll(formattedXml, "</>", "< />");  // Just in case.
+		if (this->validator != NULL)
+		{
+			this->validator->reset();
+			formatter.setTokenObserver(this->validator);
+		}
 
-	// Handle tag names followed directly by />.
-	size_t pos = 0;
-	std::string resultStr = formattedXml;
-	std::string pattern = "/>";
-	std::string replacement = " />";
+		// Format the XML.
+		std::stringstream* result = formatter.prettyPrint();
 
-	while ((pos = resultStr.find(pattern, pos)) != std::string::npos)
-	{
-		// Only add space if there isn't already one and it's not part of "/>.
-		if (pos > 0 && resultStr[pos - 1] != ' ' && resultStr[pos - 1] != '"')
+		if (this->validator != NULL)
 		{
-			resultStr.replace(pos, pattern.length(), replacement);
-			pos += replacement.length();
+			this->finishValidation(processedContent, startIndex, truncatedMarkup);
 		}
-		else
+
+		// Get the formatted string.
+		formattedXml = result->str();
+
+		// Clear the stringstream (good practice).
+		result->str(std::string());
+	}
+
+	XmlTraceScope trace("postprocess");
+	XmlCounterScope counters(CounterPostprocess);
+	return postProcessFormattedXml(formattedXml);
+}
+
+// Indent XML content with several variants, lexing it once.
+std::vector<std::string> XmlIndenter::indentXMLVariants(const std::vector<QuickXml::XmlFormatterVariant>& variants)
+{
+	QuickXml::XmlArenaScope arenaScope;
+
+	size_t startIndex;
+	size_t truncatedMarkup;
+	std::string processedContent;
+	{
+		XmlTraceScope trace("preprocess");
+		XmlCounterScope counters(CounterPreprocess);
+		processedContent = this->preprocessContent(startIndex, truncatedMarkup);
+	}
+
+	if (this->validator != NULL)
+	{
+		this->validator->reset();
+	}
+
+	std::vector<std::string> res;
+	{
+		XmlTraceScope trace("lex+format");
+		XmlCounterScope counters(CounterFormat);
+		res = QuickXml::XmlFormatter::formatVariants(processedContent.c_str(), processedContent.length(), variants, this->validator);
+		if (this->validator != NULL)
 		{
-			pos += pattern.length();
+			this->finishValidation(processedContent, startIndex, truncatedMarkup);
 		}
 	}
 
-	formattedXml = resultStr;
+	XmlTraceScope trace("postprocess");
+	XmlCounterScope counters(CounterPostprocess);
+	for (std::string& formattedXml : res)
+	{
+		formattedXml = postProcessFormattedXml(formattedXml);
+	}
+	return res;
+}
 
-	// Format single-line XML comments to ensure proper spacing.
-	formattedXml = formatSingleLineComments(formattedXml);
+// Indent only the lines of [begin, end) of the XML content.
+std::string XmlIndenter::indentXMLRange(size_t begin, size_t end, QuickXml::XmlStructureRange& range, const QuickXml::XmlStructureIndex* index)
+{
+	QuickXml::XmlArenaScope arenaScope;
 
-	// Normalize all line endings to Windows style (\r\n).
-	formattedXml = normalizeLineEndings(formattedXml);
+	// The range is formatted in place: the content before it is only pre-scanned for the indentation depth.
+	QuickXml::XmlStructureScanState resume;
+	if (index != NULL)
+	{
+		resume = index->scanStateBefore(xmlContent.c_str(), begin);
+	}
+	QuickXml::XmlFormatter formatter(xmlContent.c_str(), xmlContent.length(), this->makeFormatterParams());
+	std::stringstream* result = formatter.prettyPrintRange(begin, end, range, index != NULL ? &resume : NULL);
+	std::string formattedXml = result->str();
+	result->str(std::string());
 
-	return formattedXml;
+	return postProcessFormattedXml(formattedXml);
+}
+
+// Build the formatter parameters of the current settings.
+QuickXml::XmlFormatterParamsType XmlIndenter::makeFormatterParams() const
+{
+	return makeFormatterParams(indentStr, eolStr, indentOnly, autoCloseEmptyElements);
+}
+
+// Build the formatter parameters of given settings.
+QuickXml::XmlFormatterParamsType XmlIndenter::makeFormatterParams(const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements)
+{
+	QuickXml::XmlFormatterParamsType params;
+	params.indentChars = indentStr;
+	params.eolChars = eolStr;
+	params.maxIndentLevel = 255; // Reasonable default.
+	params.ensureConformity = true;
+	params.autoCloseTags = autoCloseEmptyElements;
+	params.indentAttributes = false; // Default for indent-only mode.
+	params.indentOnly = indentOnly;
+	params.applySpacePreserve = true; // Respect xml:space="preserve".
+	return params;
 }
 
 // Setters for options.
@@ -272,6 +399,11 @@ void XmlIndenter::setAutoCloseEmptyElements(bool autoClose)
 	autoCloseEmptyElements = autoClose;
 }
 
+void XmlIndenter::setValidator(QuickXml::XmlValidator* validator)
+{
+	this->validator = validator;
+}
+
 // Getters for options.
 std::string XmlIndenter::getIndentString() const
 {
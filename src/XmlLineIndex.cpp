@@ -0,0 +1,137 @@
+#include "XmlLineIndex.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define XML_LINE_INDEX_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace QuickXml
+{
+#ifdef XML_LINE_INDEX_SSE2
+	// Index of the lowest set bit of a non-zero mask.
+	static inline unsigned int lowestBit(unsigned int mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return static_cast<unsigned int>(index);
+#else
+		return static_cast<unsigned int>(__builtin_ctz(mask));
+#endif
+	}
+#endif
+
+	std::string XmlLinePosition::toString() const
+	{
+		return std::to_string(this->line) + ":" + std::to_string(this->column);
+	}
+
+	bool XmlLinePosition::parse(const std::string& str, XmlLinePosition& position)
+	{
+		size_t colon = str.find(':');
+		if (colon == std::string::npos || colon == 0 || colon + 1 >= str.length())
+		{
+			return false;
+		}
+
+		if (str.find_first_not_of("0123456789:") != std::string::npos || str.find(':', colon + 1) != std::string::npos)
+		{
+			return false;
+		}
+
+		position.line = std::strtoull(str.c_str(), NULL, 10);
+		position.column = std::strtoull(str.c_str() + colon + 1, NULL, 10);
+		return (position.line > 0 && position.column > 0);
+	}
+
+	XmlLineIndex::XmlLineIndex(const char* data, size_t length) : length(length)
+	{
+		this->lineStarts.push_back(0);
+
+		size_t i = 0;
+#ifdef XML_LINE_INDEX_SSE2
+		// Compare 16 bytes at once against both line break chars, only the matching positions are visited.
+		const __m128i cr = _mm_set1_epi8('\r');
+		const __m128i lf = _mm_set1_epi8('\n');
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf))));
+			while (mask != 0)
+			{
+				this->addLineBreak(data, i + lowestBit(mask));
+				mask &= mask - 1;
+			}
+		}
+#endif
+		for (; i < length; ++i)
+		{
+			if (data[i] == '\r' || data[i] == '\n')
+			{
+				this->addLineBreak(data, i);
+			}
+		}
+	}
+
+	void XmlLineIndex::addLineBreak(const char* data, size_t offset)
+	{
+		if (data[offset] == '\n')
+		{
+			if (offset == 0 || data[offset - 1] != '\r')
+			{
+				this->lineStarts.push_back(offset + 1);
+			}
+			// Else the "\r\n" pair was already recorded on the '\r'.
+		}
+		else if (offset + 1 < this->length && data[offset + 1] == '\n')
+		{
+			this->lineStarts.push_back(offset + 2);
+		}
+		else
+		{
+			this->lineStarts.push_back(offset + 1);
+		}
+	}
+
+	size_t XmlLineIndex::lineCount() const
+	{
+		return this->lineStarts.size();
+	}
+
+	XmlLinePosition XmlLineIndex::positionOf(size_t offset) const
+	{
+		if (offset > this->length)
+		{
+			offset = this->length;
+		}
+
+		// The line is the last one starting at or before the offset.
+		std::vector<size_t>::const_iterator it = std::upper_bound(this->lineStarts.begin(), this->lineStarts.end(), offset);
+		size_t line = static_cast<size_t>(it - this->lineStarts.begin());
+		return { line, offset - this->lineStarts[line - 1] + 1 };
+	}
+
+	size_t XmlLineIndex::offsetOf(const XmlLinePosition& position) const
+	{
+		if (position.line == 0 || position.column == 0 || position.line > this->lineStarts.size())
+		{
+			throw std::out_of_range("Position " + position.toString() + " is outside of the document");
+		}
+
+		// A column may address any byte of the line, its line break included, or the end of the document.
+		size_t lineEnd = (position.line < this->lineStarts.size() ? this->lineStarts[position.line] : this->length + 1);
+		size_t offset = this->lineStarts[position.line - 1] + position.column - 1;
+		if (offset >= lineEnd)
+		{
+			throw std::out_of_range("Position " + position.toString() + " is outside of the document");
+		}
+		return offset;
+	}
+}
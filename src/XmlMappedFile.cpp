@@ -0,0 +1,88 @@
+#include "XmlMappedFile.h"
+
+#include <fstream>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define XML_MAPPED_FILE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace QuickXml
+{
+	XmlMappedFile::~XmlMappedFile()
+	{
+		this->close();
+	}
+
+	bool XmlMappedFile::open(const std::filesystem::path& path)
+	{
+		this->close();
+
+#ifdef XML_MAPPED_FILE_MMAP
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		struct stat info;
+		if (fstat(fd, &info) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		// Empty files cannot be mapped, they have no data.
+		this->length = static_cast<size_t>(info.st_size);
+		if (this->length > 0)
+		{
+			void* mapping = mmap(NULL, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping == MAP_FAILED)
+			{
+				::close(fd);
+				this->length = 0;
+				return false;
+			}
+			this->mapping = mapping;
+			this->data = static_cast<const char*>(mapping);
+		}
+		::close(fd);
+		return true;
+#else
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		this->buffer.resize(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(&this->buffer[0], this->buffer.length());
+		if (static_cast<size_t>(file.gcount()) != this->buffer.length())
+		{
+			this->buffer.clear();
+			return false;
+		}
+		this->data = this->buffer.data();
+		this->length = this->buffer.length();
+		return true;
+#endif
+	}
+
+	void XmlMappedFile::close()
+	{
+#ifdef XML_MAPPED_FILE_MMAP
+		if (this->mapping != NULL)
+		{
+			munmap(this->mapping, this->length);
+		}
+#endif
+		this->mapping = NULL;
+		this->buffer.clear();
+		this->data = NULL;
+		this->length = 0;
+	}
+}
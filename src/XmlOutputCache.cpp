@@ -0,0 +1,232 @@
+#include "XmlOutputCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "XmlHash.h"
+
+// Bump this version whenever the formatter output changes, it invalidates every existing entry.
+#define XML_CACHE_FORMAT_VERSION "XMLCLEANUP-CACHE 4"
+
+// Trimming evicts entries until the cache is back to this percentage of its bound.
+#define XML_CACHE_TRIM_TARGET_PERCENT 90
+
+struct XmlCacheFileInfo
+{
+	std::filesystem::file_time_type lastUse;
+	uint64_t size;
+	std::filesystem::path path;
+};
+
+// A per-process random token, used to make temporary entry names unique between processes.
+static std::string processToken()
+{
+	static const std::string token = []()
+	{
+		std::random_device device;
+		uint64_t value = (static_cast<uint64_t>(device()) << 32) ^ device();
+		return QuickXml::XmlHasher::toHex(value);
+	}();
+	return token;
+}
+
+XmlOutputCache::XmlOutputCache(const std::filesystem::path& directory, uint64_t maxBytes) : directory(directory), maxBytes(maxBytes), storedBytes(0)
+{
+	std::error_code ec;
+	std::filesystem::create_directories(directory, ec);
+	if (ec)
+	{
+		throw std::runtime_error("Cannot create cache directory " + directory.string() + ": " + ec.message());
+	}
+}
+
+XmlOutputCache::~XmlOutputCache()
+{
+}
+
+std::string XmlOutputCache::entryKey(const std::string& content, const std::string& optionsKey) const
+{
+	// Two independent 64-bit hashes: the second one is seeded with the options so that each settings combination has its own entries.
+	uint64_t contentHash = QuickXml::XmlHasher::hash(content.data(), content.length());
+	uint64_t optionsSeed = QuickXml::XmlHasher::hash(optionsKey.data(), optionsKey.length());
+	uint64_t mixedHash = QuickXml::XmlHasher::hash(content.data(), content.length(), optionsSeed);
+	return QuickXml::XmlHasher::toHex(contentHash) + QuickXml::XmlHasher::toHex(mixedHash);
+}
+
+std::filesystem::path XmlOutputCache::entryPath(const std::string& key) const
+{
+	return this->directory / key.substr(0, 2) / key;
+}
+
+XmlCacheResult XmlOutputCache::lookup(const std::string& content, const std::string& optionsKey, std::string& output)
+{
+	std::filesystem::path path = this->entryPath(this->entryKey(content, optionsKey));
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		return XmlCacheResult::Miss;
+	}
+
+	// Check the header. Any inconsistency is handled as a miss, the entry will be rewritten.
+	std::string header;
+	if (!std::getline(file, header) || header.compare(0, strlen(XML_CACHE_FORMAT_VERSION), XML_CACHE_FORMAT_VERSION) != 0)
+	{
+		return XmlCacheResult::Miss;
+	}
+
+	std::istringstream fields(header.substr(strlen(XML_CACHE_FORMAT_VERSION)));
+	char kind = 0;
+	uint64_t inputSize = 0;
+	uint64_t outputSize = 0;
+	fields >> kind >> inputSize;
+	if (!fields || inputSize != content.length())
+	{
+		return XmlCacheResult::Miss;
+	}
+
+	XmlCacheResult result = XmlCacheResult::Miss;
+	if (kind == 'C')
+	{
+		result = XmlCacheResult::Clean;
+	}
+	else if (kind == 'F')
+	{
+		fields >> outputSize;
+		if (!fields)
+		{
+			return XmlCacheResult::Miss;
+		}
+
+		output.resize(outputSize);
+		file.read(&output[0], outputSize);
+		if (static_cast<uint64_t>(file.gcount()) != outputSize)
+		{
+			output.clear();
+			return XmlCacheResult::Miss;
+		}
+		result = XmlCacheResult::Formatted;
+	}
+	file.close();
+
+	// The modification time is the LRU clock. Failures are harmless: another process may have evicted the entry meanwhile.
+	std::error_code ec;
+	std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+
+	return result;
+}
+
+void XmlOutputCache::store(const std::string& content, const std::string& optionsKey, const std::string& output)
+{
+	std::filesystem::path path = this->entryPath(this->entryKey(content, optionsKey));
+	std::error_code ec;
+	std::filesystem::create_directories(path.parent_path(), ec);
+
+	// Write a private temporary file then publish it with an atomic rename, so that concurrent readers never see partial entries.
+	static std::atomic<uint64_t> counter(0);
+	std::filesystem::path tmpPath = path;
+	tmpPath += "." + processToken() + "." + std::to_string(counter++) + ".tmp";
+
+	bool isClean = (output == content);
+	{
+		std::ofstream file(tmpPath, std::ios::binary);
+		if (!file.is_open())
+		{
+			return;
+		}
+
+		if (isClean)
+		{
+			file << XML_CACHE_FORMAT_VERSION << " C " << content.length() << "\n";
+		}
+		else
+		{
+			file << XML_CACHE_FORMAT_VERSION << " F " << content.length() << " " << output.length() << "\n";
+			file.write(output.data(), output.length());
+		}
+
+		if (!file.good())
+		{
+			file.close();
+			std::filesystem::remove(tmpPath, ec);
+			return;
+		}
+	}
+
+	std::filesystem::rename(tmpPath, path, ec);
+	if (ec)
+	{
+		std::filesystem::remove(tmpPath, ec);
+		return;
+	}
+
+	this->storedBytes += (isClean ? 0 : output.length()) + 64;
+}
+
+void XmlOutputCache::trim()
+{
+	if (this->storedBytes == 0)
+	{
+		return;
+	}
+
+	std::vector<XmlCacheFileInfo> entries;
+	uint64_t totalBytes = 0;
+	std::error_code ec;
+	for (std::filesystem::recursive_directory_iterator it(this->directory, ec), end; !ec && it != end; it.increment(ec))
+	{
+		if (!it->is_regular_file(ec))
+		{
+			continue;
+		}
+
+		XmlCacheFileInfo info;
+		info.path = it->path();
+		info.size = it->file_size(ec);
+		info.lastUse = it->last_write_time(ec);
+		if (ec)
+		{
+			// The entry vanished, most likely evicted by another process.
+			ec.clear();
+			continue;
+		}
+		totalBytes += info.size;
+		entries.push_back(info);
+	}
+
+	if (totalBytes <= this->maxBytes)
+	{
+		return;
+	}
+
+	// Evict the oldest entries first. Concurrent evictions are harmless, a removed entry is only a future miss.
+	std::sort(entries.begin(), entries.end(), [](const XmlCacheFileInfo& a, const XmlCacheFileInfo& b) { return a.lastUse < b.lastUse; });
+
+	uint64_t targetBytes = this->maxBytes / 100 * XML_CACHE_TRIM_TARGET_PERCENT;
+	for (const XmlCacheFileInfo& info : entries)
+	{
+		if (totalBytes <= targetBytes)
+		{
+			break;
+		}
+
+		std::filesystem::remove(info.path, ec);
+		totalBytes -= info.size;
+	}
+}
+
+std::string XmlOutputCache::makeOptionsKey(const std::string& indentStr, const std::string& eolStr, bool indentOnly, bool autoCloseEmptyElements, bool validate)
+{
+	std::ostringstream key;
+	key << XML_CACHE_FORMAT_VERSION << "|indent=" << indentStr << "|eol=" << eolStr << "|indentOnly=" << indentOnly << "|autoClose=" << autoCloseEmptyElements;
+	if (validate)
+	{
+		// Not part of the key when unset, so that existing entries stay valid.
+		key << "|validated";
+	}
+	return key.str();
+}
@@ -1,8 +1,10 @@
 #include "XmlParser.h"
 
+#include <cstring>
+
 namespace QuickXml
 {
-	XmlParser::XmlParser(const char* data, size_t length)
+	XmlParser::XmlParser(const char* data, size_t length, std::pmr::memory_resource* resource) : buffer(resource), preserveSpace(std::pmr::deque<bool>(resource))
 	{
 		this->srcText = data;
 		this->srcLength = length;
@@ -21,6 +23,7 @@ namespace QuickXml
 	void XmlParser::reset()
 	{
 		this->hasAttrName = false;
+		this->expectAttrValue = false;
 		this->currpos = 0;
 
 		this->currcontext = { false, false, 0 };
@@ -28,6 +31,44 @@ namespace QuickXml
 		this->prevtoken = { XmlTokenType::Undefined, NULL, 0, 0, this->currcontext };
 		this->currtoken = { XmlTokenType::Undefined, NULL, 0, 0, this->currcontext };
 		this->nexttoken = { XmlTokenType::Undefined, NULL, 0, 0, this->currcontext };
+		this->attrnametoken = { XmlTokenType::Undefined, 0, NULL, 0, this->currcontext };
+	}
+
+	void XmlParser::setOpenElements(size_t depth, const XmlSpaceSwitches& spaceSwitches)
+	{
+		while (!this->preserveSpace.empty())
+		{
+			this->preserveSpace.pop();
+		}
+
+		bool preserve = false;
+		size_t next = 0;
+		for (size_t i = 0; i < depth; ++i)
+		{
+			if (next < spaceSwitches.size() && spaceSwitches[next] == i)
+			{
+				preserve = !preserve;
+				++next;
+			}
+			this->preserveSpace.push(preserve);
+		}
+	}
+
+	void XmlParser::popSpacePreserve()
+	{
+		if (!this->preserveSpace.empty())
+		{
+			this->preserveSpace.pop();
+		}
+	}
+
+	void XmlParser::closeUnterminatedTag()
+	{
+		// An end tag without its '>' still ends its element.
+		if (this->currcontext.inClosingTag)
+		{
+			this->popSpacePreserve();
+		}
 	}
 
 	bool XmlParser::isSpacePreserve()
@@ -55,7 +96,7 @@ namespace QuickXml
 		else
 		{
 			// Let's search in the buffered list.
-			for (std::list<XmlToken>::iterator it = this->buffer.begin(); it != this->buffer.end(); ++it)
+			for (std::pmr::list<XmlToken>::iterator it = this->buffer.begin(); it != this->buffer.end(); ++it)
 			{
 				if (!((*it).type & (XmlTokenType::Whitespace | XmlTokenType::LineBreak | XmlTokenType::Text)))
 				{
@@ -102,6 +143,72 @@ namespace QuickXml
 		return this->currtoken;
 	}
 
+	void XmlParser::extend(const char* data, size_t length)
+	{
+		// Tokens kept by the parser point to the previous copy.
+		const char* previous = this->srcText;
+		for (XmlToken* token : { &this->prevtoken, &this->currtoken, &this->nexttoken, &this->attrnametoken })
+		{
+			if (token->chars != NULL)
+			{
+				token->chars = data + (token->chars - previous);
+			}
+		}
+		for (XmlToken& token : this->buffer)
+		{
+			token.chars = data + (token.chars - previous);
+		}
+
+		this->srcText = data;
+		this->srcLength = length;
+	}
+
+	bool XmlParser::lexNext(XmlToken& token, bool moreData)
+	{
+		// Everything a single token can change.
+		size_t pos = this->currpos;
+		XmlContext context = this->currcontext;
+		bool hasAttrName = this->hasAttrName;
+		XmlToken attrnametoken = this->attrnametoken;
+		bool expectAttrValue = this->expectAttrValue;
+		size_t preserveDepth = this->preserveSpace.size();
+		bool preserveTop = (!this->preserveSpace.empty() && this->preserveSpace.top());
+
+		token = this->scanToken();
+		if (moreData && this->currpos >= this->srcLength)
+		{
+			this->currpos = pos;
+			this->currcontext = context;
+			this->hasAttrName = hasAttrName;
+			this->attrnametoken = attrnametoken;
+			this->expectAttrValue = expectAttrValue;
+
+			// A token pushes, pops or replaces one xml:space entry at most.
+			if (this->preserveSpace.size() > preserveDepth)
+			{
+				this->preserveSpace.pop();
+			}
+			else if (this->preserveSpace.size() < preserveDepth)
+			{
+				this->preserveSpace.push(preserveTop);
+			}
+			else if (!this->preserveSpace.empty() && this->preserveSpace.top() != preserveTop)
+			{
+				this->preserveSpace.pop();
+				this->preserveSpace.push(preserveTop);
+			}
+			return false;
+		}
+
+		if (this->observer != NULL && token.type != XmlTokenType::EndOfFile)
+		{
+			this->observer->onToken(token);
+		}
+		this->prevtoken = this->currtoken;
+		this->currtoken = token;
+		return true;
+	}
+
 	XmlToken XmlParser::parseUntil(XmlTokensType type)
 	{
 		type |= XmlTokenType::EndOfFile; // Let's avoid infinite loop.
@@ -113,257 +220,274 @@ namespace QuickXml
 		return this->currtoken;
 	}
 
-	XmlToken XmlParser::fetchToken()
+	XmlLexState XmlParser::lexState() const
+	{
+		if (this->currcontext.declarationObjects > 0)
+		{
+			return LexStateDeclaration;
+		}
+		else if (this->currcontext.inClosingTag)
+		{
+			return LexStateClosingTag;
+		}
+		else if (this->currcontext.inOpeningTag)
+		{
+			return LexStateOpeningTag;
+		}
+		return LexStateText;
+	}
+
+	bool XmlParser::lookingAt(const char* str, size_t length) const
 	{
-		char currentchar;
+		return (this->srcLength - this->currpos >= length && !memcmp(this->srcText + this->currpos, str, length));
+	}
 
-		const char* cursor = this->srcText + this->currpos;
-		const char* startpos = this->srcText + this->currpos;
-		size_t currpos_bak;
+	XmlToken XmlParser::fetchToken()
+	{
+		XmlToken token = this->scanToken();
+		if (this->observer != NULL && token.type != XmlTokenType::EndOfFile)
+		{
+			this->observer->onToken(token);
+		}
+		return token;
+	}
 
+	XmlToken XmlParser::scanToken()
+	{
 		if (this->currpos >= this->srcLength)
 		{
 			return { XmlTokenType::EndOfFile, this->srcLength, this->srcText + this->srcLength, 0, this->currcontext };
 		}
 
-		while (this->currpos < this->srcLength)
+		const char* startpos = this->srcText + this->currpos;
+		unsigned char currentchar = static_cast<unsigned char>(startpos[0]);
+		XmlLexState state = this->lexState();
+
+		// The dispatch table of the current state gives the token kind from its first char.
+		switch (XML_LEX_ACTIONS[state][currentchar])
 		{
-			currentchar = cursor[0];
-			currpos_bak = this->currpos;
-			if (currentchar == '<')
-			{
-				// @TODO: Prevent reading outside chars buffer.
-				if (cursor[1] == '?')
+			case LexMarkup:
+				return this->fetchMarkupToken();
+
+			case LexTagEnd:
+				if (state == LexStateDeclaration)
 				{
-					// "<?xml ...?>".
-					// Let's leave it untouched.
-					this->currcontext.inOpeningTag = false;
-					this->currcontext.inClosingTag = false;
-					return { XmlTokenType::Instruction, this->currpos, startpos, this->readUntil("?>", 0, true), this->currcontext };
+					this->currcontext.declarationObjects--;
+					return { XmlTokenType::DeclarationEnd, this->currpos, startpos, this->readChars(1), this->currcontext };
 				}
-				else if (cursor[1] == '%')
+				else if (state == LexStateClosingTag)
 				{
-					// Not really xml, but for jsp compatibility.
-					// Let's leave it untouched.
-					this->currcontext.inOpeningTag = false;
+					this->hasAttrName = false;
 					this->currcontext.inClosingTag = false;
-					return { XmlTokenType::Instruction, this->currpos, startpos, this->readUntil("%>", 0, true), this->currcontext };
+					this->popSpacePreserve();
+					return { XmlTokenType::TagClosingEnd, this->currpos, startpos, this->readChars(1), this->currcontext };
 				}
-				else if (cursor[1] == '!' && cursor[2] == '-' && cursor[3] == '-')
+				this->hasAttrName = false;
+				this->currcontext.inOpeningTag = false;
+				return { XmlTokenType::TagOpeningEnd, this->currpos, startpos, this->readChars(1), this->currcontext };
+
+			case LexSpace:
+				if (state == LexStateClosingTag)
 				{
-					// "<!--".
-					// Let's leave it untouched.
-					this->currcontext.inOpeningTag = false;
-					this->currcontext.inClosingTag = false;
-					return { XmlTokenType::Comment, this->currpos, startpos, this->readUntil("-->", 0, true), this->currcontext };
+					this->hasAttrName = false;
 				}
-				else if (cursor[1] == '!' && cursor[2] == '[' && cursor[3] == 'C' && cursor[4] == 'D' && cursor[5] == 'A' && cursor[6] == 'T' && cursor[7] == 'A' && cursor[8] == '[')
+				return { XmlTokenType::Whitespace, this->currpos, startpos, this->readUntilFirstNotOf(static_cast<XmlCharClasses>(CharSpace)), this->currcontext };
+
+			case LexLineBreak:
+				if (state == LexStateClosingTag)
 				{
-					// "<![CDATA[".
-					// Let's leave it untouched.
-					this->currcontext.inOpeningTag = false;
-					this->currcontext.inClosingTag = false;
-					return { XmlTokenType::CDATA, this->currpos, startpos, this->readUntil("]]>", 0, true), this->currcontext };
+					this->hasAttrName = false;
 				}
-				else if (cursor[1] == '!')
-				{
-					// <!  for instance "<![INCLUDE or <!DOCTYPE.
-					// Some other declaration.
-					this->currcontext.inOpeningTag = false;
-					this->currcontext.inClosingTag = false;
-					this->currcontext.declarationObjects++;
-
-					// Parse declarations.
-					// We must decide if we have a DeclarationBeg or DeclarationSelfClosing.
-					size_t ncharsread = this->readDeclaration();
-					cursor = this->srcText + this->currpos - 1;
-					XmlTokenType tokentype = (cursor[0] == '>' ? XmlTokenType::DeclarationSelfClosing : XmlTokenType::DeclarationBeg);
-					if (tokentype == XmlTokenType::DeclarationSelfClosing)
-					{
-						this->currcontext.declarationObjects--;
-					}
+				return { XmlTokenType::LineBreak, this->currpos, startpos, this->readUntilFirstNotOf(static_cast<XmlCharClasses>(CharLineBreak)), this->currcontext };
 
-					XmlToken token = { tokentype, currpos_bak, startpos, ncharsread, this->currcontext };
-					return token;
-				}
-				else if (cursor[1] == '/')
+			case LexBracketClose:
+				// Only dispatched in declarations.
+				if (this->lookingAt("]>", 2))
 				{
-					// "</ns:sample".
-					this->currcontext.inOpeningTag = false;
-					this->currcontext.inClosingTag = true;
-					if (!this->preserveSpace.empty())
-					{
-						this->preserveSpace.pop();
-					}
-					return { XmlTokenType::TagClosing, this->currpos, startpos, this->readUntilFirstOf("> \r\n"), this->currcontext };
+					this->currcontext.declarationObjects--;
+					return { XmlTokenType::DeclarationEnd, this->currpos, startpos, this->readChars(2), this->currcontext };
 				}
-				else
+				return { XmlTokenType::Undefined, this->currpos, startpos, this->readChars(1), this->currcontext };
+
+			case LexSlash:
+				// Only dispatched in opening tags.
+				if (this->lookingAt("/>", 2))
 				{
-					// Parsing tag name like "<sample" or "<ns:sample".
-					this->currcontext.inOpeningTag = true;
-					this->currcontext.inClosingTag = false;
-					if (this->preserveSpace.empty())
-					{
-						this->preserveSpace.push(false);
-					}
-					else
-					{
-						this->preserveSpace.push(this->preserveSpace.top());
-					}
-					return { XmlTokenType::TagOpening, this->currpos, startpos, this->readUntilFirstOf(" />\t\r\n"), this->currcontext };
+					this->hasAttrName = false;
+					this->currcontext.inOpeningTag = false;
+
+					// The element ends here, its xml:space entry too.
+					this->popSpacePreserve();
+					return { XmlTokenType::TagSelfClosingEnd, this->currpos, startpos, this->readChars(2), this->currcontext };
 				}
+				return { XmlTokenType::Undefined, this->currpos, startpos, this->readChars(1), this->currcontext };
+
+			case LexEqual:
+				// Only dispatched in opening tags.
+				this->expectAttrValue = true;
+				return { XmlTokenType::Equal, this->currpos, startpos, this->readChars(1), this->currcontext };
+
+			case LexQuote:
+			case LexOther:
+			default:
 				break;
-			}
-			else if (this->currcontext.declarationObjects > 0)
+		}
+
+		switch (state)
+		{
+			case LexStateOpeningTag:
+				return this->fetchAttributeToken(XML_LEX_ACTIONS[state][currentchar] == LexQuote);
+
+			case LexStateDeclaration:
+				return { XmlTokenType::Undefined, this->currpos, startpos, this->readChars(1), this->currcontext };
+
+			case LexStateClosingTag:
+				this->hasAttrName = false;
+				return { XmlTokenType::Undefined, this->currpos, startpos, this->readChars(1), this->currcontext };
+
+			case LexStateText:
+			default:
+				// Parsing text.
+				return { XmlTokenType::Text, this->currpos, startpos, this->readUntilChar('<'), this->currcontext };
+		}
+	}
+
+	XmlToken XmlParser::fetchMarkupToken()
+	{
+		this->closeUnterminatedTag();
+		const char* startpos = this->srcText + this->currpos;
+		size_t currpos_bak = this->currpos;
+
+		if (this->lookingAt("<?", 2))
+		{
+			// "<?xml ...?>".
+			// Let's leave it untouched.
+			this->currcontext.inOpeningTag = false;
+			this->currcontext.inClosingTag = false;
+			return { XmlTokenType::Instruction, this->currpos, startpos, this->readUntil("?>", 0, true), this->currcontext };
+		}
+		else if (this->lookingAt("<%", 2))
+		{
+			// Not really xml, but for jsp compatibility.
+			// Let's leave it untouched.
+			this->currcontext.inOpeningTag = false;
+			this->currcontext.inClosingTag = false;
+			return { XmlTokenType::Instruction, this->currpos, startpos, this->readUntil("%>", 0, true), this->currcontext };
+		}
+		else if (this->lookingAt("<!--", 4))
+		{
+			// "<!--".
+			// Let's leave it untouched.
+			this->currcontext.inOpeningTag = false;
+			this->currcontext.inClosingTag = false;
+			return { XmlTokenType::Comment, this->currpos, startpos, this->readUntil("-->", 0, true), this->currcontext };
+		}
+		else if (this->lookingAt("<![CDATA[", 9))
+		{
+			// "<![CDATA[".
+			// Let's leave it untouched.
+			this->currcontext.inOpeningTag = false;
+			this->currcontext.inClosingTag = false;
+			return { XmlTokenType::CDATA, this->currpos, startpos, this->readUntil("]]>", 0, true), this->currcontext };
+		}
+		else if (this->lookingAt("<!", 2))
+		{
+			// <!  for instance "<![INCLUDE or <!DOCTYPE.
+			// Some other declaration.
+			this->currcontext.inOpeningTag = false;
+			this->currcontext.inClosingTag = false;
+			this->currcontext.declarationObjects++;
+
+			// Parse declarations.
+			// We must decide if we have a DeclarationBeg or DeclarationSelfClosing.
+			size_t ncharsread = this->readDeclaration();
+			XmlTokenType tokentype = (this->srcText[this->currpos - 1] == '>' ? XmlTokenType::DeclarationSelfClosing : XmlTokenType::DeclarationBeg);
+			if (tokentype == XmlTokenType::DeclarationSelfClosing)
 			{
-				if (currentchar == ']' && cursor[1] == '>')
-				{
-					if (this->currcontext.declarationObjects > 0)
-					{
-						this->currcontext.declarationObjects--;
-					}
-					return { XmlTokenType::DeclarationEnd, this->currpos, startpos, this->readChars(2), this->currcontext };
-				}
-				else if (currentchar == '>')
-				{
-					if (this->currcontext.declarationObjects > 0)
-					{
-						this->currcontext.declarationObjects--;
-					}
-					return { XmlTokenType::DeclarationEnd, this->currpos, startpos, this->readChars(1), this->currcontext };
-				}
-				else if (currentchar == ' ' || currentchar == '\t')
-				{
-					return { XmlTokenType::Whitespace, this->currpos, startpos, this->readUntilFirstNotOf(" \t"), this->currcontext };
-				}
-				else if (currentchar == '\r' || currentchar == '\n')
-				{
-					return { XmlTokenType::LineBreak, this->currpos, startpos, this->readUntilFirstNotOf("\r\n"), this->currcontext };
-				}
-				else
-				{
-					return { XmlTokenType::Undefined, this->currpos, startpos, this->readChars(1), this->currcontext };
-				}
+				this->currcontext.declarationObjects--;
 			}
-			else if (this->currcontext.inClosingTag)
+
+			XmlToken token = { tokentype, currpos_bak, startpos, ncharsread, this->currcontext };
+			return token;
+		}
+		else if (this->lookingAt("</", 2))
+		{
+			// "</ns:sample".
+			this->currcontext.inOpeningTag = false;
+			this->currcontext.inClosingTag = true;
+			return { XmlTokenType::TagClosing, this->currpos, startpos, this->readUntilFirstOf(static_cast<XmlCharClasses>(CharClosingTagNameEnd)), this->currcontext };
+		}
+
+		// Parsing tag name like "<sample" or "<ns:sample".
+		this->currcontext.inOpeningTag = true;
+		this->currcontext.inClosingTag = false;
+		if (this->preserveSpace.empty())
+		{
+			this->preserveSpace.push(false);
+		}
+		else
+		{
+			this->preserveSpace.push(this->preserveSpace.top());
+		}
+		return { XmlTokenType::TagOpening, this->currpos, startpos, this->readUntilFirstOf(static_cast<XmlCharClasses>(CharTagNameEnd)), this->currcontext };
+	}
+
+	XmlToken XmlParser::fetchAttributeToken(bool startsWithQuote)
+	{
+		const char* startpos = this->srcText + this->currpos;
+		char currentchar = startpos[0];
+
+		if (this->hasAttrName)
+		{
+			this->hasAttrName = false;
+			if (this->expectAttrValue || startsWithQuote)
 			{
-				this->hasAttrName = false;
-				// Parsing closing tag content.
-				if (currentchar == '>')
-				{
-					this->currcontext.inClosingTag = false;
-					return { XmlTokenType::TagClosingEnd, this->currpos, startpos, this->readChars(1), this->currcontext };
-				}
-				else if (currentchar == ' ' || currentchar == '\t')
-				{
-					return { XmlTokenType::Whitespace, this->currpos, startpos, this->readUntilFirstNotOf(" \t"), this->currcontext };
-				}
-				else if (currentchar == '\r' || currentchar == '\n')
+				// Standard value, delimited with " or '.
+				this->expectAttrValue = false;
+				XmlToken tmp;
+				if (startsWithQuote)
 				{
-					return { XmlTokenType::LineBreak, this->currpos, startpos, this->readUntilFirstNotOf("\r\n"), this->currcontext };
+					// Normal case, let's skip the quoted/apostrophed attribute value.
+					tmp = { XmlTokenType::AttrValue, this->currpos, startpos, this->readUntilChar(currentchar, 1, true), this->currcontext }; // Skip actual delimiter + parse content.
 				}
 				else
 				{
-					return { XmlTokenType::Undefined, this->currpos, startpos, this->readChars(1), this->currcontext };
+					// We have some unexpected chars between the = and the attribute value.
+					// Let's read next word of string.
+					tmp = { XmlTokenType::AttrValue, this->currpos, startpos, this->readNextWord(true), this->currcontext };
 				}
-			}
-			else if (this->currcontext.inOpeningTag)
-			{
-				// Parse opening tag content.
-				if (currentchar == '>')
-				{
-					this->hasAttrName = false;
-					this->currcontext.inOpeningTag = false;
-					return { XmlTokenType::TagOpeningEnd, this->currpos, startpos, this->readChars(1), this->currcontext };
-				}
-				else if (currentchar == ' ' || currentchar == '\t')
-				{
-					return { XmlTokenType::Whitespace, this->currpos, startpos, this->readUntilFirstNotOf(" \t"), this->currcontext };
-				}
-				else if (currentchar == '\r' || currentchar == '\n')
-				{
-					return { XmlTokenType::LineBreak, this->currpos, startpos, this->readUntilFirstNotOf("\r\n"), this->currcontext };
-				}
-				else if (currentchar == '/')
-				{
-					if (cursor[1] == '>')
-					{
-						this->hasAttrName = false;
-						this->currcontext.inOpeningTag = false;
-						return { XmlTokenType::TagSelfClosingEnd, this->currpos, startpos, this->readChars(2), this->currcontext };
-					}
-					else
-					{
-						return { XmlTokenType::Undefined, this->currpos, startpos, this->readChars(1), this->currcontext };
-					}
-				}
-				else if (currentchar == '=')
-				{
-					this->expectAttrValue = true;
-					return { XmlTokenType::Equal, this->currpos, startpos, this->readChars(1), this->currcontext };
-				}
-				else if (this->hasAttrName)
+
+				// Whole names and values are compared: x="" is not xml:space="preserve".
+				if (!this->preserveSpace.empty() && this->attrnametoken.size == 9 && !strncmp(this->attrnametoken.chars, "xml:space", 9) && tmp.size >= 2)
 				{
-					this->hasAttrName = false;
-					if (this->expectAttrValue || currentchar == '"' || currentchar == '\'')
+					if (tmp.size - 2 == 8 && !strncmp(tmp.chars + 1, "preserve", 8))
 					{
-						// Standard value, delimited with " or '.
-						this->expectAttrValue = false;
-						XmlToken tmp;
-						if (currentchar == '"' || currentchar == '\'')
-						{
-							// Normal case, let's skip the quoted/apostrophed attribute value.
-							char valDelimiter[2] = { currentchar, '\0' };
-							tmp = { XmlTokenType::AttrValue, this->currpos, startpos, this->readUntilFirstOf(valDelimiter, 1, true), this->currcontext }; // Skip actual delimiter + parse content.
-						}
-						else
-						{
-							// We have some unexpected chars between the = and the attribute value.
-							// Let's read next word of string.
-							tmp = { XmlTokenType::AttrValue, this->currpos, startpos, this->readNextWord(true), this->currcontext };
-						}
-
-						if (!this->preserveSpace.empty() && !strncmp(this->attrnametoken.chars, "xml:space", this->attrnametoken.size))
-						{
-							if (!strncmp(tmp.chars + 1, "preserve", tmp.size - 2))
-							{
-								this->preserveSpace.pop(); // Replace the actual stack top.
-								this->preserveSpace.push(true);
-							}
-							else if (!strncmp(tmp.chars + 1, "default", tmp.size - 2))
-							{
-								this->preserveSpace.pop(); // Replace the actual stack top.
-								this->preserveSpace.push(false);
-							}
-						}
-
-						return tmp;
+						this->preserveSpace.pop(); // Replace the actual stack top.
+						this->preserveSpace.push(true);
 					}
-					else
+					else if (tmp.size - 2 == 7 && !strncmp(tmp.chars + 1, "default", 7))
 					{
-						// Attribute with no value.
-						this->hasAttrName = true;
-						XmlToken tmp = { XmlTokenType::AttrName, this->currpos, startpos, this->readUntilFirstOf("= /\t\r\n"), this->currcontext };
-						this->attrnametoken = tmp;
-						return tmp;
+						this->preserveSpace.pop(); // Replace the actual stack top.
+						this->preserveSpace.push(false);
 					}
 				}
-				else
-				{
-					this->hasAttrName = true;
-					XmlToken tmp = { XmlTokenType::AttrName, this->currpos, startpos, this->readUntilFirstOf("= /\t\r\n"), this->currcontext };
-					this->attrnametoken = tmp;
-					return tmp;
-				}
+
+				return tmp;
 			}
 			else
 			{
-				// Parsing text.
-				return { XmlTokenType::Text, this->currpos, startpos, this->readUntilFirstOf("<"), this->currcontext };
+				// Attribute with no value.
+				this->hasAttrName = true;
+				XmlToken tmp = { XmlTokenType::AttrName, this->currpos, startpos, this->readUntilFirstOf(static_cast<XmlCharClasses>(CharAttrNameEnd)), this->currcontext };
+				this->attrnametoken = tmp;
+				return tmp;
 			}
 		}
 
-		return { XmlTokenType::Undefined, this->currpos, startpos, this->readChars(1), this->currcontext };
+		this->hasAttrName = true;
+		XmlToken tmp = { XmlTokenType::AttrName, this->currpos, startpos, this->readUntilFirstOf(static_cast<XmlCharClasses>(CharAttrNameEnd)), this->currcontext };
+		this->attrnametoken = tmp;
+		return tmp;
 	}
 
 	size_t XmlParser::readChars(size_t nchars)
@@ -386,8 +510,17 @@ namespace QuickXml
 			while (n > 0)
 			{
 				num += n;
-				if (cursor[num] == ' ' || cursor[num] == '\t' || cursor[num] == '\r' || cursor[num] == '\n')
+				if (this->currpos >= this->srcLength)
+				{
+					break;
+				}
+				else if (cursor[num] == ' ' || cursor[num] == '\t' || cursor[num] == '\r' || cursor[num] == '\n')
+				{
+					break;
+				}
+				else if (cursor[num] == '>' || (cursor[num] == '/' && this->currpos + 1 < this->srcLength && cursor[num + 1] == '>'))
 				{
+					// An unquoted value ends with its tag: <b c=d/> is not terminated by the rest of the document.
 					break;
 				}
 				else if (cursor[num] == '"')
@@ -407,100 +540,181 @@ namespace QuickXml
 		}
 		else
 		{
-			return this->readUntilFirstOf(" \t\r\n=\"'<>");
+			return this->readUntilFirstOf(static_cast<XmlCharClasses>(CharWordEnd));
 		}
 	}
 
 	size_t XmlParser::readUntilFirstOf(const char* characters, size_t offset, bool goAfter)
 	{
+		// Runtime equivalent of the constexpr class tables, for arbitrary delimiters.
+		bool delimiters[256] = {};
+		for (const char* c = characters; *c; ++c)
+		{
+			delimiters[static_cast<unsigned char>(*c)] = true;
+		}
+
+		if (offset > 0)
+		{
+			offset = this->readChars(offset);
+		}
+		const unsigned char* cursor = reinterpret_cast<const unsigned char*>(this->srcText + this->currpos);
+		size_t remaining = this->srcLength - this->currpos;
+		size_t res = 0;
+		while (res < remaining && !delimiters[cursor[res]])
+		{
+			++res;
+		}
+		if (goAfter && res < remaining)
+		{
+			++res;
+		}
+		this->currpos += res;
+		return res + offset;
+	}
+
+	size_t XmlParser::readUntilFirstOf(XmlCharClasses classes, size_t offset, bool goAfter)
+	{
+		if (offset > 0)
+		{
+			offset = this->readChars(offset);
+		}
+		const unsigned char* cursor = reinterpret_cast<const unsigned char*>(this->srcText + this->currpos);
+		size_t remaining = this->srcLength - this->currpos;
 		size_t res = 0;
+		while (res < remaining && !(XML_CHAR_CLASSES[cursor[res]] & classes))
+		{
+			++res;
+		}
+		if (goAfter && res < remaining)
+		{
+			++res;
+		}
+		this->currpos += res;
+		return res + offset;
+	}
+
+	size_t XmlParser::readUntilChar(char character, size_t offset, bool goAfter)
+	{
 		if (offset > 0)
 		{
 			offset = this->readChars(offset);
 		}
 		const char* cursor = this->srcText + this->currpos;
-		const char* tmp = strpbrk(cursor, characters);
-		if (!tmp)
+		size_t remaining = this->srcLength - this->currpos;
+		const char* tmp = static_cast<const char*>(memchr(cursor, character, remaining));
+		size_t res = (tmp ? tmp - cursor : remaining);
+		if (goAfter && res < remaining)
+		{
+			++res;
+		}
+		this->currpos += res;
+		return res + offset;
+	}
+
+	size_t XmlParser::readUntilFirstNotOf(const char* characters, size_t offset)
+	{
+		bool accepted[256] = {};
+		for (const char* c = characters; *c; ++c)
 		{
-			tmp = this->srcText + this->srcLength;
+			accepted[static_cast<unsigned char>(*c)] = true;
 		}
-		res = tmp - cursor;
-		if (goAfter)
+
+		if (offset > 0)
+		{
+			offset = this->readChars(offset);
+		}
+		const unsigned char* cursor = reinterpret_cast<const unsigned char*>(this->srcText + this->currpos);
+		size_t remaining = this->srcLength - this->currpos;
+		size_t res = 0;
+		while (res < remaining && accepted[cursor[res]])
 		{
 			++res;
-			if (this->currpos + res > this->srcLength)
-			{
-				res = this->srcLength - this->currpos;
-			}
 		}
 		this->currpos += res;
 		return res + offset;
 	}
 
-	size_t XmlParser::readUntilFirstNotOf(const char* characters, size_t offset)
+	size_t XmlParser::readUntilFirstNotOf(XmlCharClasses classes, size_t offset)
 	{
 		if (offset > 0)
 		{
 			offset = this->readChars(offset);
 		}
-		size_t res = strspn(this->srcText + this->currpos, characters);
+		const unsigned char* cursor = reinterpret_cast<const unsigned char*>(this->srcText + this->currpos);
+		size_t remaining = this->srcLength - this->currpos;
+		size_t res = 0;
+		while (res < remaining && (XML_CHAR_CLASSES[cursor[res]] & classes))
+		{
+			++res;
+		}
 		this->currpos += res;
 		return res + offset;
 	}
 
+	size_t XmlParser::findString(size_t from, const char* str, size_t length) const
+	{
+		// memchr finds the candidates, each one is compared once: O(n * length) with length bounded by the delimiters, and never past srcLength.
+		while (length > 0 && from + length <= this->srcLength)
+		{
+			const char* candidate = static_cast<const char*>(memchr(this->srcText + from, str[0], this->srcLength - from - length + 1));
+			if (candidate == NULL)
+			{
+				break;
+			}
+
+			from = candidate - this->srcText;
+			if (!memcmp(candidate, str, length))
+			{
+				return from;
+			}
+			++from;
+		}
+		return this->srcLength;
+	}
+
 	size_t XmlParser::readUntil(const char* delimiter, size_t offset, bool goAfter, std::string skipDelimiter)
 	{
-		size_t res = 0;
 		if (offset > 0)
 		{
 			offset = this->readChars(offset);
 		}
-		const char* cursor = this->srcText + this->currpos;
+		size_t delimiterLength = strlen(delimiter);
+		size_t end = this->srcLength;
 		if (skipDelimiter.length() > 0)
 		{
+			// Nested segments: one forward walk, every position is looked at once whatever the nesting.
 			size_t lvl = 0;
-			const char* beg;
-			const char* end;
-			do
+			for (size_t i = this->currpos; i < this->srcLength; ++i)
 			{
-				end = strstr(cursor, delimiter);
-				beg = strstr(cursor, skipDelimiter.c_str());
-				if (beg != NULL && beg < end)
+				size_t remaining = this->srcLength - i;
+				if (remaining >= skipDelimiter.length() && !memcmp(this->srcText + i, skipDelimiter.data(), skipDelimiter.length()))
 				{
 					++lvl;
-					cursor = beg + 1;
 				}
-				else if (end != NULL && lvl > 0)
+				else if (remaining >= delimiterLength && !memcmp(this->srcText + i, delimiter, delimiterLength))
 				{
+					// The delimiter closing the outermost segment ends the read.
+					if (lvl <= 1)
+					{
+						end = i;
+						break;
+					}
 					--lvl;
-					cursor = end + 1;
 				}
-			} while (lvl > 0);
-			if (!end)
-			{
-				end = this->srcText + this->srcLength;
 			}
-			res = end - (this->srcText + this->currpos);
-			if (goAfter)
-			{
-				res += strlen(delimiter);
-			}
-			this->currpos += res;
 		}
 		else
 		{
-			const char* end = strstr(cursor, delimiter);
-			if (!end)
-			{
-				end = this->srcText + this->srcLength;
-			}
-			res = end - cursor;
-			if (goAfter)
-			{
-				res += strlen(delimiter);
-			}
-			this->currpos += res;
+			end = this->findString(this->currpos, delimiter, delimiterLength);
+		}
+
+		// An unterminated segment ends with the stream.
+		size_t res = end - this->currpos;
+		if (goAfter && end < this->srcLength)
+		{
+			res += delimiterLength;
 		}
+		this->currpos += res;
 		return res + offset;
 	}
 
@@ -527,7 +741,7 @@ namespace QuickXml
 		const char* cursor = this->srcText + this->currpos;
 		bool continueloop = true;
 
-		if (cursor[2] == '[')
+		if (this->lookingAt("<![", 3))
 		{
 			res += this->readChars(3);
 		}
@@ -537,9 +751,14 @@ namespace QuickXml
 		}
 		while (continueloop)
 		{
-			res += this->readUntilFirstOf("[>\"'", 0, false);
+			// Every step moves forward: the declaration is read in a single pass.
+			res += this->readUntilFirstOf(static_cast<XmlCharClasses>(CharDeclarationStop), 0, false);
 			cursor = this->srcText + this->currpos;
-			if (cursor[0] == '\"')
+			if (this->currpos >= this->srcLength)
+			{
+				continueloop = false;
+			}
+			else if (cursor[0] == '\"')
 			{
 				res += this->readUntil("\"", 1, true);
 			}
@@ -0,0 +1,230 @@
+#include "XmlPerfCounters.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+std::atomic<bool> XmlPerfCounters::enabled(false);
+std::atomic<XmlCounterThread*> XmlPerfCounters::threads(NULL);
+
+static const char* const XML_COUNTER_PHASE_NAMES[CounterPhaseCount] = { "preprocess", "lex+format", "postprocess" };
+
+XmlCounterValues& XmlCounterValues::operator+=(const XmlCounterValues& other)
+{
+	for (int i = 0; i < CounterEventCount; ++i)
+	{
+		this->values[i] += other.values[i];
+		this->available[i] = this->available[i] || other.available[i];
+	}
+	return *this;
+}
+
+#if defined(__linux__)
+// Open a counter of the calling thread, user space only, in the group of given leader (-1 for a new group). Returns -1 on errors, with errno set.
+static int openCounter(uint64_t config, int groupFd)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+#endif
+
+XmlCounterThread* XmlPerfCounters::local()
+{
+	// Threads are owned by the list once registered, the file counts are reported after the threads are joined. The counters stop with their thread, and are closed at exit.
+	thread_local XmlCounterThread* thread = NULL;
+	if (thread != NULL)
+	{
+		return (thread->groupSize > 0 ? thread : NULL);
+	}
+
+	thread = new XmlCounterThread();
+#if defined(__linux__)
+	// The events are read at once as a group, led by the first one the CPU provides.
+	static const uint64_t configs[CounterEventCount] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES };
+	int leaderFd = -1;
+	for (int i = 0; i < CounterEventCount; ++i)
+	{
+		thread->fds[i] = openCounter(configs[i], leaderFd);
+		if (thread->fds[i] >= 0)
+		{
+			leaderFd = (leaderFd >= 0 ? leaderFd : thread->fds[i]);
+			thread->slots[i] = thread->groupSize++;
+		}
+	}
+#endif
+
+	thread->next = threads.load(std::memory_order_relaxed);
+	while (!threads.compare_exchange_weak(thread->next, thread, std::memory_order_release, std::memory_order_relaxed))
+	{
+	}
+	return (thread->groupSize > 0 ? thread : NULL);
+}
+
+bool XmlPerfCounters::start(std::string& message)
+{
+	enabled.store(true, std::memory_order_relaxed);
+	XmlCounterValues values;
+	if (!read(values))
+	{
+		enabled.store(false, std::memory_order_relaxed);
+#if defined(__linux__)
+		message = std::string("perf_event_open failed: ") + strerror(errno) + " (see /proc/sys/kernel/perf_event_paranoid)";
+#else
+		message = "hardware counters are only supported on Linux";
+#endif
+		return false;
+	}
+
+	std::atexit(&XmlPerfCounters::reportAtExit);
+	return true;
+}
+
+bool XmlPerfCounters::read(XmlCounterValues& values)
+{
+	XmlCounterThread* thread = local();
+	if (thread == NULL)
+	{
+		return false;
+	}
+
+#if defined(__linux__)
+	// Group read: the number of events, the enabled and running times, then the counts in opening order.
+	uint64_t buffer[3 + CounterEventCount];
+	int leader = 0;
+	while (thread->slots[leader] < 0)
+	{
+		++leader;
+	}
+	ssize_t size = ::read(thread->fds[leader], buffer, sizeof(buffer));
+	if (size < static_cast<ssize_t>((3 + thread->groupSize) * sizeof(uint64_t)))
+	{
+		return false;
+	}
+
+	// Counts are scaled when the kernel multiplexed the counters.
+	double scale = (buffer[2] > 0 && buffer[2] < buffer[1] ? static_cast<double>(buffer[1]) / buffer[2] : 1.0);
+	for (int i = 0; i < CounterEventCount; ++i)
+	{
+		values.available[i] = (thread->slots[i] >= 0);
+		values.values[i] = (values.available[i] ? static_cast<uint64_t>(buffer[3 + thread->slots[i]] * scale) : 0);
+	}
+	return true;
+#else
+	(void)values;
+	return false;
+#endif
+}
+
+void XmlPerfCounters::addPhase(XmlCounterPhase phase, const XmlCounterValues& values)
+{
+	XmlCounterThread* thread = local();
+	if (thread != NULL)
+	{
+		thread->current[phase] += values;
+		thread->counted = true;
+	}
+}
+
+void XmlPerfCounters::endFile(const std::string& path)
+{
+	XmlCounterThread* thread = (isEnabled() ? local() : NULL);
+	if (thread == NULL || !thread->counted)
+	{
+		return;
+	}
+
+	XmlFileCounters file;
+	file.path = path;
+	std::copy(thread->current, thread->current + CounterPhaseCount, file.phases);
+	thread->files.push_back(file);
+	std::fill(thread->current, thread->current + CounterPhaseCount, XmlCounterValues());
+	thread->counted = false;
+}
+
+// Write the counts of a phase: every event, then the instructions per cycle.
+static void writeCounts(std::ostream& out, const XmlCounterValues& values)
+{
+	static const char* const names[CounterEventCount] = { "cycles", "instructions", "branch-misses", "llc-misses" };
+	for (int i = 0; i < CounterEventCount; ++i)
+	{
+		out << "  " << names[i] << "=";
+		if (values.available[i])
+		{
+			out << values.values[i];
+		}
+		else
+		{
+			out << "n/a";
+		}
+	}
+
+	if (values.available[CounterCycles] && values.available[CounterInstructions] && values.values[CounterCycles] > 0)
+	{
+		out << "  ipc=" << std::fixed << std::setprecision(2) << static_cast<double>(values.values[CounterInstructions]) / values.values[CounterCycles];
+		out << std::defaultfloat;
+	}
+}
+
+void XmlPerfCounters::report(std::ostream& out)
+{
+	std::vector<XmlFileCounters> files;
+	for (XmlCounterThread* thread = threads.load(std::memory_order_acquire); thread != NULL; thread = thread->next)
+	{
+		files.insert(files.end(), thread->files.begin(), thread->files.end());
+	}
+	std::sort(files.begin(), files.end(), [](const XmlFileCounters& a, const XmlFileCounters& b) { return a.path < b.path; });
+
+	XmlCounterValues totals[CounterPhaseCount];
+	out << "Counters of " << files.size() << " files:\n";
+	for (const XmlFileCounters& file : files)
+	{
+		for (int phase = 0; phase < CounterPhaseCount; ++phase)
+		{
+			out << file.path << "  " << XML_COUNTER_PHASE_NAMES[phase];
+			writeCounts(out, file.phases[phase]);
+			out << "\n";
+			totals[phase] += file.phases[phase];
+		}
+	}
+
+	for (int phase = 0; phase < CounterPhaseCount; ++phase)
+	{
+		out << "Total  " << XML_COUNTER_PHASE_NAMES[phase];
+		writeCounts(out, totals[phase]);
+		out << "\n";
+	}
+}
+
+void XmlPerfCounters::reportAtExit()
+{
+	enabled.store(false, std::memory_order_relaxed);
+	report(std::cerr);
+}
+
+XmlCounterScope::~XmlCounterScope()
+{
+	XmlCounterValues end;
+	if (this->counting && XmlPerfCounters::read(end))
+	{
+		for (int i = 0; i < CounterEventCount; ++i)
+		{
+			end.values[i] -= this->begin.values[i];
+		}
+		XmlPerfCounters::addPhase(this->phase, end);
+	}
+}
@@ -0,0 +1,427 @@
+#include "XmlPipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include "XmlTrace.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+// Number of files the reader asks the kernel to prefetch ahead of itself.
+#define XML_PIPELINE_READAHEAD_FILES 8
+
+// Number of jobs each queue can hold. The bytes budget is usually the tighter bound.
+#define XML_PIPELINE_QUEUE_CAPACITY 64
+
+// Nanoseconds of the steady clock.
+static uint64_t steadyNanoseconds()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+XmlPipeline::XmlPipeline(XmlJobProcessor& processor, size_t formatterThreads, size_t maxBytesInFlight) : processor(processor), formatterThreads(formatterThreads > 0 ? formatterThreads : 1), maxBytesInFlight(maxBytesInFlight), formatQueue(XML_PIPELINE_QUEUE_CAPACITY), writeQueue(XML_PIPELINE_QUEUE_CAPACITY), bytesInFlight(0), readerDone(false), activeFormatters(0), successCount(0), readTime(0), readerWaitTime(0), formatTime(0), formatterIdleTime(0), formatterWaitTime(0), bytesRead(0)
+{
+}
+
+XmlPipeline::~XmlPipeline()
+{
+}
+
+size_t XmlPipeline::run(const std::vector<std::filesystem::path>& files)
+{
+	this->bytesInFlight = 0;
+	this->readerDone = false;
+	this->activeFormatters = this->formatterThreads;
+	this->successCount = 0;
+	this->pendingJobs.clear();
+	this->nextIndex = 0;
+	this->readTime = 0;
+	this->readerWaitTime = 0;
+	this->formatTime = 0;
+	this->formatterIdleTime = 0;
+	this->formatterWaitTime = 0;
+	this->bytesRead = 0;
+	this->stats = XmlPipelineStats();
+	uint64_t begin = steadyNanoseconds();
+
+	std::vector<std::thread> threads;
+	threads.reserve(this->formatterThreads + 1);
+	threads.emplace_back(&XmlPipeline::readerLoop, this, std::cref(files));
+	for (size_t i = 0; i < this->formatterThreads; ++i)
+	{
+		threads.emplace_back(&XmlPipeline::formatterLoop, this);
+	}
+
+	// The calling thread is the writer.
+	this->writerLoop();
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	this->stats.wallTime = steadyNanoseconds() - begin;
+	this->stats.readTime = this->readTime;
+	this->stats.readerWaitTime = this->readerWaitTime;
+	this->stats.formatTime = this->formatTime;
+	this->stats.formatterIdleTime = this->formatterIdleTime;
+	this->stats.formatterWaitTime = this->formatterWaitTime;
+	this->stats.bytesRead = this->bytesRead;
+	return this->successCount;
+}
+
+void XmlPipeline::readerLoop(const std::vector<std::filesystem::path>& files)
+{
+	XmlTrace::setThreadName("reader");
+	XmlBackoff backoff;
+	size_t advised = 0;
+	uint64_t readNanoseconds = 0;
+	uint64_t pushNanoseconds = 0;
+	uint64_t bytes = 0;
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		// Keep the kernel read-ahead a few files in front of the reader.
+		while (advised < files.size() && advised <= i + XML_PIPELINE_READAHEAD_FILES)
+		{
+			adviseWillNeed(files[advised]);
+			++advised;
+		}
+
+		std::unique_ptr<XmlPipelineJob> job = std::make_unique<XmlPipelineJob>();
+		job->index = i;
+		job->path = files[i];
+
+		std::error_code ec;
+		uintmax_t size = std::filesystem::file_size(files[i], ec);
+		if (ec)
+		{
+			size = 0;
+		}
+
+		// Backpressure: wait until the file fits in the budget. A file is always accepted when nothing is in flight, whatever its size.
+		while (this->bytesInFlight.load(std::memory_order_acquire) > 0 && this->bytesInFlight.load(std::memory_order_acquire) + size > this->maxBytesInFlight)
+		{
+			backoff.pause();
+		}
+		backoff.reset();
+
+		uint64_t readBegin = steadyNanoseconds();
+		try
+		{
+			job->input = readWholeFile(job->path);
+		}
+		catch (const std::exception& e)
+		{
+			job->failed = true;
+			job->message = e.what();
+		}
+		readNanoseconds += steadyNanoseconds() - readBegin;
+		bytes += job->input.length();
+
+		job->bytesReserved = job->input.length();
+		this->bytesInFlight += job->bytesReserved;
+		pushNanoseconds += pushJob(this->formatQueue, job);
+	}
+
+	this->readTime += readNanoseconds;
+	this->readerWaitTime += backoff.getWaitedTime() + pushNanoseconds;
+	this->bytesRead += bytes;
+	this->readerDone.store(true, std::memory_order_release);
+}
+
+void XmlPipeline::formatterLoop()
+{
+	XmlTrace::setThreadName("formatter");
+	XmlBackoff backoff;
+	std::unique_ptr<XmlPipelineJob> job;
+	uint64_t processNanoseconds = 0;
+	uint64_t pushNanoseconds = 0;
+
+	for (;;)
+	{
+		// Read the flag before popping: once the reader is done, an empty queue means there is no more work.
+		bool done = this->readerDone.load(std::memory_order_acquire);
+		if (!this->formatQueue.tryPop(job))
+		{
+			if (done)
+			{
+				break;
+			}
+			backoff.pause();
+			continue;
+		}
+		backoff.reset();
+
+		uint64_t processBegin = steadyNanoseconds();
+		if (!job->failed)
+		{
+			try
+			{
+				this->processor.process(*job);
+			}
+			catch (const std::exception& e)
+			{
+				job->failed = true;
+				job->message = e.what();
+			}
+		}
+		processNanoseconds += steadyNanoseconds() - processBegin;
+
+		job->bytesReserved += job->output.length();
+		this->bytesInFlight += job->output.length();
+		pushNanoseconds += pushJob(this->writeQueue, job);
+	}
+
+	backoff.reset();
+	this->formatTime += processNanoseconds;
+	this->formatterIdleTime += backoff.getWaitedTime();
+	this->formatterWaitTime += pushNanoseconds;
+	this->activeFormatters.fetch_sub(1, std::memory_order_release);
+}
+
+void XmlPipeline::writerLoop()
+{
+	XmlBackoff backoff;
+	std::unique_ptr<XmlPipelineJob> job;
+
+	for (;;)
+	{
+		bool done = (this->activeFormatters.load(std::memory_order_acquire) == 0);
+		if (!this->writeQueue.tryPop(job))
+		{
+			if (done)
+			{
+				break;
+			}
+			backoff.pause();
+			continue;
+		}
+		backoff.reset();
+
+		if (this->orderedOutput == NULL)
+		{
+			uint64_t writeBegin = steadyNanoseconds();
+			this->finishJob(job);
+			this->stats.writeTime += steadyNanoseconds() - writeBegin;
+			continue;
+		}
+
+		// Sequencer: a job waits for the ones before it, each complete prefix of the list is emitted at once.
+		size_t index = job->index;
+		this->pendingJobs[index] = std::move(job);
+		std::map<size_t, std::unique_ptr<XmlPipelineJob>>::iterator it;
+		uint64_t writeBegin = steadyNanoseconds();
+		while ((it = this->pendingJobs.find(this->nextIndex)) != this->pendingJobs.end())
+		{
+			this->finishJob(it->second);
+			this->pendingJobs.erase(it);
+			++this->nextIndex;
+		}
+		this->stats.writeTime += steadyNanoseconds() - writeBegin;
+	}
+
+	backoff.reset();
+	this->stats.writerIdleTime = backoff.getWaitedTime();
+
+	if (this->orderedOutput != NULL)
+	{
+		this->orderedOutput->flush();
+	}
+}
+
+void XmlPipeline::finishJob(std::unique_ptr<XmlPipelineJob>& job)
+{
+	if (!job->failed && this->orderedOutput != NULL)
+	{
+		// Unchanged files have no output, their content is the input.
+		const std::string& content = (job->writeOutput ? job->output : job->input);
+		std::string path = (XmlTrace::isEnabled() ? job->path.string() : std::string());
+		XmlTraceScope trace("write", &path);
+		this->orderedOutput->write(content.data(), content.length());
+	}
+	else if (!job->failed && (job->writeOutput || !this->mirrorOutput.empty()))
+	{
+		try
+		{
+			std::filesystem::path outputPath = (this->mirrorOutput.empty() ? job->path : mirrorPath(job->path, this->mirrorInput, this->mirrorOutput));
+			if (job->writeOutput)
+			{
+				writeWholeFile(outputPath, job->output);
+			}
+			else
+			{
+				copyWholeFile(job->path, outputPath);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			job->failed = true;
+			job->message = e.what();
+		}
+	}
+
+	if (job->failed)
+	{
+		std::cerr << "Error processing " << job->path.string() << ": " << job->message << std::endl;
+	}
+	else
+	{
+		if (this->orderedOutput == NULL && !this->quiet)
+		{
+			std::cout << job->message << std::endl;
+		}
+		++this->successCount;
+	}
+
+	this->bytesInFlight -= job->bytesReserved;
+	job.reset();
+}
+
+uint64_t XmlPipeline::pushJob(XmlBoundedQueue<std::unique_ptr<XmlPipelineJob>>& queue, std::unique_ptr<XmlPipelineJob>& job)
+{
+	XmlBackoff backoff;
+	while (!queue.tryPush(job))
+	{
+		backoff.pause();
+	}
+	backoff.reset();
+	return backoff.getWaitedTime();
+}
+
+void XmlPipeline::adviseWillNeed(const std::filesystem::path& path)
+{
+#if defined(__linux__)
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd >= 0)
+	{
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+#else
+	(void)path;
+#endif
+}
+
+std::string XmlPipeline::readWholeFile(const std::filesystem::path& path)
+{
+	std::string pathString = (XmlTrace::isEnabled() ? path.string() : std::string());
+	XmlTraceScope trace("read", &pathString);
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Cannot open input file: " + path.string());
+	}
+
+	std::string content;
+	content.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(&content[0], content.length());
+	if (static_cast<size_t>(file.gcount()) != content.length())
+	{
+		throw std::runtime_error("Cannot read input file: " + path.string());
+	}
+	return content;
+}
+
+void XmlPipeline::writeWholeFile(const std::filesystem::path& path, const std::string& content)
+{
+	std::string pathString = (XmlTrace::isEnabled() ? path.string() : std::string());
+	XmlTraceScope trace("write", &pathString);
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Cannot open output file: " + path.string());
+	}
+
+	file.write(content.data(), content.length());
+	if (!file.good())
+	{
+		throw std::runtime_error("Cannot write output file: " + path.string());
+	}
+}
+
+void XmlPipeline::copyWholeFile(const std::filesystem::path& from, const std::filesystem::path& to)
+{
+	std::string pathString = (XmlTrace::isEnabled() ? from.string() : std::string());
+	XmlTraceScope trace("copy", &pathString);
+#if defined(__linux__)
+	int in = open(from.c_str(), O_RDONLY);
+	if (in < 0)
+	{
+		throw std::runtime_error("Cannot open input file: " + from.string());
+	}
+	int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out < 0)
+	{
+		close(in);
+		throw std::runtime_error("Cannot open output file: " + to.string());
+	}
+
+	// A reflink shares the extents (btrfs, XFS), else copy_file_range copies in the kernel, server-side on network filesystems.
+	bool copied = (ioctl(out, FICLONE, in) == 0);
+	while (!copied)
+	{
+		ssize_t res = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+		if (res == 0)
+		{
+			copied = true;
+		}
+		else if (res < 0)
+		{
+			break;
+		}
+	}
+	close(in);
+	close(out);
+	if (copied)
+	{
+		return;
+	}
+	// Filesystems without copy_file_range: the library copy.
+#endif
+
+	std::error_code ec;
+	if (!std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, ec))
+	{
+		throw std::runtime_error("Cannot copy " + from.string() + " to " + to.string() + ": " + ec.message());
+	}
+}
+
+std::filesystem::path XmlPipeline::mirrorPath(const std::filesystem::path& path, const std::filesystem::path& inputRoot, const std::filesystem::path& outputRoot)
+{
+	return outputRoot / path.lexically_relative(inputRoot);
+}
+
+void XmlPipeline::createMirrorDirectories(const std::vector<std::filesystem::path>& files, const std::filesystem::path& inputRoot, const std::filesystem::path& outputRoot)
+{
+	// Sorted, a directory comes after its parent and the files of a directory share one entry.
+	std::vector<std::filesystem::path> directories;
+	directories.reserve(files.size());
+	for (const std::filesystem::path& file : files)
+	{
+		directories.push_back(mirrorPath(file, inputRoot, outputRoot).parent_path());
+	}
+	std::sort(directories.begin(), directories.end());
+	directories.erase(std::unique(directories.begin(), directories.end()), directories.end());
+
+	std::filesystem::create_directories(outputRoot);
+	for (const std::filesystem::path& directory : directories)
+	{
+		// Parents outside the file list (directories without XML files) are created with the first child.
+		std::error_code ec;
+		if (!std::filesystem::create_directory(directory, ec) && ec)
+		{
+			std::filesystem::create_directories(directory);
+		}
+	}
+}
@@ -0,0 +1,293 @@
+#include "XmlRecordSplitter.h"
+
+#include <iostream>
+#include <memory_resource>
+#include <stdexcept>
+#include <thread>
+
+#include "XmlParser.h"
+#include "XmlTrace.h"
+
+// Move an offset back over the indentation before it, when only indentation precedes it on its line.
+static size_t indentationBegin(const char* data, size_t pos)
+{
+	size_t begin = pos;
+	while (begin > 0 && (data[begin - 1] == ' ' || data[begin - 1] == '\t'))
+	{
+		--begin;
+	}
+	return ((begin == 0 || data[begin - 1] == '\n' || data[begin - 1] == '\r') ? begin : pos);
+}
+
+bool XmlRecordSplitter::sameAncestors(const std::vector<OpenElement>& elements, size_t count, const std::vector<size_t>& ancestors)
+{
+	if (count != ancestors.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (elements[i].begin != ancestors[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+XmlRecordSplitter::XmlRecordSplitter(const std::string& spec, XmlJobProcessor* processor, size_t writerThreads, size_t maxBytesInFlight) : absolute(!spec.empty() && spec[0] == '/'), processor(processor), writerThreads(writerThreads > 0 ? writerThreads : 1), maxBytesInFlight(maxBytesInFlight), queue(XML_RECORD_SPLITTER_QUEUE_CAPACITY), bytesInFlight(0), lexerDone(false), failedCount(0)
+{
+	size_t begin = (this->absolute ? 1 : 0);
+	while (begin <= spec.length())
+	{
+		size_t end = spec.find('/', begin);
+		if (end == std::string::npos)
+		{
+			end = spec.length();
+		}
+		if (end == begin)
+		{
+			throw std::runtime_error("Invalid record path: " + spec);
+		}
+		this->path.push_back(spec.substr(begin, end - begin));
+		begin = end + 1;
+	}
+}
+
+bool XmlRecordSplitter::isRecord(const std::vector<OpenElement>& elements) const
+{
+	// Absolute paths match from the root, relative ones (and single names) match the innermost elements.
+	if (elements.size() < this->path.size() || (this->absolute && elements.size() != this->path.size()))
+	{
+		return false;
+	}
+
+	size_t offset = elements.size() - this->path.size();
+	for (size_t i = 0; i < this->path.size(); ++i)
+	{
+		if (elements[offset + i].name != this->path[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void XmlRecordSplitter::pushPart(const std::filesystem::path& outputPath, std::string& content)
+{
+	std::unique_ptr<XmlPipelineJob> job = std::make_unique<XmlPipelineJob>();
+	job->index = this->partCount++;
+	job->path = outputPath;
+	job->input.swap(content);
+
+	// The formatted copy counts in the budget too. A part larger than the budget goes through alone.
+	job->bytesReserved = job->input.length() * (this->processor != NULL ? 2 : 1);
+	XmlBackoff backoff;
+	while (this->bytesInFlight.load(std::memory_order_acquire) > 0 && this->bytesInFlight.load(std::memory_order_acquire) + job->bytesReserved > this->maxBytesInFlight)
+	{
+		backoff.pause();
+	}
+	this->bytesInFlight += job->bytesReserved;
+	while (!this->queue.tryPush(job))
+	{
+		backoff.pause();
+	}
+}
+
+void XmlRecordSplitter::writerLoop()
+{
+	XmlTrace::setThreadName("writer");
+	XmlBackoff backoff;
+	std::unique_ptr<XmlPipelineJob> job;
+
+	for (;;)
+	{
+		// Read the flag before popping: once the lexer is done, an empty queue means there is no more work.
+		bool done = this->lexerDone.load(std::memory_order_acquire);
+		if (!this->queue.tryPop(job))
+		{
+			if (done)
+			{
+				break;
+			}
+			backoff.pause();
+			continue;
+		}
+		backoff.reset();
+
+		if (this->processor != NULL)
+		{
+			try
+			{
+				this->processor->process(*job);
+			}
+			catch (const std::exception& e)
+			{
+				job->failed = true;
+				job->message = e.what();
+			}
+		}
+
+		// Parts failing processing are written as found: their records must not be lost.
+		std::string status;
+		if (job->failed)
+		{
+			status = "Error: " + job->message + " (" + job->path.string() + " written as found)\n";
+		}
+		try
+		{
+			XmlPipeline::writeWholeFile(job->path, (job->writeOutput ? job->output : job->input));
+		}
+		catch (const std::exception& e)
+		{
+			job->failed = true;
+			status = std::string("Error: ") + e.what() + "\n";
+		}
+		if (job->failed)
+		{
+			++this->failedCount;
+			std::cerr << status;
+		}
+
+		this->bytesInFlight -= job->bytesReserved;
+		job.reset();
+	}
+}
+
+bool XmlRecordSplitter::run(const char* data, size_t length, const std::filesystem::path& outputDirectory, const std::string& baseName, size_t recordsPerFile)
+{
+	this->lexerDone = false;
+	this->recordCount = 0;
+	this->partCount = 0;
+	std::vector<std::thread> writers;
+	for (size_t i = 0; i < this->writerThreads; ++i)
+	{
+		writers.emplace_back(&XmlRecordSplitter::writerLoop, this);
+	}
+
+	// The parser of a whole document keeps no more than the open elements, its memory is released as it goes.
+	QuickXml::XmlParser parser(data, length, std::pmr::new_delete_resource());
+	QuickXml::XmlToken token;
+	std::vector<OpenElement> elements;
+	std::string eol;
+	size_t prologEnd = std::string::npos;       // Offset of the root start tag: what precedes it is copied to every part.
+	size_t recordDepth = 0;                     // Number of open elements at the record being read (0: outside records).
+	size_t recordBegin = 0;
+	std::string part;
+	std::string closing;                        // End tags of the ancestors of the first record of the part.
+	std::vector<size_t> ancestors;              // Offsets of the start tags of those ancestors.
+	size_t partRecords = 0;
+
+	// Part file names are numbered from 1.
+	auto partPath = [&](size_t index) -> std::filesystem::path
+	{
+		std::string number = std::to_string(index + 1);
+		if (number.length() < XML_RECORD_SPLITTER_PART_DIGITS)
+		{
+			number.insert(0, XML_RECORD_SPLITTER_PART_DIGITS - number.length(), '0');
+		}
+		return outputDirectory / (baseName + "-" + number + ".xml");
+	};
+
+	while (parser.lexNext(token, false) && token.type != QuickXml::XmlTokenType::EndOfFile)
+	{
+		switch (token.type)
+		{
+			case QuickXml::XmlTokenType::TagOpening:
+				if (prologEnd == std::string::npos)
+				{
+					prologEnd = indentationBegin(data, token.pos);
+				}
+				elements.push_back({ std::string_view(token.chars + 1, token.size - 1), token.pos, 0 });
+				if (recordDepth == 0 && this->isRecord(elements))
+				{
+					recordDepth = elements.size();
+					recordBegin = indentationBegin(data, token.pos);
+				}
+				break;
+
+			case QuickXml::XmlTokenType::TagOpeningEnd:
+				if (!elements.empty())
+				{
+					elements.back().end = token.pos + token.size;
+				}
+				break;
+
+			case QuickXml::XmlTokenType::LineBreak:
+				if (eol.empty())
+				{
+					eol.assign(token.chars, token.size);
+				}
+				break;
+
+			case QuickXml::XmlTokenType::TagClosingEnd:
+			case QuickXml::XmlTokenType::TagSelfClosingEnd:
+				if (recordDepth != 0 && elements.size() == recordDepth)
+				{
+					// Records of a part share their ancestors: a record under other ones ends the part.
+					if (partRecords > 0 && !XmlRecordSplitter::sameAncestors(elements, recordDepth - 1, ancestors))
+					{
+						part += closing;
+						this->pushPart(partPath(this->partCount), part);
+						partRecords = 0;
+					}
+
+					// The record ends: a new part starts with the ancestors of its first record.
+					if (partRecords == 0)
+					{
+						if (eol.empty())
+						{
+							eol = "\n";
+						}
+						part.assign(data, prologEnd);
+						closing.clear();
+						ancestors.clear();
+						for (size_t i = 0; i + 1 < recordDepth; ++i)
+						{
+							ancestors.push_back(elements[i].begin);
+							size_t begin = indentationBegin(data, elements[i].begin);
+							part.append(data + begin, elements[i].end - begin);
+							part += eol;
+							closing.insert(0, std::string(data + begin, elements[i].begin - begin) + "</" + std::string(elements[i].name) + ">" + eol);
+						}
+					}
+					part.append(data + recordBegin, token.pos + token.size - recordBegin);
+					part += eol;
+					recordDepth = 0;
+					++partRecords;
+					++this->recordCount;
+
+					if (partRecords == recordsPerFile)
+					{
+						part += closing;
+						this->pushPart(partPath(this->partCount), part);
+						partRecords = 0;
+					}
+				}
+				if (!elements.empty())
+				{
+					elements.pop_back();
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+	if (recordDepth != 0)
+	{
+		std::cerr << "Warning: The record at byte offset " << recordBegin << " is not closed, it is not written\n";
+	}
+	if (partRecords > 0)
+	{
+		part += closing;
+		this->pushPart(partPath(this->partCount), part);
+	}
+
+	this->lexerDone.store(true, std::memory_order_release);
+	for (std::thread& writer : writers)
+	{
+		writer.join();
+	}
+	return (this->failedCount.load() == 0);
+}
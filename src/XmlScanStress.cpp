@@ -0,0 +1,136 @@
+#include "XmlScanStress.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "XmlArena.h"
+#include "XmlCanonicalReader.h"
+#include "XmlIndenter.h"
+#include "XmlParser.h"
+#include "XmlStructureScanner.h"
+#include "XmlValidator.h"
+
+double XmlScanStress::timeInput(const std::string& input, bool& outOfBounds)
+{
+	double best = 0;
+	for (int run = 0; run < 3; ++run)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		{
+			QuickXml::XmlArenaScope arenaScope;
+
+			// Tokens must stay inside the input, whatever the input.
+			QuickXml::XmlParser parser(input.data(), input.length());
+			QuickXml::XmlToken token;
+			while ((token = parser.parseNext()).type != QuickXml::XmlTokenType::EndOfFile)
+			{
+				if (token.chars != NULL && (token.chars < input.data() || token.chars + token.size > input.data() + input.length()))
+				{
+					outOfBounds = true;
+				}
+			}
+		}
+
+		// Without a validator, the indent-only formatting copies the input (see XmlFormatter::indentLines).
+		QuickXml::XmlValidator validator;
+		XmlIndenter indenter(input, "\t", "\n", true, true);
+		indenter.indentXML();
+		indenter.setValidator(&validator);
+		indenter.indentXML();
+		QuickXml::XmlCanonicalReader::fingerprint(input.data(), input.length());
+		QuickXml::XmlStructureScanner::lineRange(input.data(), input.length(), input.length() / 2, input.length() / 2 + 1);
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		best = (run == 0 ? seconds : std::min(best, seconds));
+	}
+	return best;
+}
+
+XmlScanStressResult XmlScanStress::measure(const std::string& name, const std::string& prefix, const std::string& unit, const std::string& suffix, size_t size)
+{
+	XmlScanStressResult res;
+	res.name = name;
+
+	std::string input = prefix;
+	while (input.length() < size)
+	{
+		input += unit;
+	}
+	std::string large = prefix;
+	for (int i = 0; i < 4; ++i)
+	{
+		large.append(input, prefix.length(), std::string::npos);
+	}
+	input += suffix;
+	large += suffix;
+
+	res.smallSize = input.length();
+	res.largeSize = large.length();
+	res.smallSeconds = timeInput(input, res.outOfBounds);
+	res.largeSeconds = timeInput(large, res.outOfBounds);
+
+	res.superLinear = (res.largeSeconds > MIN_REPORTED_SECONDS && res.largeSeconds > res.smallSeconds * MAX_GROWTH);
+
+	// A candidate is timed again before being reported: a single slow run (another process, a page fault storm) must not fail a CI gate.
+	if (res.superLinear)
+	{
+		res.smallSeconds = std::min(res.smallSeconds, timeInput(input, res.outOfBounds));
+		res.largeSeconds = std::min(res.largeSeconds, timeInput(large, res.outOfBounds));
+		res.superLinear = (res.largeSeconds > MIN_REPORTED_SECONDS && res.largeSeconds > res.smallSeconds * MAX_GROWTH);
+	}
+	return res;
+}
+
+std::vector<XmlScanStressResult> XmlScanStress::benchmark(size_t size)
+{
+	std::vector<XmlScanStressResult> res;
+	res.push_back(measure("unterminated comments", "<a>", "<!--", "", size));
+	res.push_back(measure("unterminated comment with dashes", "<a><!--", "-- - ->", "", size));
+	res.push_back(measure("unterminated CDATA sections", "<a>", "<![CDATA[", "", size));
+	res.push_back(measure("unterminated CDATA with brackets", "<a><![CDATA[", "]] ]>", "", size));
+	res.push_back(measure("unterminated instructions", "<a>", "<?", "", size));
+	res.push_back(measure("unterminated declarations", "<a>", "<![", "", size));
+	res.push_back(measure("declaration quotes", "<!DOCTYPE a [", "\"x' ", "", size));
+	res.push_back(measure("unterminated attribute values", "<a>", "<b c=\"", "", size));
+	res.push_back(measure("unquoted attribute values", "<a", " b= c", ">", size));
+	res.push_back(measure("deep nesting", "", "<a>", "", size));
+	res.push_back(measure("unbalanced closing tags", "<a>", "</a>", "", size));
+	res.push_back(measure("self-closing tags", "<a>", "<b/>", "</a>", size));
+	res.push_back(measure("single-line comments", "<a>", "<!--  x  -->", "</a>", size));
+	res.push_back(measure("Mac line endings", "<a>", "<b>\r", "</a>", size));
+	res.push_back(measure("preserved space", "<a xml:space=\"preserve\">", "<b xml:space=\"default\"> ", "</a>", size));
+	return res;
+}
+
+std::vector<XmlScanStressResult> XmlScanStress::fuzz(size_t iterations, size_t size, uint64_t seed)
+{
+	static const char* fragments[] = { "<", "</", ">", "/>", "<!--", "-->", "-", "<![CDATA[", "]]>", "]", "[", "<?", "?>", "<%", "%>", "<!", "<!DOCTYPE ", "\"", "'", "=", " ", "\t", "\n", "\r", "a", "b:c", "xml:space=\"preserve\"", "&amp;" };
+	const size_t fragmentCount = sizeof(fragments) / sizeof(fragments[0]);
+
+	std::vector<XmlScanStressResult> failures;
+	for (size_t i = 0; i < iterations; ++i)
+	{
+		// A random unit, repeated up to the size: its growth exposes the scans that restart from the same place.
+		std::mt19937_64 random(seed + i);
+		std::string unit;
+		size_t unitFragments = 1 + random() % 16;
+		for (size_t j = 0; j < unitFragments; ++j)
+		{
+			unit += fragments[random() % fragmentCount];
+		}
+		std::string prefix;
+		size_t prefixFragments = random() % 8;
+		for (size_t j = 0; j < prefixFragments; ++j)
+		{
+			prefix += fragments[random() % fragmentCount];
+		}
+
+		XmlScanStressResult res = measure("seed " + std::to_string(seed + i), prefix, unit, "", size);
+		if (res.superLinear || res.outOfBounds)
+		{
+			failures.push_back(res);
+		}
+	}
+	return failures;
+}
@@ -0,0 +1,71 @@
+#include "XmlSlowCapture.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "XmlHash.h"
+
+std::atomic<bool> XmlSlowCapture::enabled(false);
+std::filesystem::path XmlSlowCapture::directory;
+double XmlSlowCapture::thresholdNanosecondsPerByte = 0;
+size_t XmlSlowCapture::maxBytes = 0;
+std::string XmlSlowCapture::options;
+std::atomic<size_t> XmlSlowCapture::capturedCount(0);
+
+void XmlSlowCapture::start(const std::filesystem::path& directory, double thresholdNanosecondsPerByte, size_t maxBytes, const std::string& options)
+{
+	std::filesystem::create_directories(directory);
+	XmlSlowCapture::directory = directory;
+	XmlSlowCapture::thresholdNanosecondsPerByte = thresholdNanosecondsPerByte;
+	XmlSlowCapture::maxBytes = maxBytes;
+	XmlSlowCapture::options = options;
+
+	// Phase durations come from the trace scopes.
+	XmlTrace::startPhaseTimes();
+	enabled.store(true, std::memory_order_relaxed);
+}
+
+bool XmlSlowCapture::check(const std::string& path, const std::string& content, uint64_t elapsed, const std::vector<XmlTracePhaseTime>& phases)
+{
+	double nanosecondsPerByte = static_cast<double>(elapsed) / std::max<size_t>(content.length(), 1);
+	if (elapsed < XML_SLOW_CAPTURE_MIN_NANOSECONDS || nanosecondsPerByte <= thresholdNanosecondsPerByte)
+	{
+		return false;
+	}
+
+	// Named after the content, so captures of the same input from several runs overwrite each other.
+	std::string fileName = std::filesystem::path(path).filename().string();
+	std::string name = QuickXml::XmlHasher::toHex(QuickXml::XmlHasher::hash(content.data(), content.length())) + "-" + (fileName.empty() ? std::string("input") : fileName);
+	std::filesystem::path inputPath = directory / name;
+	std::filesystem::path reportPath = directory / (name + ".txt");
+	size_t capturedBytes = (maxBytes > 0 && maxBytes < content.length() ? maxBytes : content.length());
+
+	std::ostringstream report;
+	report << std::fixed << std::setprecision(3);
+	report << "Source: " << path << "\n";
+	report << "Size: " << content.length() << " bytes (captured: " << capturedBytes << " bytes)\n";
+	report << "Time: " << (elapsed / 1e6) << " ms (" << nanosecondsPerByte << " ns/byte, threshold " << thresholdNanosecondsPerByte << " ns/byte)\n";
+	for (const XmlTracePhaseTime& phase : phases)
+	{
+		report << "Phase " << phase.name << ": " << (phase.duration / 1e6) << " ms\n";
+	}
+	report << "Options: " << options << "\n";
+	std::string reportText = report.str();
+
+	std::ofstream inputFile(inputPath, std::ios::binary);
+	inputFile.write(content.data(), capturedBytes);
+	std::ofstream reportFile(reportPath, std::ios::binary);
+	reportFile.write(reportText.data(), reportText.length());
+	if (!inputFile.good() || !reportFile.good())
+	{
+		std::cerr << "Error: Cannot write capture of " << path << " to " << directory.string() << std::endl;
+		return false;
+	}
+
+	std::cerr << "Slow: " << path << " (" << std::fixed << std::setprecision(1) << nanosecondsPerByte << " ns/byte), captured as " << inputPath.string() << std::endl;
+	++capturedCount;
+	return true;
+}
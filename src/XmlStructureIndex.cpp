@@ -0,0 +1,486 @@
+#include "XmlStructureIndex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "XmlHash.h"
+#include "XmlParser.h"
+
+namespace QuickXml
+{
+	static const char XML_INDEX_MAGIC[8] = { 'X', 'C', 'I', 'D', 'X', '\0', '\r', '\n' };
+	static const uint64_t XML_INDEX_VERSION = 2;
+
+	// Bytes hashed at each end of a document to identify its content. Hashing it whole would cost as much as the scan the index avoids.
+	static const size_t XML_INDEX_HASHED_BYTES = 65536;
+
+	// Find the first line break char from given offset. Returns the length when not found.
+	static size_t findLineBreak(const char* data, size_t length, size_t from)
+	{
+		while (from < length && data[from] != '\n' && data[from] != '\r')
+		{
+			++from;
+		}
+		return from;
+	}
+
+	// Get the start of the line following the line break at given offset. "\r\n", lone "\r" and lone "\n" all count as one line break.
+	static size_t nextLineStart(const char* data, size_t length, size_t lineBreak)
+	{
+		return (data[lineBreak] == '\r' && lineBreak + 1 < length && data[lineBreak + 1] == '\n' ? lineBreak + 2 : lineBreak + 1);
+	}
+
+	// Count the lines starting in (from, to], from a position whose line and line start are known.
+	static void advanceLines(const char* data, size_t length, size_t from, size_t to, uint64_t& line, uint64_t& lineBegin)
+	{
+		for (size_t i = findLineBreak(data, length, from); i < to; i = findLineBreak(data, length, i))
+		{
+			size_t start = nextLineStart(data, length, i);
+			if (start > to)
+			{
+				break;
+			}
+			++line;
+			lineBegin = start;
+			i = start;
+		}
+	}
+
+	// Check that xml:space switches are increasing depths below given depth.
+	static bool validSpaceSwitches(const uint64_t* switches, uint64_t count, uint64_t depth)
+	{
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			if (switches[i] >= depth || (i > 0 && switches[i] <= switches[i - 1]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	const XmlIndexCheckpoint& XmlStructureIndex::checkpointBefore(size_t offset) const
+	{
+		// The first checkpoint is at offset 0.
+		const XmlIndexCheckpoint* end = this->checkpoints + this->header.checkpointCount;
+		const XmlIndexCheckpoint* it = std::upper_bound(this->checkpoints, end, offset, [](size_t value, const XmlIndexCheckpoint& checkpoint) { return value < checkpoint.offset; });
+		return *(it - 1);
+	}
+
+	bool XmlStructureIndex::checkTables() const
+	{
+		if (this->header.checkpointCount == 0 || this->checkpoints[0].offset != 0 || this->nameOffsets[this->header.nameCount] > this->header.nameBytes)
+		{
+			return false;
+		}
+
+		for (uint64_t i = 0; i < this->header.checkpointCount; ++i)
+		{
+			const XmlIndexCheckpoint& checkpoint = this->checkpoints[i];
+			if ((checkpoint.element != XML_INDEX_NONE && checkpoint.element >= this->header.elementCount) || checkpoint.offset > this->header.source.size
+				|| (i > 0 && checkpoint.offset <= this->checkpoints[i - 1].offset))
+			{
+				return false;
+			}
+			if (checkpoint.depth != (checkpoint.element == XML_INDEX_NONE ? 0 : this->elements[checkpoint.element].depth + 1ULL))
+			{
+				return false;
+			}
+
+			// The xml:space states are increasing depths below the depth of their position.
+			if (checkpoint.spaceSwitches > this->header.spaceSwitchCount || checkpoint.spaceSwitchCount > this->header.spaceSwitchCount - checkpoint.spaceSwitches
+				|| checkpoint.lineStartSpaceSwitchCount > this->header.spaceSwitchCount - checkpoint.spaceSwitches - checkpoint.spaceSwitchCount
+				|| !validSpaceSwitches(this->spaceSwitches + checkpoint.spaceSwitches, checkpoint.spaceSwitchCount, checkpoint.depth)
+				|| !validSpaceSwitches(this->spaceSwitches + checkpoint.spaceSwitches + checkpoint.spaceSwitchCount, checkpoint.lineStartSpaceSwitchCount, checkpoint.lineStartDepth))
+			{
+				return false;
+			}
+		}
+
+		// Parents come first, so walking up the parent links always ends.
+		for (uint64_t i = 0; i < this->header.elementCount; ++i)
+		{
+			const XmlIndexElement& element = this->elements[i];
+			if ((element.parent != XML_INDEX_NONE && element.parent >= i) || element.name >= this->header.nameCount
+				|| element.depth != (element.parent == XML_INDEX_NONE ? 0 : this->elements[element.parent].depth + 1))
+			{
+				return false;
+			}
+		}
+
+		for (uint64_t i = 0; i < this->header.nameCount; ++i)
+		{
+			if (this->nameOffsets[i] > this->nameOffsets[i + 1])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void XmlStructureIndex::build(const char* data, size_t length, const XmlIndexSource& source)
+	{
+		this->mapping.close();
+		this->builtCheckpoints.clear();
+		this->builtElements.clear();
+		this->builtSpaceSwitches.clear();
+		this->builtNameOffsets.assign(1, 0);
+		this->builtNames.clear();
+
+		// An element open at a checkpoint is stored once, with its chain of ancestors.
+		struct OpenElement
+		{
+			size_t begin;
+			std::string_view name;
+			uint64_t element;
+		};
+		std::vector<OpenElement> stack;
+		std::unordered_map<std::string_view, uint32_t> nameIds;
+
+		// The first checkpoint is the start of the document (before its first construct, if any), so any query has a checkpoint before it.
+		uint64_t line = 1;
+		uint64_t lineBegin = 0;
+		size_t counted = 0;
+		size_t textBegin = 0;
+		size_t lineStart = 0;
+		size_t lineStartDepth = 0;
+		XmlSpaceSwitches switches;
+		XmlSpaceSwitches lineStartSwitches;
+		size_t nextCheckpoint = 0;
+
+		XmlStructureScanner scanner(data, length);
+		XmlStructureEvent event;
+		bool more = scanner.next(event);
+		while (true)
+		{
+			size_t offset = (more ? event.begin : length);
+			if (offset >= nextCheckpoint && (offset < length || this->builtCheckpoints.empty()))
+			{
+				size_t checkpointOffset = (this->builtCheckpoints.empty() ? 0 : offset);
+				advanceLines(data, length, counted, checkpointOffset, line, lineBegin);
+				counted = checkpointOffset;
+
+				for (size_t i = 0; i < stack.size(); ++i)
+				{
+					if (stack[i].element != XML_INDEX_NONE)
+					{
+						continue;
+					}
+
+					std::unordered_map<std::string_view, uint32_t>::iterator it = nameIds.find(stack[i].name);
+					if (it == nameIds.end())
+					{
+						it = nameIds.emplace(stack[i].name, static_cast<uint32_t>(nameIds.size())).first;
+						this->builtNames.append(stack[i].name);
+						this->builtNameOffsets.push_back(this->builtNames.length());
+					}
+
+					stack[i].element = this->builtElements.size();
+					this->builtElements.push_back({ stack[i].begin, XML_INDEX_NONE, (i > 0 ? stack[i - 1].element : XML_INDEX_NONE), it->second, static_cast<uint32_t>(i) });
+				}
+
+				this->builtCheckpoints.push_back({ checkpointOffset, line, lineBegin, stack.size(), (stack.empty() ? XML_INDEX_NONE : stack.back().element), textBegin, lineStart, lineStartDepth, this->builtSpaceSwitches.size(), switches.size(), lineStartSwitches.size() });
+				this->builtSpaceSwitches.insert(this->builtSpaceSwitches.end(), switches.begin(), switches.end());
+				this->builtSpaceSwitches.insert(this->builtSpaceSwitches.end(), lineStartSwitches.begin(), lineStartSwitches.end());
+				nextCheckpoint = checkpointOffset + XML_STRUCTURE_INDEX_INTERVAL;
+				if (checkpointOffset != offset)
+				{
+					continue;
+				}
+			}
+			if (!more)
+			{
+				break;
+			}
+
+			// Follow the lineRange scan, which only looks at the text between constructs for line starts.
+			for (size_t i = event.begin; i > textBegin; --i)
+			{
+				if (data[i - 1] == '\n' || data[i - 1] == '\r')
+				{
+					lineStart = i;
+					lineStartDepth = stack.size();
+					lineStartSwitches = switches;
+					break;
+				}
+			}
+
+			XmlStructureScanner::updateSpaceSwitches(switches, data, event, stack.size());
+			if (event.type == StructElementStart)
+			{
+				stack.push_back({ event.begin, event.name, XML_INDEX_NONE });
+			}
+			else if (event.type == StructElementEnd && !stack.empty())
+			{
+				if (stack.back().element != XML_INDEX_NONE)
+				{
+					this->builtElements[stack.back().element].close = event.end - 1;
+				}
+				stack.pop_back();
+			}
+			textBegin = event.end;
+			more = scanner.next(event);
+		}
+
+		this->header = {};
+		memcpy(this->header.magic, XML_INDEX_MAGIC, sizeof(XML_INDEX_MAGIC));
+		this->header.version = XML_INDEX_VERSION;
+		this->header.source = source;
+		this->header.checkpointCount = this->builtCheckpoints.size();
+		this->header.elementCount = this->builtElements.size();
+		this->header.spaceSwitchCount = this->builtSpaceSwitches.size();
+		this->header.nameCount = nameIds.size();
+		this->header.nameBytes = this->builtNames.length();
+		this->checkpoints = this->builtCheckpoints.data();
+		this->elements = this->builtElements.data();
+		this->spaceSwitches = this->builtSpaceSwitches.data();
+		this->nameOffsets = this->builtNameOffsets.data();
+		this->names = this->builtNames.data();
+	}
+
+	bool XmlStructureIndex::load(const std::filesystem::path& path, const XmlIndexSource& source)
+	{
+		this->header = {};
+		if (!this->mapping.open(path) || this->mapping.getLength() < sizeof(XmlIndexHeader))
+		{
+			this->mapping.close();
+			return false;
+		}
+
+		XmlIndexHeader loaded;
+		memcpy(&loaded, this->mapping.getData(), sizeof(XmlIndexHeader));
+		if (memcmp(loaded.magic, XML_INDEX_MAGIC, sizeof(XML_INDEX_MAGIC)) != 0 || loaded.version != XML_INDEX_VERSION
+			|| loaded.source.size != source.size || loaded.source.time != source.time || loaded.source.hash != source.hash)
+		{
+			this->mapping.close();
+			return false;
+		}
+
+		// The counts are checked one by one, so that their sum cannot overflow.
+		uint64_t available = this->mapping.getLength() - sizeof(XmlIndexHeader);
+		uint64_t expected = 0;
+		bool fits = (loaded.checkpointCount <= available / sizeof(XmlIndexCheckpoint));
+		expected += (fits ? loaded.checkpointCount * sizeof(XmlIndexCheckpoint) : 0);
+		fits = fits && loaded.elementCount <= (available - expected) / sizeof(XmlIndexElement);
+		expected += (fits ? loaded.elementCount * sizeof(XmlIndexElement) : 0);
+		fits = fits && loaded.spaceSwitchCount <= (available - expected) / sizeof(uint64_t);
+		expected += (fits ? loaded.spaceSwitchCount * sizeof(uint64_t) : 0);
+		fits = fits && loaded.nameCount < (available - expected) / sizeof(uint64_t);
+		expected += (fits ? (loaded.nameCount + 1) * sizeof(uint64_t) : 0);
+		fits = fits && loaded.nameBytes == available - expected;
+		if (!fits)
+		{
+			this->mapping.close();
+			return false;
+		}
+
+		const char* tables = this->mapping.getData() + sizeof(XmlIndexHeader);
+		this->header = loaded;
+		this->checkpoints = reinterpret_cast<const XmlIndexCheckpoint*>(tables);
+		this->elements = reinterpret_cast<const XmlIndexElement*>(tables + loaded.checkpointCount * sizeof(XmlIndexCheckpoint));
+		this->spaceSwitches = reinterpret_cast<const uint64_t*>(reinterpret_cast<const char*>(this->elements) + loaded.elementCount * sizeof(XmlIndexElement));
+		this->nameOffsets = this->spaceSwitches + loaded.spaceSwitchCount;
+		this->names = reinterpret_cast<const char*>(this->nameOffsets + loaded.nameCount + 1);
+		this->builtCheckpoints.clear();
+		this->builtElements.clear();
+		this->builtSpaceSwitches.clear();
+		this->builtNameOffsets.clear();
+		this->builtNames.clear();
+		if (!this->checkTables())
+		{
+			this->header = {};
+			this->mapping.close();
+			return false;
+		}
+		return true;
+	}
+
+	bool XmlStructureIndex::save(const std::filesystem::path& path) const
+	{
+		// Written aside, then renamed over the previous index.
+		std::filesystem::path temporaryPath = path;
+		temporaryPath += ".tmp";
+		{
+			std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+			file.write(reinterpret_cast<const char*>(&this->header), sizeof(XmlIndexHeader));
+			file.write(reinterpret_cast<const char*>(this->checkpoints), this->header.checkpointCount * sizeof(XmlIndexCheckpoint));
+			file.write(reinterpret_cast<const char*>(this->elements), this->header.elementCount * sizeof(XmlIndexElement));
+			file.write(reinterpret_cast<const char*>(this->spaceSwitches), this->header.spaceSwitchCount * sizeof(uint64_t));
+			file.write(reinterpret_cast<const char*>(this->nameOffsets), (this->header.nameCount + 1) * sizeof(uint64_t));
+			file.write(this->names, this->header.nameBytes);
+			file.close();
+			if (!file.good())
+			{
+				std::error_code ignored;
+				std::filesystem::remove(temporaryPath, ignored);
+				return false;
+			}
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, path, error);
+		return !error;
+	}
+
+	std::filesystem::path XmlStructureIndex::sidecarPath(const std::filesystem::path& file)
+	{
+		std::filesystem::path path = file;
+		path += XML_STRUCTURE_INDEX_EXTENSION;
+		return path;
+	}
+
+	XmlIndexSource XmlStructureIndex::describe(const std::filesystem::path& file, const char* data, size_t length)
+	{
+		XmlHasher hasher;
+		uint64_t size = length;
+		hasher.update(reinterpret_cast<const char*>(&size), sizeof(size));
+		hasher.update(data, std::min(length, XML_INDEX_HASHED_BYTES));
+		if (length > XML_INDEX_HASHED_BYTES)
+		{
+			size_t tail = std::max(XML_INDEX_HASHED_BYTES, length - XML_INDEX_HASHED_BYTES);
+			hasher.update(data + tail, length - tail);
+		}
+
+		std::error_code error;
+		std::filesystem::file_time_type time = std::filesystem::last_write_time(file, error);
+		return { size, (error ? 0 : static_cast<int64_t>(time.time_since_epoch().count())), hasher.digest() };
+	}
+
+	std::string XmlStructureIndex::path(const char* data, size_t length, size_t offset) const
+	{
+		if (offset > length)
+		{
+			offset = length;
+		}
+
+		// The elements open at the checkpoint, outermost first.
+		const XmlIndexCheckpoint& checkpoint = this->checkpointBefore(offset);
+		std::vector<std::string_view> names(static_cast<size_t>(checkpoint.depth));
+		for (uint64_t i = checkpoint.element; i != XML_INDEX_NONE; i = this->elements[i].parent)
+		{
+			const XmlIndexElement& element = this->elements[i];
+			names[element.depth] = std::string_view(this->names + this->nameOffsets[element.name], static_cast<size_t>(this->nameOffsets[element.name + 1] - this->nameOffsets[element.name]));
+		}
+
+		// Then the constructs from the checkpoint to the offset, with the boundaries of currentPath: an element is entered at its '<' and left after the '/' of "/>" or the '>' of its end tag.
+		std::string attr;
+		XmlStructureScanner scanner(data, length, static_cast<size_t>(checkpoint.offset));
+		XmlStructureEvent event;
+		while (scanner.next(event) && event.begin < offset)
+		{
+			bool inside = (event.end > offset);
+			if (!inside)
+			{
+				if (event.type == StructElementStart)
+				{
+					names.push_back(event.name);
+				}
+				else if (event.type == StructElementEnd && !names.empty())
+				{
+					names.pop_back();
+				}
+				continue;
+			}
+
+			// The offset is inside this construct. Inside a start tag, the path ends with the last attribute name before the offset.
+			if (event.type != StructElementStart && (event.type != StructEmptyElement || offset >= event.end - 1))
+			{
+				break;
+			}
+			names.push_back(event.name);
+			XmlParser parser(data + event.begin, event.end - event.begin);
+			XmlToken token;
+			while ((token = parser.parseNext()).type != XmlTokenType::EndOfFile && token.pos < offset - event.begin)
+			{
+				if (token.type == XmlTokenType::AttrName)
+				{
+					attr.assign(token.chars, token.size);
+				}
+			}
+			break;
+		}
+
+		std::string result;
+		for (const std::string_view& name : names)
+		{
+			result += "/";
+			result += name;
+		}
+		if (!attr.empty())
+		{
+			result += "/@" + attr;
+		}
+		return result;
+	}
+
+	XmlLinePosition XmlStructureIndex::positionOf(const char* data, size_t length, size_t offset) const
+	{
+		if (offset > length)
+		{
+			offset = length;
+		}
+
+		const XmlIndexCheckpoint& checkpoint = this->checkpointBefore(offset);
+		uint64_t line = checkpoint.line;
+		uint64_t lineBegin = checkpoint.lineBegin;
+		advanceLines(data, length, static_cast<size_t>(checkpoint.offset), offset, line, lineBegin);
+		return { static_cast<size_t>(line), static_cast<size_t>(offset - lineBegin + 1) };
+	}
+
+	size_t XmlStructureIndex::offsetOf(const char* data, size_t length, const XmlLinePosition& position) const
+	{
+		if (position.line == 0 || position.column == 0)
+		{
+			throw std::out_of_range("Position " + position.toString() + " is outside of the document");
+		}
+
+		// Start from the last checkpoint on or before the line.
+		const XmlIndexCheckpoint* end = this->checkpoints + this->header.checkpointCount;
+		const XmlIndexCheckpoint* checkpoint = std::upper_bound(this->checkpoints, end, position.line, [](size_t value, const XmlIndexCheckpoint& checkpoint) { return value < checkpoint.line; }) - 1;
+		uint64_t line = checkpoint->line;
+		size_t lineBegin = static_cast<size_t>(checkpoint->lineBegin);
+		size_t i = static_cast<size_t>(checkpoint->offset);
+		while (line < position.line)
+		{
+			i = findLineBreak(data, length, i);
+			if (i >= length)
+			{
+				throw std::out_of_range("Position " + position.toString() + " is outside of the document");
+			}
+			i = nextLineStart(data, length, i);
+			lineBegin = i;
+			++line;
+		}
+
+		// A column may address any byte of the line, its line break included, or the end of the document.
+		size_t lineBreak = findLineBreak(data, length, i);
+		size_t lineEnd = (lineBreak < length ? nextLineStart(data, length, lineBreak) : length + 1);
+		size_t offset = lineBegin + position.column - 1;
+		if (offset >= lineEnd || offset < lineBegin)
+		{
+			throw std::out_of_range("Position " + position.toString() + " is outside of the document");
+		}
+		return offset;
+	}
+
+	XmlStructureScanState XmlStructureIndex::scanStateBefore(const char* data, size_t offset) const
+	{
+		// lineRange scans up to the start of the line of the range.
+		if (offset > this->header.source.size)
+		{
+			offset = static_cast<size_t>(this->header.source.size);
+		}
+		while (offset > 0 && data[offset - 1] != '\n' && data[offset - 1] != '\r')
+		{
+			--offset;
+		}
+
+		const XmlIndexCheckpoint& checkpoint = this->checkpointBefore(offset);
+		const uint64_t* switches = this->spaceSwitches + checkpoint.spaceSwitches;
+		const uint64_t* lineStartSwitches = switches + checkpoint.spaceSwitchCount;
+		return { static_cast<size_t>(checkpoint.offset), static_cast<size_t>(checkpoint.depth), static_cast<size_t>(checkpoint.textBegin), static_cast<size_t>(checkpoint.lineStart), static_cast<size_t>(checkpoint.lineStartDepth), XmlSpaceSwitches(switches, switches + checkpoint.spaceSwitchCount), XmlSpaceSwitches(lineStartSwitches, lineStartSwitches + checkpoint.lineStartSpaceSwitchCount) };
+	}
+}
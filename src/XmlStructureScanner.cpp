@@ -0,0 +1,446 @@
+#include "XmlStructureScanner.h"
+
+#include <cstring>
+
+#include "XmlCharClass.h"
+
+namespace QuickXml
+{
+	// Indicates if a char separates the parts of a tag.
+	static bool isMarkupSpace(char c)
+	{
+		return (XML_CHAR_CLASSES[static_cast<unsigned char>(c)] & (CharSpace | CharLineBreak)) != 0;
+	}
+
+	XmlStructureScanner::XmlStructureScanner(const char* data, size_t length, size_t offset) : data(data), length(length), pos(offset)
+	{
+	}
+
+	size_t XmlStructureScanner::find(size_t from, const char* str, size_t strLength) const
+	{
+		while (from + strLength <= this->length)
+		{
+			const char* candidate = static_cast<const char*>(memchr(this->data + from, str[0], this->length - from - strLength + 1));
+			if (candidate == NULL)
+			{
+				break;
+			}
+
+			from = candidate - this->data;
+			if (!memcmp(candidate, str, strLength))
+			{
+				return from;
+			}
+			++from;
+		}
+		return this->length;
+	}
+
+	size_t XmlStructureScanner::findTagEnd(size_t from) const
+	{
+		size_t i = from;
+		while (i < this->length)
+		{
+			char c = this->data[i];
+			if (c == '>')
+			{
+				return i + 1;
+			}
+			else if (c == '"' || c == '\'')
+			{
+				const char* quote = static_cast<const char*>(memchr(this->data + i + 1, c, this->length - i - 1));
+				if (quote == NULL)
+				{
+					return this->length;
+				}
+				i = quote - this->data;
+			}
+			++i;
+		}
+		return this->length;
+	}
+
+	size_t XmlStructureScanner::findDeclarationEnd(size_t from) const
+	{
+		size_t i = from;
+		size_t subsets = 0;
+		while (i < this->length)
+		{
+			char c = this->data[i];
+			if (c == '"' || c == '\'')
+			{
+				const char* quote = static_cast<const char*>(memchr(this->data + i + 1, c, this->length - i - 1));
+				if (quote == NULL)
+				{
+					return this->length;
+				}
+				i = quote - this->data;
+			}
+			else if (c == '[')
+			{
+				++subsets;
+			}
+			else if (c == ']' && subsets > 0)
+			{
+				--subsets;
+			}
+			else if (c == '>' && subsets == 0)
+			{
+				return i + 1;
+			}
+			else if (c == '<' && subsets > 0 && this->length - i >= 4 && !memcmp(this->data + i, "<!--", 4))
+			{
+				// Comments of internal subsets may contain any char.
+				i = this->find(i + 4, "-->", 3) + 2;
+			}
+			++i;
+		}
+		return this->length;
+	}
+
+	bool XmlStructureScanner::next(XmlStructureEvent& event)
+	{
+		if (this->pos >= this->length)
+		{
+			return false;
+		}
+
+		const char* markup = static_cast<const char*>(memchr(this->data + this->pos, '<', this->length - this->pos));
+		if (markup == NULL)
+		{
+			this->pos = this->length;
+			return false;
+		}
+
+		size_t begin = markup - this->data;
+		size_t remaining = this->length - begin;
+		event.begin = begin;
+		event.name = std::string_view();
+		event.type = StructOther;
+
+		// Terminators are searched as the parser does, from the markup start: "<!-->" and "<?>" are whole constructs.
+		if (remaining >= 4 && !memcmp(markup, "<!--", 4))
+		{
+			event.end = this->find(begin + 2, "-->", 3) + 3;
+		}
+		else if (remaining >= 9 && !memcmp(markup, "<![CDATA[", 9))
+		{
+			event.end = this->find(begin + 9, "]]>", 3) + 3;
+		}
+		else if (remaining >= 2 && markup[1] == '?')
+		{
+			event.end = this->find(begin + 1, "?>", 2) + 2;
+		}
+		else if (remaining >= 2 && markup[1] == '%')
+		{
+			event.end = this->find(begin + 1, "%>", 2) + 2;
+		}
+		else if (remaining >= 2 && markup[1] == '!')
+		{
+			event.end = this->findDeclarationEnd(begin + 2);
+		}
+		else
+		{
+			// Element tags: the name ends at the first space, '/' or '>'.
+			bool closing = (remaining >= 2 && markup[1] == '/');
+			size_t nameBegin = begin + (closing ? 2 : 1);
+			size_t nameEnd = nameBegin;
+			while (nameEnd < this->length && !(XML_CHAR_CLASSES[static_cast<unsigned char>(this->data[nameEnd])] & CharTagNameEnd))
+			{
+				++nameEnd;
+			}
+			event.name = std::string_view(this->data + nameBegin, nameEnd - nameBegin);
+			event.end = this->findTagEnd(nameEnd);
+			if (closing)
+			{
+				event.type = StructElementEnd;
+			}
+			else if (event.end >= begin + 2 && this->data[event.end - 1] == '>' && this->data[event.end - 2] == '/')
+			{
+				event.type = StructEmptyElement;
+			}
+			else
+			{
+				event.type = StructElementStart;
+			}
+		}
+
+		if (event.end > this->length)
+		{
+			event.end = this->length;
+		}
+		this->pos = event.end;
+		return true;
+	}
+
+	// Indicates if an XML declaration starts at given offset.
+	static bool isDeclarationAt(const char* data, size_t length, size_t offset)
+	{
+		return (length - offset >= 6 && !memcmp(data + offset, "<?xml", 5) && (XML_CHAR_CLASSES[static_cast<unsigned char>(data[offset + 5])] & (CharSpace | CharLineBreak)));
+	}
+
+	std::vector<size_t> XmlStructureScanner::documentStarts(const char* data, size_t length)
+	{
+		std::vector<size_t> res;
+		XmlStructureScanner scanner(data, length);
+		XmlStructureEvent event;
+		while (scanner.next(event))
+		{
+			if (event.begin > 0 && isDeclarationAt(data, length, event.begin))
+			{
+				res.push_back(event.begin);
+			}
+
+			size_t size = event.end - event.begin;
+			bool comment = (size >= 7 && !memcmp(data + event.begin, "<!--", 4) && !memcmp(data + event.end - 3, "-->", 3));
+			bool cdata = (size >= 12 && !memcmp(data + event.begin, "<![CDATA[", 9) && !memcmp(data + event.end - 3, "]]>", 3));
+			if (comment || cdata)
+			{
+				continue;
+			}
+
+			// A declaration inside the construct: the construct is broken, the scan restarts at the declaration.
+			for (size_t i = event.begin + 1; i < event.end; ++i)
+			{
+				const char* markup = static_cast<const char*>(memchr(data + i, '<', event.end - i));
+				if (markup == NULL)
+				{
+					break;
+				}
+
+				i = markup - data;
+				if (isDeclarationAt(data, length, i))
+				{
+					scanner.pos = i;
+					break;
+				}
+			}
+		}
+		return res;
+	}
+
+	size_t XmlStructureScanner::depthAt(const char* data, size_t length, size_t offset, XmlStructureEvent* markup)
+	{
+		XmlStructureScanner scanner(data, length);
+		XmlStructureEvent event;
+		size_t depth = 0;
+		if (markup != NULL)
+		{
+			markup->end = 0;
+		}
+
+		while (scanner.next(event) && event.begin < offset)
+		{
+			if (event.end > offset)
+			{
+				if (markup != NULL)
+				{
+					*markup = event;
+				}
+				break;
+			}
+
+			if (event.type == StructElementStart)
+			{
+				++depth;
+			}
+			else if (event.type == StructElementEnd && depth > 0)
+			{
+				--depth;
+			}
+		}
+		return depth;
+	}
+
+	// Get the start of the line containing offset.
+	static size_t lineStart(const char* data, size_t offset)
+	{
+		while (offset > 0 && data[offset - 1] != '\n' && data[offset - 1] != '\r')
+		{
+			--offset;
+		}
+		return offset;
+	}
+
+	// Get the end of the line containing offset (before its line break).
+	static size_t lineEnd(const char* data, size_t length, size_t offset)
+	{
+		while (offset < length && data[offset] != '\n' && data[offset] != '\r')
+		{
+			++offset;
+		}
+		return offset;
+	}
+
+	int XmlStructureScanner::spaceAttribute(const char* data, const XmlStructureEvent& event)
+	{
+		static const char name[] = "xml:space";
+		static const size_t nameLength = sizeof(name) - 1;
+
+		// The last xml:space attribute wins, as in the parser.
+		int value = -1;
+		size_t end = event.end;
+		size_t i = event.begin + 1 + event.name.length();
+		while (i < end)
+		{
+			char c = data[i];
+			if (c == '"' || c == '\'')
+			{
+				const char* quote = static_cast<const char*>(memchr(data + i + 1, c, end - i - 1));
+				i = (quote != NULL ? quote - data + 1 : end);
+				continue;
+			}
+			if (end - i <= nameLength || memcmp(data + i, name, nameLength) != 0 || !isMarkupSpace(data[i - 1]))
+			{
+				++i;
+				continue;
+			}
+
+			i += nameLength;
+			size_t j = i;
+			while (j < end && isMarkupSpace(data[j]))
+			{
+				++j;
+			}
+			if (j >= end || data[j] != '=')
+			{
+				continue;
+			}
+			++j;
+			while (j < end && isMarkupSpace(data[j]))
+			{
+				++j;
+			}
+			if (j >= end || (data[j] != '"' && data[j] != '\''))
+			{
+				continue;
+			}
+
+			char quote = data[j];
+			const char* close = static_cast<const char*>(memchr(data + j + 1, quote, end - j - 1));
+			if (close == NULL)
+			{
+				break;
+			}
+			std::string_view spaceValue(data + j + 1, close - data - j - 1);
+			if (spaceValue == "preserve")
+			{
+				value = 1;
+			}
+			else if (spaceValue == "default")
+			{
+				value = 0;
+			}
+			i = close - data + 1;
+		}
+		return value;
+	}
+
+	void XmlStructureScanner::updateSpaceSwitches(XmlSpaceSwitches& switches, const char* data, const XmlStructureEvent& event, size_t depth)
+	{
+		if (event.type == StructElementStart)
+		{
+			// Only the elements changing the inherited value are recorded.
+			int value = spaceAttribute(data, event);
+			if (value >= 0 && value != static_cast<int>(switches.size() % 2))
+			{
+				switches.push_back(depth);
+			}
+		}
+		else if (event.type == StructElementEnd && depth > 0 && !switches.empty() && switches.back() == depth - 1)
+		{
+			switches.pop_back();
+		}
+	}
+
+	XmlStructureRange XmlStructureScanner::lineRange(const char* data, size_t length, size_t begin, size_t end, const XmlStructureScanState* resume)
+	{
+		if (end > length)
+		{
+			end = length;
+		}
+		if (begin > end)
+		{
+			begin = end;
+		}
+
+		// Widen the beginning to the last line start outside of markup, in a single pass over the content before it.
+		// Line starts in the text between constructs are outside of markup, the depth there is the one after the previous construct.
+		size_t target = lineStart(data, begin);
+		XmlStructureRange range = { 0, end, 0, {} };
+		size_t depth = 0;
+		XmlSpaceSwitches switches;
+		size_t textBegin = 0;
+		size_t scanBegin = 0;
+		if (resume != NULL && resume->offset <= target)
+		{
+			range.begin = resume->lineStart;
+			range.depth = resume->lineStartDepth;
+			range.spaceSwitches = resume->lineStartSpaceSwitches;
+			depth = resume->depth;
+			switches = resume->spaceSwitches;
+			textBegin = resume->textBegin;
+			scanBegin = resume->offset;
+		}
+
+		XmlStructureScanner scanner(data, length, scanBegin);
+		XmlStructureEvent event;
+		bool crossed = false;
+		while (scanner.next(event) && event.begin < target)
+		{
+			for (size_t i = event.begin; i > textBegin; --i)
+			{
+				if (data[i - 1] == '\n' || data[i - 1] == '\r')
+				{
+					range.begin = i;
+					range.depth = depth;
+					range.spaceSwitches = switches;
+					break;
+				}
+			}
+
+			if (event.end > target)
+			{
+				crossed = true;
+				break;
+			}
+
+			updateSpaceSwitches(switches, data, event, depth);
+			if (event.type == StructElementStart)
+			{
+				++depth;
+			}
+			else if (event.type == StructElementEnd && depth > 0)
+			{
+				--depth;
+			}
+			textBegin = event.end;
+		}
+		if (!crossed)
+		{
+			range.begin = target;
+			range.depth = depth;
+			range.spaceSwitches = switches;
+		}
+
+		// Widen the end to a line end outside of markup. A range ending at a line start is left as is.
+		if (range.end < range.begin)
+		{
+			range.end = range.begin;
+		}
+		if (range.end > range.begin && data[range.end - 1] != '\n' && data[range.end - 1] != '\r')
+		{
+			range.end = lineEnd(data, length, range.end);
+		}
+
+		XmlStructureScanner endScanner(data, length, range.begin);
+		while (endScanner.next(event) && event.begin < range.end)
+		{
+			if (event.end > range.end)
+			{
+				range.end = lineEnd(data, length, event.end);
+			}
+		}
+		return range;
+	}
+}
@@ -0,0 +1,209 @@
+#include "XmlStructureStats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "XmlArena.h"
+#include "XmlParser.h"
+
+namespace QuickXml
+{
+	// Write the names of a frequency map by decreasing count, then by name.
+	static void reportNames(std::ostream& out, const char* title, const std::unordered_map<std::string, uint64_t>& names)
+	{
+		std::vector<std::pair<std::string, uint64_t>> sorted(names.begin(), names.end());
+		std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b)
+		{
+			return (a.second != b.second ? a.second > b.second : a.first < b.first);
+		});
+
+		out << title << ":\n";
+		for (const std::pair<std::string, uint64_t>& name : sorted)
+		{
+			out << std::setw(12) << name.second << "  " << name.first << "\n";
+		}
+	}
+
+	// Write the largest node of a kind.
+	static void reportLargest(std::ostream& out, const char* title, const XmlLargestNode& largest)
+	{
+		out << title << ": ";
+		if (largest.size == 0)
+		{
+			out << "none\n";
+		}
+		else
+		{
+			out << largest.size << " bytes in " << largest.file << " at byte offset " << largest.offset << "\n";
+		}
+	}
+
+	void XmlStructureStats::updateLargest(XmlLargestNode& largest, size_t size, const std::string& file, size_t offset)
+	{
+		// Ties go to the first node in file then offset order, so that the result does not depend on the order files are collected and merged in.
+		if (size > largest.size || (size == largest.size && size > 0 && (file < largest.file || (file == largest.file && offset < largest.offset))))
+		{
+			largest.size = size;
+			largest.file = file;
+			largest.offset = offset;
+		}
+	}
+
+	void XmlStructureStats::add(const char* data, size_t length, const std::string& file)
+	{
+		XmlArenaScope arenaScope;
+		XmlParser parser(data, length);
+
+		// Names are counted on views of the document first, only the distinct ones are copied to the maps.
+		std::unordered_map<std::string_view, uint64_t> documentElements;
+		std::unordered_map<std::string_view, uint64_t> documentAttributes;
+		size_t depth = 0;
+		bool spaceAttribute = false;
+
+		// A text node is a run of text, whitespace and line break tokens with some text.
+		bool inText = false;
+		bool hasText = false;
+		size_t textBegin = 0;
+		size_t textEnd = 0;
+
+		XmlToken token;
+		while ((token = parser.parseNext()).type != XmlTokenType::EndOfFile)
+		{
+			if (token.type == XmlTokenType::Text || token.type == XmlTokenType::Whitespace || token.type == XmlTokenType::LineBreak)
+			{
+				if (!inText)
+				{
+					inText = true;
+					hasText = false;
+					textBegin = token.pos;
+				}
+				hasText = (hasText || token.type == XmlTokenType::Text);
+				textEnd = token.pos + token.size;
+				continue;
+			}
+
+			if (inText && hasText)
+			{
+				updateLargest(this->largestText, textEnd - textBegin, file, textBegin);
+			}
+			inText = false;
+
+			switch (token.type)
+			{
+				case XmlTokenType::TagOpening:
+					++depth;
+					++this->elements;
+					this->depthSum += depth;
+					if (depth > this->maxDepth || (depth == this->maxDepth && file < this->maxDepthFile))
+					{
+						this->maxDepth = depth;
+						this->maxDepthFile = file;
+					}
+					++documentElements[std::string_view(token.chars + 1, token.size - 1)];
+					break;
+
+				case XmlTokenType::TagClosingEnd:
+				case XmlTokenType::TagSelfClosingEnd:
+					if (depth > 0)
+					{
+						--depth;
+					}
+					break;
+
+				case XmlTokenType::AttrName:
+				{
+					// Braces needed - declaring variables.
+					std::string_view name(token.chars, token.size);
+					++this->attributes;
+					++documentAttributes[name];
+					spaceAttribute = (name == "xml:space");
+					break;
+				}
+
+				case XmlTokenType::AttrValue:
+					// Values are quoted.
+					if (spaceAttribute && token.size >= 2 && std::string_view(token.chars + 1, token.size - 2) == "preserve")
+					{
+						++this->preserveRegions;
+					}
+					spaceAttribute = false;
+					break;
+
+				case XmlTokenType::Comment:
+					updateLargest(this->largestComment, token.size, file, token.pos);
+					break;
+
+				case XmlTokenType::CDATA:
+					updateLargest(this->largestCDATA, token.size, file, token.pos);
+					break;
+
+				default:
+					break;
+			}
+		}
+		if (inText && hasText)
+		{
+			updateLargest(this->largestText, textEnd - textBegin, file, textBegin);
+		}
+
+		for (const std::pair<const std::string_view, uint64_t>& name : documentElements)
+		{
+			this->elementNames[std::string(name.first)] += name.second;
+		}
+		for (const std::pair<const std::string_view, uint64_t>& name : documentAttributes)
+		{
+			this->attributeNames[std::string(name.first)] += name.second;
+		}
+		++this->files;
+		this->bytes += length;
+	}
+
+	void XmlStructureStats::merge(const XmlStructureStats& other)
+	{
+		this->files += other.files;
+		this->bytes += other.bytes;
+		this->elements += other.elements;
+		this->attributes += other.attributes;
+		this->depthSum += other.depthSum;
+		if (other.maxDepth > this->maxDepth || (other.maxDepth == this->maxDepth && other.maxDepth > 0 && other.maxDepthFile < this->maxDepthFile))
+		{
+			this->maxDepth = other.maxDepth;
+			this->maxDepthFile = other.maxDepthFile;
+		}
+		this->preserveRegions += other.preserveRegions;
+		updateLargest(this->largestText, other.largestText.size, other.largestText.file, other.largestText.offset);
+		updateLargest(this->largestComment, other.largestComment.size, other.largestComment.file, other.largestComment.offset);
+		updateLargest(this->largestCDATA, other.largestCDATA.size, other.largestCDATA.file, other.largestCDATA.offset);
+		for (const std::pair<const std::string, uint64_t>& name : other.elementNames)
+		{
+			this->elementNames[name.first] += name.second;
+		}
+		for (const std::pair<const std::string, uint64_t>& name : other.attributeNames)
+		{
+			this->attributeNames[name.first] += name.second;
+		}
+	}
+
+	void XmlStructureStats::report(std::ostream& out) const
+	{
+		out << std::fixed << std::setprecision(2);
+		out << "Files: " << this->files << " (" << this->bytes << " bytes)\n";
+		out << "Elements: " << this->elements << " (" << this->elementNames.size() << " names)\n";
+		out << "Attributes: " << this->attributes << " (" << this->attributeNames.size() << " names)\n";
+		out << "Depth: max " << this->maxDepth;
+		if (this->maxDepth > 0)
+		{
+			out << " in " << this->maxDepthFile;
+		}
+		out << ", mean " << (this->elements > 0 ? static_cast<double>(this->depthSum) / this->elements : 0.0) << "\n";
+		out << "xml:space=\"preserve\" regions: " << this->preserveRegions << "\n";
+		reportLargest(out, "Largest text", this->largestText);
+		reportLargest(out, "Largest comment", this->largestComment);
+		reportLargest(out, "Largest CDATA", this->largestCDATA);
+		reportNames(out, "Element names", this->elementNames);
+		reportNames(out, "Attribute names", this->attributeNames);
+	}
+}
@@ -0,0 +1,379 @@
+#include "XmlTarRewriter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+// Offsets and lengths of the ustar header fields used.
+#define XML_TAR_NAME_OFFSET 0
+#define XML_TAR_NAME_LENGTH 100
+#define XML_TAR_SIZE_OFFSET 124
+#define XML_TAR_SIZE_LENGTH 12
+#define XML_TAR_CHECKSUM_OFFSET 148
+#define XML_TAR_CHECKSUM_LENGTH 8
+#define XML_TAR_TYPE_OFFSET 156
+#define XML_TAR_MAGIC_OFFSET 257
+#define XML_TAR_PREFIX_OFFSET 345
+#define XML_TAR_PREFIX_LENGTH 155
+
+// Bytes copied at once for members passed through.
+#define XML_TAR_COPY_BYTES (64 * 1024)
+
+// A metadata member (GNU long name, pax extended header) held until the member it describes is written.
+struct XmlTarMetadata
+{
+	char header[XML_TAR_BLOCK_SIZE];
+	std::string data;
+};
+
+// Get the value of a pax record ("length key=value\n"). Returns false when the key is missing.
+static bool findPaxRecord(const std::string& records, const std::string& key, std::string& value)
+{
+	size_t pos = 0;
+	while (pos < records.length())
+	{
+		size_t space = records.find(' ', pos);
+		size_t length = (space == std::string::npos ? 0 : std::strtoull(records.c_str() + pos, NULL, 10));
+		if (length == 0 || pos + length > records.length())
+		{
+			return false;
+		}
+
+		size_t equal = records.find('=', space);
+		if (equal < pos + length && records.compare(space + 1, equal - space - 1, key) == 0)
+		{
+			value = records.substr(equal + 1, pos + length - equal - 2);
+			return true;
+		}
+		pos += length;
+	}
+	return false;
+}
+
+// Replace the value of the size record of pax records, if any.
+static std::string replacePaxSize(const std::string& records, uint64_t size)
+{
+	std::string result;
+	size_t pos = 0;
+	while (pos < records.length())
+	{
+		size_t space = records.find(' ', pos);
+		size_t length = (space == std::string::npos ? 0 : std::strtoull(records.c_str() + pos, NULL, 10));
+		if (length == 0 || pos + length > records.length())
+		{
+			// Malformed records are kept as is.
+			result.append(records, pos, std::string::npos);
+			break;
+		}
+
+		if (records.compare(space + 1, 5, "size=") == 0)
+		{
+			// The record length counts its own digits.
+			std::string content = " size=" + std::to_string(size) + "\n";
+			size_t recordLength = content.length() + 1;
+			while (std::to_string(recordLength).length() + content.length() != recordLength)
+			{
+				++recordLength;
+			}
+			result += std::to_string(recordLength) + content;
+		}
+		else
+		{
+			result.append(records, pos, length);
+		}
+		pos += length;
+	}
+	return result;
+}
+
+XmlTarRewriter::XmlTarRewriter(XmlJobProcessor& processor, uint64_t maxMemberBytes) : processor(processor), maxMemberBytes(maxMemberBytes)
+{
+}
+
+uint64_t XmlTarRewriter::parseNumber(const char* field, size_t length)
+{
+	uint64_t value = 0;
+	if ((static_cast<unsigned char>(field[0]) & 0x80) != 0)
+	{
+		// Base-256, big-endian, after the marker bit (and the sign bit, negative values are not used here).
+		value = static_cast<unsigned char>(field[0]) & 0x3F;
+		for (size_t i = 1; i < length; ++i)
+		{
+			value = (value << 8) | static_cast<unsigned char>(field[i]);
+		}
+		return value;
+	}
+
+	size_t i = 0;
+	while (i < length && (field[i] == ' ' || field[i] == '\0'))
+	{
+		++i;
+	}
+	for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i)
+	{
+		value = (value << 3) | static_cast<uint64_t>(field[i] - '0');
+	}
+	return value;
+}
+
+void XmlTarRewriter::formatNumber(char* field, size_t length, uint64_t value)
+{
+	// Octal digits fill the field but its last byte, a NUL.
+	if (value < (1ULL << (3 * (length - 1))))
+	{
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%0*llo", static_cast<int>(length - 1), static_cast<unsigned long long>(value));
+		memcpy(field, buffer, length);
+		return;
+	}
+
+	memset(field, 0, length);
+	field[0] = static_cast<char>(0x80);
+	for (size_t i = length - 1; i > 0 && value > 0; --i)
+	{
+		field[i] = static_cast<char>(value & 0xFF);
+		value >>= 8;
+	}
+}
+
+uint64_t XmlTarRewriter::checksum(const char* header)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < XML_TAR_BLOCK_SIZE; ++i)
+	{
+		bool inField = (i >= XML_TAR_CHECKSUM_OFFSET && i < XML_TAR_CHECKSUM_OFFSET + XML_TAR_CHECKSUM_LENGTH);
+		sum += (inField ? static_cast<unsigned char>(' ') : static_cast<unsigned char>(header[i]));
+	}
+	return sum;
+}
+
+bool XmlTarRewriter::readBlocks(char* data, size_t blocks)
+{
+	this->in->read(data, blocks * XML_TAR_BLOCK_SIZE);
+	size_t count = static_cast<size_t>(this->in->gcount());
+	if (count == 0)
+	{
+		return false;
+	}
+	if (count != blocks * XML_TAR_BLOCK_SIZE)
+	{
+		throw std::runtime_error("Truncated tar archive at offset " + std::to_string(this->offset + count));
+	}
+	this->offset += count;
+	return true;
+}
+
+void XmlTarRewriter::readData(uint64_t size, std::string& content)
+{
+	uint64_t blocks = (size + XML_TAR_BLOCK_SIZE - 1) / XML_TAR_BLOCK_SIZE;
+	content.resize(static_cast<size_t>(blocks * XML_TAR_BLOCK_SIZE));
+	if (blocks > 0 && !this->readBlocks(&content[0], static_cast<size_t>(blocks)))
+	{
+		throw std::runtime_error("Truncated tar archive at offset " + std::to_string(this->offset));
+	}
+	content.resize(static_cast<size_t>(size));
+}
+
+void XmlTarRewriter::copyData(uint64_t size)
+{
+	uint64_t remaining = (size + XML_TAR_BLOCK_SIZE - 1) / XML_TAR_BLOCK_SIZE;
+	std::vector<char> buffer(XML_TAR_COPY_BYTES);
+	while (remaining > 0)
+	{
+		size_t blocks = static_cast<size_t>(std::min<uint64_t>(remaining, XML_TAR_COPY_BYTES / XML_TAR_BLOCK_SIZE));
+		if (!this->readBlocks(buffer.data(), blocks))
+		{
+			throw std::runtime_error("Truncated tar archive at offset " + std::to_string(this->offset));
+		}
+		this->out->write(buffer.data(), blocks * XML_TAR_BLOCK_SIZE);
+		remaining -= blocks;
+	}
+}
+
+void XmlTarRewriter::writeData(const std::string& content)
+{
+	static const char padding[XML_TAR_BLOCK_SIZE] = {};
+	this->out->write(content.data(), content.length());
+	size_t tail = content.length() % XML_TAR_BLOCK_SIZE;
+	if (tail > 0)
+	{
+		this->out->write(padding, XML_TAR_BLOCK_SIZE - tail);
+	}
+}
+
+void XmlTarRewriter::writeHeader(char* header, uint64_t size, uint64_t newSize)
+{
+	// Headers of unchanged sizes are written as read, byte for byte.
+	if (newSize != size)
+	{
+		formatNumber(header + XML_TAR_SIZE_OFFSET, XML_TAR_SIZE_LENGTH, newSize);
+
+		// Six octal digits, a NUL and a space, as tar writes it.
+		char buffer[16];
+		snprintf(buffer, sizeof(buffer), "%06llo", static_cast<unsigned long long>(checksum(header)));
+		memcpy(header + XML_TAR_CHECKSUM_OFFSET, buffer, 7);
+		header[XML_TAR_CHECKSUM_OFFSET + 7] = ' ';
+	}
+	this->out->write(header, XML_TAR_BLOCK_SIZE);
+}
+
+void XmlTarRewriter::run(std::istream& in, std::ostream& out)
+{
+	this->in = &in;
+	this->out = &out;
+	this->offset = 0;
+	this->memberCount = 0;
+	this->formattedCount = 0;
+	this->failedCount = 0;
+
+	std::vector<XmlTarMetadata> metadata;
+	char header[XML_TAR_BLOCK_SIZE];
+	while (this->readBlocks(header, 1))
+	{
+		static const char zeros[XML_TAR_BLOCK_SIZE] = {};
+		if (memcmp(header, zeros, XML_TAR_BLOCK_SIZE) == 0)
+		{
+			// End of archive: the end blocks and anything after them are copied as is.
+			out.write(header, XML_TAR_BLOCK_SIZE);
+			std::vector<char> buffer(XML_TAR_COPY_BYTES);
+			while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0)
+			{
+				out.write(buffer.data(), in.gcount());
+			}
+			break;
+		}
+
+		// Old archivers sum signed chars.
+		uint64_t storedChecksum = parseNumber(header + XML_TAR_CHECKSUM_OFFSET, XML_TAR_CHECKSUM_LENGTH);
+		int64_t signedChecksum = 0;
+		for (size_t i = 0; i < XML_TAR_BLOCK_SIZE; ++i)
+		{
+			bool inField = (i >= XML_TAR_CHECKSUM_OFFSET && i < XML_TAR_CHECKSUM_OFFSET + XML_TAR_CHECKSUM_LENGTH);
+			signedChecksum += (inField ? ' ' : static_cast<signed char>(header[i]));
+		}
+		if (storedChecksum != checksum(header) && static_cast<int64_t>(storedChecksum) != signedChecksum)
+		{
+			throw std::runtime_error("Invalid tar header at offset " + std::to_string(this->offset - XML_TAR_BLOCK_SIZE));
+		}
+
+		char type = header[XML_TAR_TYPE_OFFSET];
+		uint64_t size = parseNumber(header + XML_TAR_SIZE_OFFSET, XML_TAR_SIZE_LENGTH);
+		if (type == 'x' || type == 'L' || type == 'K')
+		{
+			if (size > this->maxMemberBytes)
+			{
+				throw std::runtime_error("Extended tar header too large at offset " + std::to_string(this->offset - XML_TAR_BLOCK_SIZE));
+			}
+			metadata.emplace_back();
+			memcpy(metadata.back().header, header, XML_TAR_BLOCK_SIZE);
+			this->readData(size, metadata.back().data);
+			continue;
+		}
+		++this->memberCount;
+
+		// The name (and the size) comes from a pax path record, a GNU long name, or the ustar prefix and name fields.
+		std::string name;
+		bool paxSize = false;
+		for (const XmlTarMetadata& entry : metadata)
+		{
+			std::string value;
+			if (entry.header[XML_TAR_TYPE_OFFSET] == 'x')
+			{
+				if (findPaxRecord(entry.data, "path", value))
+				{
+					name = value;
+				}
+				if (findPaxRecord(entry.data, "size", value))
+				{
+					// Overrides the header size, which may not hold it.
+					size = std::strtoull(value.c_str(), NULL, 10);
+					paxSize = true;
+				}
+			}
+			else if (entry.header[XML_TAR_TYPE_OFFSET] == 'L' && name.empty())
+			{
+				name = entry.data.substr(0, entry.data.find('\0'));
+			}
+		}
+		if (name.empty())
+		{
+			name.assign(header + XML_TAR_NAME_OFFSET, strnlen(header + XML_TAR_NAME_OFFSET, XML_TAR_NAME_LENGTH));
+			if (memcmp(header + XML_TAR_MAGIC_OFFSET, "ustar", 6) == 0 && header[XML_TAR_PREFIX_OFFSET] != '\0')
+			{
+				name = std::string(header + XML_TAR_PREFIX_OFFSET, strnlen(header + XML_TAR_PREFIX_OFFSET, XML_TAR_PREFIX_LENGTH)) + "/" + name;
+			}
+		}
+
+		bool regular = (type == '0' || type == '\0' || type == '7');
+		std::string extension = std::filesystem::path(name).extension().string();
+		if (!regular || (extension != ".xml" && extension != ".xsd") || size > this->maxMemberBytes)
+		{
+			if (regular && (extension == ".xml" || extension == ".xsd"))
+			{
+				std::cerr << "Copied: " << name << " (larger than " << this->maxMemberBytes << " bytes)" << std::endl;
+			}
+			for (XmlTarMetadata& entry : metadata)
+			{
+				this->writeHeader(entry.header, entry.data.length(), entry.data.length());
+				this->writeData(entry.data);
+			}
+			metadata.clear();
+			this->writeHeader(header, size, size);
+			this->copyData(size);
+			continue;
+		}
+
+		XmlPipelineJob job;
+		job.path = name;
+		this->readData(size, job.input);
+		try
+		{
+			this->processor.process(job);
+		}
+		catch (const std::exception& e)
+		{
+			job.failed = true;
+			job.message = e.what();
+		}
+
+		// Failed members are kept untouched, as failed files are not written.
+		const std::string& content = (!job.failed && job.writeOutput ? job.output : job.input);
+		if (job.failed)
+		{
+			++this->failedCount;
+			std::cerr << "Error processing " << name << ": " << job.message << std::endl;
+		}
+		else
+		{
+			this->formattedCount += (job.writeOutput ? 1 : 0);
+			std::cerr << job.message << std::endl;
+		}
+
+		for (XmlTarMetadata& entry : metadata)
+		{
+			uint64_t entrySize = entry.data.length();
+			if (paxSize && entry.header[XML_TAR_TYPE_OFFSET] == 'x')
+			{
+				entry.data = replacePaxSize(entry.data, content.length());
+			}
+			this->writeHeader(entry.header, entrySize, entry.data.length());
+			this->writeData(entry.data);
+		}
+		metadata.clear();
+		this->writeHeader(header, size, content.length());
+		this->writeData(content);
+	}
+
+	if (!metadata.empty())
+	{
+		throw std::runtime_error("Truncated tar archive at offset " + std::to_string(this->offset));
+	}
+	if (!out.good())
+	{
+		throw std::runtime_error("Cannot write tar archive");
+	}
+}
@@ -0,0 +1,122 @@
+#include "XmlTokenGenerator.h"
+
+#include <memory_resource>
+
+namespace QuickXml
+{
+	void XmlChunkSource::resumeWaiting()
+	{
+		if (this->waiting)
+		{
+			std::coroutine_handle<> handle = this->waiting;
+			this->waiting = NULL;
+			handle.resume();
+		}
+	}
+
+	void XmlChunkSource::push(const char* chunk, size_t length)
+	{
+		this->data.append(chunk, length);
+		if (this->data.length() > this->waitingLength)
+		{
+			this->resumeWaiting();
+		}
+	}
+
+	void XmlChunkSource::close()
+	{
+		this->closed = true;
+		this->resumeWaiting();
+	}
+
+	std::coroutine_handle<> XmlTokenGenerator::YieldAwaiter::await_suspend(Handle handle) noexcept
+	{
+		// Without a consumer waiting (token lexed from a push, or tryNext), control goes back to the resumer.
+		std::coroutine_handle<> continuation = handle.promise().continuation;
+		handle.promise().continuation = NULL;
+		return (continuation ? continuation : std::noop_coroutine());
+	}
+
+	XmlTokenGenerator::YieldAwaiter XmlTokenGenerator::promise_type::yield_value(const XmlTokenView& token) noexcept
+	{
+		this->current = token;
+		this->pending = true;
+		return {};
+	}
+
+	std::coroutine_handle<> XmlTokenGenerator::NextAwaiter::await_suspend(std::coroutine_handle<> consumer) noexcept
+	{
+		this->generator.promise().continuation = consumer;
+		return this->generator;
+	}
+
+	bool XmlTokenGenerator::NextAwaiter::await_resume()
+	{
+		return XmlTokenGenerator::take(this->generator);
+	}
+
+	bool XmlTokenGenerator::take(Handle handle)
+	{
+		promise_type& promise = handle.promise();
+		if (promise.exception)
+		{
+			std::exception_ptr exception = promise.exception;
+			promise.exception = NULL;
+			std::rethrow_exception(exception);
+		}
+
+		if (promise.pending)
+		{
+			promise.pending = false;
+			return true;
+		}
+		return false;
+	}
+
+	XmlTokenGenerator::~XmlTokenGenerator()
+	{
+		if (this->handle)
+		{
+			this->handle.destroy();
+		}
+	}
+
+	bool XmlTokenGenerator::tryNext()
+	{
+		if (!this->handle.promise().pending && !this->handle.done())
+		{
+			this->handle.resume();
+		}
+		return take(this->handle);
+	}
+
+	XmlTokenGenerator XmlTokenGenerator::tokens(XmlChunkSource& source)
+	{
+		// The coroutine may be resumed from another thread than the one which created it: no thread arena.
+		XmlParser parser(source.getData(), source.getLength(), std::pmr::new_delete_resource());
+		XmlToken token;
+
+		for (;;)
+		{
+			if (!parser.lexNext(token, !source.isClosed()))
+			{
+				// The chunk ran out inside a token: lex the token again once the chars after its start have doubled. A long token fed by small chunks is lexed again
+				// a logarithmic number of times, its chars are read a bounded number of times overall instead of once per chunk.
+				// The lexer may be resumed earlier by tryNext, it waits again then.
+				size_t length = source.getLength() + (source.getLength() - parser.getPosition());
+				while (!source.isClosed() && source.getLength() <= length)
+				{
+					co_await source.moreData(length);
+				}
+				parser.extend(source.getData(), source.getLength());
+				continue;
+			}
+
+			if (token.type == XmlTokenType::EndOfFile)
+			{
+				co_return;
+			}
+			co_yield XmlTokenView{ token.type, token.pos, std::string_view(token.chars, token.size), token.context };
+		}
+	}
+}
@@ -0,0 +1,189 @@
+#include "XmlTrace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+std::atomic<bool> XmlTrace::enabled(false);
+bool XmlTrace::timeline = false;
+bool XmlTrace::phaseTimes = false;
+std::atomic<XmlTraceBuffer*> XmlTrace::buffers(NULL);
+std::atomic<size_t> XmlTrace::threadCount(0);
+uint64_t XmlTrace::origin = 0;
+std::string XmlTrace::outputPath;
+
+// Nanoseconds of the steady clock.
+static uint64_t steadyNanoseconds()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Append a JSON string literal.
+static void appendJsonString(std::string& out, const std::string& str)
+{
+	out += '"';
+	for (char c : str)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+			out += escaped;
+		}
+		else
+		{
+			out += c;
+		}
+	}
+	out += '"';
+}
+
+// Append a trace clock time as the microseconds of trace-event timestamps.
+static void appendMicroseconds(std::string& out, uint64_t nanoseconds)
+{
+	char str[32];
+	snprintf(str, sizeof(str), "%llu.%03llu", static_cast<unsigned long long>(nanoseconds / 1000), static_cast<unsigned long long>(nanoseconds % 1000));
+	out += str;
+}
+
+XmlTraceBuffer& XmlTrace::local()
+{
+	// Buffers are owned by the list and outlive their threads, the events are written after the threads are joined.
+	thread_local XmlTraceBuffer* buffer = NULL;
+	if (buffer == NULL)
+	{
+		buffer = new XmlTraceBuffer();
+		buffer->threadId = ++threadCount;
+		buffer->events.reserve(1024);
+		buffer->next = buffers.load(std::memory_order_relaxed);
+		while (!buffers.compare_exchange_weak(buffer->next, buffer, std::memory_order_release, std::memory_order_relaxed))
+		{
+		}
+	}
+	return *buffer;
+}
+
+void XmlTrace::start(const std::string& path)
+{
+	origin = steadyNanoseconds();
+	outputPath = path;
+	timeline = true;
+	enabled.store(true, std::memory_order_relaxed);
+	setThreadName("main");
+	std::atexit(&XmlTrace::writeAtExit);
+}
+
+void XmlTrace::startPhaseTimes()
+{
+	phaseTimes = true;
+	enabled.store(true, std::memory_order_relaxed);
+}
+
+std::vector<XmlTracePhaseTime> XmlTrace::takePhaseTimes()
+{
+	std::vector<XmlTracePhaseTime> res;
+	if (isEnabled())
+	{
+		res.swap(local().phaseTimes);
+	}
+	return res;
+}
+
+uint64_t XmlTrace::now()
+{
+	return steadyNanoseconds() - origin;
+}
+
+void XmlTrace::record(const char* name, uint64_t begin, uint64_t end, const std::string& detail)
+{
+	XmlTraceBuffer& buffer = local();
+	if (timeline)
+	{
+		buffer.events.push_back({ name, begin, end, detail });
+	}
+
+	if (phaseTimes)
+	{
+		// Few distinct phases: a linear search.
+		std::vector<XmlTracePhaseTime>::iterator it = buffer.phaseTimes.begin();
+		while (it != buffer.phaseTimes.end() && strcmp(it->name, name) != 0)
+		{
+			++it;
+		}
+		if (it == buffer.phaseTimes.end())
+		{
+			buffer.phaseTimes.push_back({ name, 0 });
+			it = buffer.phaseTimes.end() - 1;
+		}
+		it->duration += end - begin;
+	}
+}
+
+void XmlTrace::setThreadName(const char* name)
+{
+	if (timeline)
+	{
+		local().threadName = name;
+	}
+}
+
+void XmlTrace::writeAtExit()
+{
+	enabled.store(false, std::memory_order_relaxed);
+	timeline = false;
+	if (!write(outputPath))
+	{
+		std::cerr << "Error: Cannot write trace file: " << outputPath << std::endl;
+	}
+}
+
+bool XmlTrace::write(const std::string& path)
+{
+	std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	for (XmlTraceBuffer* buffer = buffers.load(std::memory_order_acquire); buffer != NULL; buffer = buffer->next)
+	{
+		std::string tid = std::to_string(buffer->threadId);
+		if (!buffer->threadName.empty())
+		{
+			out += (first ? "\n" : ",\n");
+			out += "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" + tid + ",\"args\":{\"name\":";
+			appendJsonString(out, buffer->threadName);
+			out += "}}";
+			first = false;
+		}
+
+		// A phase is a complete event: its begin timestamp and its duration.
+		for (const XmlTraceEvent& event : buffer->events)
+		{
+			out += (first ? "\n" : ",\n");
+			out += "{\"ph\":\"X\",\"name\":\"";
+			out += event.name;
+			out += "\",\"pid\":1,\"tid\":" + tid + ",\"ts\":";
+			appendMicroseconds(out, event.begin);
+			out += ",\"dur\":";
+			appendMicroseconds(out, event.end - event.begin);
+			if (!event.detail.empty())
+			{
+				out += ",\"args\":{\"file\":";
+				appendJsonString(out, event.detail);
+				out += "}";
+			}
+			out += "}";
+			first = false;
+		}
+	}
+	out += "\n]}\n";
+
+	std::ofstream file(path, std::ios::binary);
+	file.write(out.data(), out.length());
+	return file.good();
+}
@@ -0,0 +1,284 @@
+#include "XmlValidator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// Errors reported per document, the following ones are most often consequences of the first ones.
+#define XML_VALIDATOR_MAX_ERRORS 100
+
+namespace QuickXml
+{
+	XmlValidator::XmlValidator()
+	{
+		this->reset();
+	}
+
+	void XmlValidator::reset()
+	{
+		this->elements.clear();
+		this->openNames.clear();
+		this->attributes.clear();
+		this->errors.clear();
+		this->inTag = false;
+		this->tagOffset = 0;
+		this->hasPendingAttr = false;
+		this->pendingAttrHasEqual = false;
+	}
+
+	void XmlValidator::addError(size_t offset, const std::string& message)
+	{
+		if (this->errors.size() < XML_VALIDATOR_MAX_ERRORS)
+		{
+			this->errors.push_back({ offset, { 0, 0 }, message });
+		}
+	}
+
+	void XmlValidator::pushElement(std::string_view name, size_t offset)
+	{
+		this->elements.push_back({ name, offset });
+		++this->openNames[name];
+	}
+
+	void XmlValidator::popElement()
+	{
+		std::unordered_map<std::string_view, size_t>::iterator it = this->openNames.find(this->elements.back().name);
+		if (--it->second == 0)
+		{
+			this->openNames.erase(it);
+		}
+		this->elements.pop_back();
+	}
+
+	void XmlValidator::checkPendingAttr()
+	{
+		if (this->hasPendingAttr)
+		{
+			std::string name(this->pendingAttr.chars, this->pendingAttr.size);
+			this->addError(this->pendingAttr.pos, (this->pendingAttrHasEqual ? "Missing value of attribute '" : "Attribute '") + name + (this->pendingAttrHasEqual ? "'" : "' has no value"));
+			this->hasPendingAttr = false;
+		}
+	}
+
+	void XmlValidator::checkTagTerminated()
+	{
+		if (this->inTag)
+		{
+			this->checkPendingAttr();
+			this->addError(this->tagOffset, "Tag <" + std::string(this->tagName) + "> is not terminated");
+			this->inTag = false;
+		}
+	}
+
+	void XmlValidator::checkTerminated(const XmlToken& token, const char* delimiter, const char* what)
+	{
+		std::string_view chars(token.chars, token.size);
+		std::string_view end(delimiter);
+		if (chars.size() < end.size() * 2 || chars.substr(chars.size() - end.size()) != end)
+		{
+			this->addError(token.pos, std::string("Unterminated ") + what);
+		}
+	}
+
+	void XmlValidator::onToken(const XmlToken& token)
+	{
+		switch (token.type)
+		{
+			case XmlTokenType::TagOpening:
+				this->checkTagTerminated();
+				this->inTag = true;
+				this->tagOffset = token.pos;
+				this->tagName = std::string_view(token.chars + 1, token.size - 1);
+				this->attributes.clear();
+				if (this->tagName.empty())
+				{
+					this->addError(token.pos, "Missing tag name");
+					this->inTag = false;
+					break;
+				}
+				this->pushElement(this->tagName, token.pos);
+				break;
+
+			case XmlTokenType::TagClosing:
+			{
+				// Braces needed - declaring variables.
+				this->checkTagTerminated();
+				this->inTag = true;
+				this->tagOffset = token.pos;
+				this->tagName = std::string_view(token.chars + 2, token.size - 2);
+				if (this->elements.empty())
+				{
+					this->addError(token.pos, "Closing tag </" + std::string(this->tagName) + "> has no opening tag");
+					break;
+				}
+
+				if (this->elements.back().name == this->tagName)
+				{
+					this->popElement();
+					break;
+				}
+
+				// Mismatch: when the name matches an outer element, the inner ones were not closed. Else the closing tag is ignored.
+				// The open names are counted, so that stray closing tags do not walk the open elements: each element is walked once, when closed.
+				if (this->openNames.find(this->tagName) == this->openNames.end())
+				{
+					this->addError(token.pos, "Closing tag </" + std::string(this->tagName) + "> does not match <" + std::string(this->elements.back().name) + ">");
+					break;
+				}
+
+				while (this->elements.back().name != this->tagName)
+				{
+					this->addError(this->elements.back().offset, "Element <" + std::string(this->elements.back().name) + "> is not closed before </" + std::string(this->tagName) + ">");
+					this->popElement();
+				}
+				this->popElement();
+				break;
+			}
+
+			case XmlTokenType::TagOpeningEnd:
+			case XmlTokenType::TagClosingEnd:
+				this->checkPendingAttr();
+				this->inTag = false;
+				break;
+
+			case XmlTokenType::TagSelfClosingEnd:
+				this->checkPendingAttr();
+				this->inTag = false;
+				if (!this->elements.empty())
+				{
+					this->popElement();
+				}
+				break;
+
+			case XmlTokenType::AttrName:
+			{
+				// Braces needed - declaring variables.
+				this->checkPendingAttr();
+				std::string_view name(token.chars, token.size);
+				for (const std::string_view& attribute : this->attributes)
+				{
+					if (attribute == name)
+					{
+						this->addError(token.pos, "Duplicated attribute '" + std::string(name) + "'");
+						break;
+					}
+				}
+				this->attributes.push_back(name);
+				this->hasPendingAttr = true;
+				this->pendingAttrHasEqual = false;
+				this->pendingAttr = token;
+				break;
+			}
+
+			case XmlTokenType::Equal:
+				this->pendingAttrHasEqual = true;
+				break;
+
+			case XmlTokenType::AttrValue:
+			{
+				// Braces needed - declaring variables.
+				std::string name(this->pendingAttr.chars, this->pendingAttr.size);
+				char quote = token.chars[0];
+				if (!this->pendingAttrHasEqual)
+				{
+					this->addError(token.pos, "Missing '=' after attribute '" + name + "'");
+				}
+
+				if (quote != '"' && quote != '\'')
+				{
+					this->addError(token.pos, "Value of attribute '" + name + "' is not quoted");
+				}
+				else if (token.size < 2 || token.chars[token.size - 1] != quote)
+				{
+					this->addError(token.pos, "Value of attribute '" + name + "' is not terminated");
+				}
+				this->hasPendingAttr = false;
+				break;
+			}
+
+			case XmlTokenType::Comment:
+				this->checkTagTerminated();
+				this->checkTerminated(token, "-->", "comment");
+				break;
+
+			case XmlTokenType::CDATA:
+				this->checkTagTerminated();
+				this->checkTerminated(token, "]]>", "CDATA section");
+				break;
+
+			case XmlTokenType::Instruction:
+				this->checkTagTerminated();
+				this->checkTerminated(token, (token.chars[1] == '%' ? "%>" : "?>"), "instruction");
+				break;
+
+			case XmlTokenType::DeclarationBeg:
+			case XmlTokenType::DeclarationSelfClosing:
+				this->checkTagTerminated();
+				break;
+
+			case XmlTokenType::Undefined:
+				// Declarations content is not checked.
+				if (token.context.declarationObjects == 0 && token.size > 0)
+				{
+					this->addError(token.pos, "Unexpected character '" + std::string(token.chars, 1) + "'");
+				}
+				break;
+
+			case XmlTokenType::DeclarationEnd:
+			case XmlTokenType::Text:
+			case XmlTokenType::Whitespace:
+			case XmlTokenType::LineBreak:
+			case XmlTokenType::EndOfFile:
+			default:
+				break;
+		}
+	}
+
+	void XmlValidator::finish()
+	{
+		this->checkTagTerminated();
+		while (!this->elements.empty())
+		{
+			this->addError(this->elements.back().offset, "Element <" + std::string(this->elements.back().name) + "> is not closed at end of document");
+			this->popElement();
+		}
+
+		// Errors are reported in document order.
+		std::stable_sort(this->errors.begin(), this->errors.end(), [](const XmlValidationError& a, const XmlValidationError& b) { return a.offset < b.offset; });
+	}
+
+	void XmlValidator::locate(const XmlLineIndex& lines, const XmlLineIndex& sourceLines, const XmlLinePosition& origin)
+	{
+		for (XmlValidationError& error : this->errors)
+		{
+			XmlLinePosition position = lines.positionOf(error.offset);
+			position.column += (position.line == 1 ? origin.column - 1 : 0);
+			position.line += origin.line - 1;
+			error.position = position;
+			try
+			{
+				error.offset = sourceLines.offsetOf(position);
+			}
+			catch (const std::out_of_range&)
+			{
+				// Only line breaks added by the pre-processing have no source offset, keep the closest one.
+				error.offset = sourceLines.offsetOf({ position.line, 1 });
+			}
+		}
+	}
+
+	void XmlValidator::addSourceError(size_t offset, const XmlLinePosition& position, const std::string& message)
+	{
+		std::vector<XmlValidationError>::iterator it = std::upper_bound(this->errors.begin(), this->errors.end(), offset, [](size_t offset, const XmlValidationError& error) { return offset < error.offset; });
+		this->errors.insert(it, { offset, position, message });
+	}
+
+	bool XmlValidator::isValid() const
+	{
+		return this->errors.empty();
+	}
+
+	const std::vector<XmlValidationError>& XmlValidator::getErrors() const
+	{
+		return this->errors;
+	}
+}